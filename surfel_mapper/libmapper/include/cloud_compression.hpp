@@ -0,0 +1,62 @@
+/**
+ *  @file cloud_compression.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ * 
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef CLOUD_COMPRESSION_HPP
+#define CLOUD_COMPRESSION_HPP
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <vector>
+#include <stdint.h>
+
+/**
+* @brief Octree-based compression of colored point clouds 
+*
+* The class wraps pcl::io::OctreePointCloudCompression. Geometry is coded with octree occupancy codes and
+* point precision specified by the user, colors are coded per point. Each cloud is coded independently 
+* (as an intra frame), so the decoder does not depend on previously received data and lost messages do not affect
+* subsequent ones.
+*/
+class CloudCompression {
+	protected:
+		double point_resolution ; /**< @brief precision of coded point coordinates*/
+		double octree_resolution ; /**< @brief resolution of the coding octree*/
+		unsigned int color_bit_resolution ; /**< @brief number of bits per color component*/
+
+	public:
+		/**
+		 * @brief A parametric constructor
+		 *
+		 * @param point_resolution precision of coded point coordinates
+		 * @param octree_resolution resolution of the coding octree (should be larger than point_resolution)
+		 * @param color_bit_resolution number of bits per color component (1-8)
+		 */
+		CloudCompression(double point_resolution, double octree_resolution, unsigned int color_bit_resolution) ;
+
+		/**
+		 * @brief Encodes the point cloud
+		 *
+		 * @param cloud input cloud
+		 * @param data output byte stream
+		 */
+		void encode(const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr &cloud, std::vector<uint8_t> &data) ;
+
+		/**
+		 * @brief Decodes the point cloud 
+		 *
+		 * The coding parameters are stored in the byte stream, so no decoder configuration is necessary
+		 *
+		 * @param data input byte stream
+		 * @param cloud output cloud
+		 */
+		static void decode(const std::vector<uint8_t> &data, pcl::PointCloud<pcl::PointXYZRGB>::Ptr &cloud) ;
+} ;
+
+#endif
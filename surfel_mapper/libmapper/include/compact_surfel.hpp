@@ -0,0 +1,313 @@
+/**
+ *  @file compact_surfel.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef COMPACT_SURFEL_HPP
+#define COMPACT_SURFEL_HPP
+
+#include "point_custom_surfel.hpp"
+#include <pcl/common/point_tests.h>
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+
+/**
+ * @brief Quantized surfel (20 bytes instead of 64 bytes of PointCustomSurfel)
+ *
+ * The position is stored in 16-bit fixed point relative to the origin of the enclosing cube (e.g. a map tile), the normal
+ * in the octahedral encoding with 16 bits per coordinate, the radius as a half-precision float and the confidence and
+ * the observation count saturated at 16 bits. For a 6.4 m cube the position is kept with 0.1 mm precision. The encoding is
+ * used for the tiles paged out to the disk (SurfelTileCache), the scene storage in memory uses PackedSurfel.
+ */
+struct CompactSurfel {
+	uint16_t position[3] ; /**< @brief position in the cube (0 - cube origin, 65535 - opposite cube corner) */
+	uint16_t normal[2] ; /**< @brief octahedral encoding of the normal */
+	uint16_t radius ; /**< @brief radius (half-precision float) */
+	uint32_t rgba ; /**< @brief color */
+	uint16_t confidence ; /**< @brief confidence (saturated) */
+	uint16_t count ; /**< @brief observation count (saturated) */
+} ;
+
+#define PACKED_POSITION_BITS 21 /**< Number of bits of each coordinate of PackedSurfel */
+#define PACKED_POSITION_STEP 0.0005f /**< Quantization step (in meters) of the coordinates of PackedSurfel */
+#define PACKED_POSITION_RANGE ((1 << (PACKED_POSITION_BITS - 1)) * PACKED_POSITION_STEP) /**< Maximum absolute coordinate of PackedSurfel (about 524 m) */
+
+/**
+ * @brief Quantized surfel of the scene storage (22 bytes instead of 64 bytes of PointCustomSurfel)
+ *
+ * Differs from CompactSurfel in the position, which is not relative to an enclosing cube (a surfel in memory is addressed by
+ * its index only): the coordinates are kept in PACKED_POSITION_BITS-bit fixed point with PACKED_POSITION_STEP step, packed into
+ * a 64-bit word whose highest bit marks a removed surfel. All fields are 16-bit words, so that the surfels are not padded.
+ */
+struct PackedSurfel {
+	uint16_t position[4] ; /**< @brief packed coordinates (the highest bit is set for a removed surfel) */
+	uint16_t normal[2] ; /**< @brief octahedral encoding of the normal */
+	uint16_t radius ; /**< @brief radius (half-precision float) */
+	uint16_t rgba[2] ; /**< @brief color */
+	uint16_t confidence ; /**< @brief confidence (saturated) */
+	uint16_t count ; /**< @brief observation count (saturated) */
+} ;
+
+/**
+ * @brief Converts a float to the half-precision float (rounding to the nearest)
+ *
+ * @param value input value
+ * @return half-precision bits
+ */
+inline uint16_t floatToHalf(float value)
+{
+	uint32_t bits ;
+	memcpy(&bits, &value, sizeof(bits)) ;
+	uint32_t sign = (bits >> 16) & 0x8000 ;
+	int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xff) - 127 + 15 ;
+	uint32_t mantissa = bits & 0x7fffff ;
+
+	if (((bits >> 23) & 0xff) == 0xff) //Infinity or NaN
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0) ;
+	if (exponent >= 31) //Overflow
+		return sign | 0x7c00 ;
+	if (exponent <= 0) { //Subnormal half (or zero)
+		if (exponent < -10)
+			return sign ;
+		mantissa |= 0x800000 ;
+		uint32_t shift = 14 - exponent ;
+		uint32_t half = mantissa >> shift ;
+		if ((mantissa >> (shift - 1)) & 1)
+			half++ ;
+		return sign | half ;
+	}
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13) ;
+	if (mantissa & 0x1000)
+		half++ ; //A carry into the exponent gives the correctly rounded value
+	return half ;
+}
+
+/**
+ * @brief Converts a half-precision float to a float
+ *
+ * @param half half-precision bits
+ * @return float value
+ */
+inline float halfToFloat(uint16_t half)
+{
+	uint32_t sign = (half & 0x8000) << 16 ;
+	uint32_t exponent = (half >> 10) & 0x1f ;
+	uint32_t mantissa = half & 0x3ff ;
+	uint32_t bits ;
+	if (exponent == 0) {
+		if (mantissa == 0)
+			bits = sign ;
+		else {
+			//Normalize the subnormal half
+			exponent = 127 - 15 + 1 ;
+			while (!(mantissa & 0x400)) {
+				mantissa <<= 1 ;
+				exponent-- ;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13) ;
+		}
+	} else if (exponent == 31)
+		bits = sign | 0x7f800000 | (mantissa << 13) ;
+	else
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13) ;
+	float value ;
+	memcpy(&value, &bits, sizeof(value)) ;
+	return value ;
+}
+
+/**
+ * @brief Quantizes a value from the [-1, 1] range to 16 bits
+ *
+ * @param value input value
+ * @return quantized value
+ */
+inline uint16_t quantizeSigned(float value)
+{
+	return static_cast<uint16_t>(floor((std::min(1.0f, std::max(-1.0f, value)) * 0.5f + 0.5f) * 65535.0f + 0.5f)) ;
+}
+
+/**
+ * @brief Encodes the normal of a surfel in the octahedral encoding
+ *
+ * @param point input surfel
+ * @param normal output encoded normal
+ */
+inline void encodeNormal(const PointCustomSurfel &point, uint16_t normal[2])
+{
+	//Octahedral projection of the normal (the lower hemisphere is folded over the diagonals)
+	float l1 = fabs(point.normal_x) + fabs(point.normal_y) + fabs(point.normal_z) ;
+	float u = l1 > 0.0f ? point.normal_x / l1 : 0.0f ;
+	float v = l1 > 0.0f ? point.normal_y / l1 : 0.0f ;
+	if (point.normal_z < 0.0f) {
+		float fu = (1.0f - fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f) ;
+		float fv = (1.0f - fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f) ;
+		u = fu ;
+		v = fv ;
+	}
+	normal[0] = quantizeSigned(u) ;
+	normal[1] = quantizeSigned(v) ;
+}
+
+/**
+ * @brief Decodes the normal of a surfel from the octahedral encoding
+ *
+ * @param normal input encoded normal
+ * @param point output surfel (the normal is of unit length)
+ */
+inline void decodeNormal(const uint16_t normal[2], PointCustomSurfel &point)
+{
+	float u = normal[0] / 65535.0f * 2.0f - 1.0f ;
+	float v = normal[1] / 65535.0f * 2.0f - 1.0f ;
+	Eigen::Vector3f n(u, v, 1.0f - fabs(u) - fabs(v)) ;
+	if (n[2] < 0.0f) {
+		n[0] = (1.0f - fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f) ;
+		n[1] = (1.0f - fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f) ;
+	}
+	n.normalize() ;
+	point.normal_x = n[0] ;
+	point.normal_y = n[1] ;
+	point.normal_z = n[2] ;
+	point.data_n[3] = 0.0f ;
+}
+
+/**
+ * @brief Encodes a surfel in the compact representation
+ *
+ * @param point input surfel
+ * @param origin origin of the cube enclosing the surfel
+ * @param side side of the cube
+ * @param compact output compact surfel
+ */
+inline void encodeSurfel(const PointCustomSurfel &point, const Eigen::Vector3f &origin, float side, CompactSurfel &compact)
+{
+	for (int i = 0; i < 3 ; i++) {
+		float t = (point.data[i] - origin[i]) / side ;
+		compact.position[i] = static_cast<uint16_t>(floor(std::min(1.0f, std::max(0.0f, t)) * 65535.0f + 0.5f)) ;
+	}
+
+	encodeNormal(point, compact.normal) ;
+
+	compact.radius = floatToHalf(point.radius) ;
+	compact.rgba = point.rgba ;
+	compact.confidence = static_cast<uint16_t>(std::min<uint32_t>(point.confidence, 0xffff)) ;
+	compact.count = static_cast<uint16_t>(std::min<uint32_t>(point.count, 0xffff)) ;
+}
+
+/**
+ * @brief Decodes a surfel from the compact representation
+ *
+ * @param compact input compact surfel
+ * @param origin origin of the cube enclosing the surfel
+ * @param side side of the cube
+ * @param point output surfel (the normal is of unit length)
+ */
+inline void decodeSurfel(const CompactSurfel &compact, const Eigen::Vector3f &origin, float side, PointCustomSurfel &point)
+{
+	for (int i = 0; i < 3 ; i++)
+		point.data[i] = origin[i] + compact.position[i] / 65535.0f * side ;
+	point.data[3] = 1.0f ;
+
+	decodeNormal(compact.normal, point) ;
+
+	point.radius = halfToFloat(compact.radius) ;
+	point.rgba = compact.rgba ;
+	point.confidence = compact.confidence ;
+	point.count = compact.count ;
+}
+
+/**
+ * @brief Checks if the position of a surfel can be kept in PackedSurfel
+ *
+ * @param point surfel
+ * @return true if all coordinates are within PACKED_POSITION_RANGE (removed surfels are always accepted)
+ */
+inline bool isPackable(const PointCustomSurfel &point)
+{
+	return !pcl::isFinite(point) || (fabs(point.x) < PACKED_POSITION_RANGE && fabs(point.y) < PACKED_POSITION_RANGE && fabs(point.z) < PACKED_POSITION_RANGE) ;
+}
+
+/**
+ * @brief Checks if a packed surfel has been removed
+ *
+ * @param packed packed surfel
+ * @return true if the surfel has been removed
+ */
+inline bool isRemoved(const PackedSurfel &packed)
+{
+	return (packed.position[3] & 0x8000) != 0 ;
+}
+
+/**
+ * @brief Decodes the position of a packed surfel
+ *
+ * @param packed input packed surfel
+ * @return position (NaN for a removed surfel)
+ */
+inline Eigen::Vector3f decodePosition(const PackedSurfel &packed)
+{
+	if (isRemoved(packed))
+		return Eigen::Vector3f::Constant(std::numeric_limits<float>::quiet_NaN()) ;
+	uint64_t word ;
+	memcpy(&word, packed.position, sizeof(word)) ;
+	const uint64_t mask = (1ull << PACKED_POSITION_BITS) - 1 ;
+	Eigen::Vector3f position ;
+	for (int i = 0; i < 3 ; i++)
+		position[i] = (static_cast<int32_t>((word >> (i * PACKED_POSITION_BITS)) & mask) - (1 << (PACKED_POSITION_BITS - 1))) * PACKED_POSITION_STEP ;
+	return position ;
+}
+
+/**
+ * @brief Encodes a surfel in the packed representation of the scene storage
+ *
+ * Coordinates beyond PACKED_POSITION_RANGE are clamped (see isPackable()), a surfel with a NaN position is marked as removed.
+ *
+ * @param point input surfel
+ * @param packed output packed surfel
+ */
+inline void encodeSurfel(const PointCustomSurfel &point, PackedSurfel &packed)
+{
+	uint64_t word = 0 ;
+	if (pcl::isFinite(point)) {
+		const float max_value = static_cast<float>((1 << PACKED_POSITION_BITS) - 1) ;
+		for (int i = 0; i < 3 ; i++) {
+			float q = floor(point.data[i] / PACKED_POSITION_STEP + 0.5f) + (1 << (PACKED_POSITION_BITS - 1)) ;
+			word |= static_cast<uint64_t>(std::min(max_value, std::max(0.0f, q))) << (i * PACKED_POSITION_BITS) ;
+		}
+	} else
+		word = 1ull << 63 ;
+	memcpy(packed.position, &word, sizeof(word)) ;
+
+	encodeNormal(point, packed.normal) ;
+	packed.radius = floatToHalf(point.radius) ;
+	memcpy(packed.rgba, &point.rgba, sizeof(packed.rgba)) ;
+	packed.confidence = static_cast<uint16_t>(std::min<uint32_t>(point.confidence, 0xffff)) ;
+	packed.count = static_cast<uint16_t>(std::min<uint32_t>(point.count, 0xffff)) ;
+}
+
+/**
+ * @brief Decodes a surfel from the packed representation of the scene storage
+ *
+ * @param packed input packed surfel
+ * @param point output surfel (the normal is of unit length)
+ */
+inline void decodeSurfel(const PackedSurfel &packed, PointCustomSurfel &point)
+{
+	point.getVector3fMap() = decodePosition(packed) ;
+	point.data[3] = 1.0f ;
+	decodeNormal(packed.normal, point) ;
+	point.radius = halfToFloat(packed.radius) ;
+	memcpy(&point.rgba, packed.rgba, sizeof(packed.rgba)) ;
+	point.confidence = packed.confidence ;
+	point.count = packed.count ;
+}
+
+#endif
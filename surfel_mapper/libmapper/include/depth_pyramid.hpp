@@ -0,0 +1,149 @@
+/**
+ *  @file depth_pyramid.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef DEPTH_PYRAMID_HPP
+#define DEPTH_PYRAMID_HPP
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <Eigen/Core>
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+/**
+* @brief Pyramid of depth bounds of the current scan used for occlusion culling
+*
+* The base level stores the maximum valid depth in each TILE_SIZE x TILE_SIZE tile of the scan, each next level
+* stores the maximum over 2x2 tiles of the previous one. A box is occluded if all scan readings it projects on
+* are closer to the sensor than the box by more than the margin (or invalid). Surfels inside such a box can only be
+* classified as lying behind the observed surface (or as hitting invalid readings), so they need not be visited by the map update.
+*
+* Valid readings are additionally counted in a summed-area table, so that boxes projecting only on invalid pixels
+* (e.g. windows, black or distant surfaces) are rejected at the pixel resolution.
+*
+* The pyramid is filled pixel by pixel in the row-major order (see DepthPyramid::reset(), DepthPyramid::addPixel() and
+* DepthPyramid::finish()), so that it can be built in the same pass that validates the scan.
+*/
+class DepthPyramid {
+	public:
+		static const int TILE_SIZE = 8 ; /**< @brief side of the base level tile in pixels */
+
+	protected:
+		int width = 0 ; /**< @brief scan width */
+		int height = 0 ; /**< @brief scan height */
+		std::vector<std::vector<float> > levels ; /**< @brief maximum valid depth in tiles (-inf for tiles without valid readings) */
+		std::vector<int> level_widths ; /**< @brief width of each level in tiles */
+		std::vector<int> level_heights ; /**< @brief height of each level in tiles */
+		std::vector<uint32_t> valid_sums ; /**< @brief summed-area table of valid readings ((width + 1) x (height + 1), the first row and column are zero) */
+		Eigen::Matrix<double, 4, 4, Eigen::DontAlign> view_matrix ; /**< @brief world to sensor transformation (unaligned, so that the pyramid can be a member of heap-allocated objects) */
+		double alpha = 0.0 ; /**< @brief x-focal length (fx) */
+		double beta = 0.0 ; /**< @brief y-focal length (fy) */
+		double cx = 0.0 ; /**< @brief x coordinate of the camera optical center */
+		double cy = 0.0 ; /**< @brief y coordinate of the camera optical center */
+		double margin = 0.0 ; /**< @brief depth distance below which a reading still matches the box */
+
+	public:
+		/**
+		 * @brief Starts building the pyramid for a scan of the given size
+		 *
+		 * @param width scan width
+		 * @param height scan height
+		 */
+		void reset(int width, int height) ;
+
+		/**
+		 * @brief Adds a scan pixel (pixels must be added in the row-major order)
+		 *
+		 * @param j pixel column
+		 * @param i pixel row
+		 * @param z depth reading (NaN - invalid reading)
+		 */
+		inline void addPixel(int j, int i, float z) {
+			bool valid = !std::isnan(z) ;
+			int w = width + 1 ;
+			valid_sums[(i + 1) * w + j + 1] = valid + valid_sums[(i + 1) * w + j] + valid_sums[i * w + j + 1] - valid_sums[i * w + j] ;
+			float &tile = levels[0][(i / TILE_SIZE) * level_widths[0] + j / TILE_SIZE] ;
+			if (valid && z > tile)
+				tile = z ;
+		}
+
+		/**
+		 * @brief Completes the pyramid after all pixels were added
+		 */
+		void finish() ;
+
+		/**
+		 * @brief Builds the pyramid from the scan
+		 *
+		 * @param scan organized scan in the sensor frame (invalid readings are NaN)
+		 */
+		void build(const pcl::PointCloud<pcl::PointXYZRGBNormal> &scan) ;
+
+		/**
+		 * @brief Sets the sensor used for projecting boxes
+		 *
+		 * @param view_matrix world to sensor transformation
+		 * @param alpha x-focal length (fx)
+		 * @param beta y-focal length (fy)
+		 * @param cx x coordinate of the camera optical center
+		 * @param cy y coordinate of the camera optical center
+		 * @param margin depth distance below which a reading still matches the box (the surfel update threshold)
+		 */
+		void setCamera(const Eigen::Matrix4d &view_matrix, double alpha, double beta, double cx, double cy, double margin) ;
+
+		/**
+		 * @brief Gets the maximum valid depth in the pixel rectangle (bounded conservatively by tiles)
+		 *
+		 * @param u0 first column
+		 * @param v0 first row
+		 * @param u1 last column
+		 * @param v1 last row
+		 * @return maximum depth (-inf if there are no valid readings)
+		 */
+		float getMaxDepth(int u0, int v0, int u1, int v1) const ;
+
+		/**
+		 * @brief Gets the number of valid readings in the pixel rectangle
+		 *
+		 * @param u0 first column
+		 * @param v0 first row
+		 * @param u1 last column
+		 * @param v1 last row
+		 * @return number of valid readings
+		 */
+		uint32_t getValidCount(int u0, int v0, int u1, int v1) const ;
+
+		/**
+		 * @brief Tests if the box lies entirely behind the observed surface
+		 *
+		 * The box is extended by the margin, since surfel positions are averaged after insertion and may slightly leave their leaf.
+		 *
+		 * @param min_bb minimum corner of the box (world frame)
+		 * @param max_bb maximum corner of the box (world frame)
+		 * @return true if no surfel inside the box can match or remove a scan reading (the box projects only on readings closer
+		 * than the box or on invalid readings)
+		 */
+		bool isOccluded(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb) const ;
+
+		/**
+		 * @brief Gets the number of bytes reserved by the pyramid levels and the summed-area table
+		 *
+		 * @return number of bytes
+		 */
+		size_t getMemoryBytes() const {
+			size_t bytes = valid_sums.capacity() * sizeof(uint32_t) ;
+			for (size_t l = 0; l < levels.size() ; l++)
+				bytes += levels[l].capacity() * sizeof(float) ;
+			return bytes ;
+		}
+} ;
+
+#endif
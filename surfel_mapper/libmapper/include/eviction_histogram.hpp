@@ -0,0 +1,148 @@
+/**
+ *  @file eviction_histogram.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef EVICTION_HISTOGRAM_HPP
+#define EVICTION_HISTOGRAM_HPP
+
+#include "index_pool.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+* @brief Histogram of surfels over the buckets of an eviction criterion
+*
+* Each bucket counts its surfels and links them in a doubly-linked list threaded through the slots of the scene storage,
+* so a surfel is inserted, removed or moved to another bucket in constant time and the surfels of a bucket are visited without
+* scanning the map. Surfels are appended at the tail of their bucket, so within a bucket they are listed in the order
+* in which they entered it (or were moved within it).
+*/
+class EvictionHistogram {
+	public:
+		static const uint32_t NO_BUCKET = 0xffffffffu ; /**< @brief bucket of a slot outside the histogram */
+		static const SurfelIdx NO_SLOT = -1 ; /**< @brief end of a bucket list */
+
+	protected:
+		/**
+		 * @brief Bucket of the histogram
+		 */
+		struct Bucket {
+			size_t count ; /**< @brief number of surfels in the bucket */
+			SurfelIdx head ; /**< @brief first surfel of the bucket list */
+			SurfelIdx tail ; /**< @brief last surfel of the bucket list */
+		} ;
+
+		/**
+		 * @brief Links of a slot of the scene storage
+		 */
+		struct SlotLinks {
+			SurfelIdx prev ; /**< @brief previous surfel of the bucket list */
+			SurfelIdx next ; /**< @brief next surfel of the bucket list */
+			uint32_t bucket ; /**< @brief bucket of the surfel (NO_BUCKET - none) */
+		} ;
+
+		std::vector<Bucket> buckets ; /**< @brief buckets (grown on demand) */
+		std::vector<SlotLinks> slots ; /**< @brief links of each slot of the scene storage (grown on demand) */
+		size_t count ; /**< @brief number of surfels in the histogram */
+
+		/**
+		 * @brief Appends a slot at the tail of a bucket list
+		 *
+		 * @param idx slot index (outside the histogram)
+		 * @param bucket bucket
+		 */
+		void link(SurfelIdx idx, uint32_t bucket) ;
+
+		/**
+		 * @brief Removes a slot from its bucket list
+		 *
+		 * @param idx slot index (in the histogram)
+		 */
+		void unlink(SurfelIdx idx) ;
+
+		/**
+		 * @brief Points the neighbours of a slot (or the ends of its bucket list) at the slot
+		 *
+		 * @param idx slot index
+		 */
+		void relink(SurfelIdx idx) ;
+
+		/**
+		 * @brief Grows the slot links, so that they cover the given slot
+		 *
+		 * @param idx slot index
+		 */
+		void reserveSlot(SurfelIdx idx) ;
+
+	public:
+		/**
+		 * @brief A constructor (creates an empty histogram)
+		 */
+		EvictionHistogram() ;
+
+		/**
+		 * @brief Adds a surfel to a bucket
+		 *
+		 * @param idx slot of the surfel (outside the histogram)
+		 * @param bucket bucket of the surfel
+		 */
+		void insert(SurfelIdx idx, uint32_t bucket) ;
+
+		/**
+		 * @brief Removes a surfel from the histogram (no-op for a slot outside the histogram)
+		 *
+		 * @param idx slot of the surfel
+		 */
+		void erase(SurfelIdx idx) ;
+
+		/**
+		 * @brief Moves a surfel to the tail of a bucket (also if it is already in that bucket)
+		 *
+		 * @param idx slot of the surfel (in the histogram)
+		 * @param bucket new bucket of the surfel
+		 */
+		void update(SurfelIdx idx, uint32_t bucket) ;
+
+		/**
+		 * @brief Exchanges two slots keeping the positions of their surfels in the bucket lists
+		 *
+		 * Either slot may be outside the histogram, so a surfel moved to an empty slot is handled as well.
+		 *
+		 * @param a first slot
+		 * @param b second slot
+		 */
+		void swap(SurfelIdx a, SurfelIdx b) ;
+
+		/**
+		 * @brief Removes all surfels (the memory is kept)
+		 */
+		void clear() ;
+
+		/**
+		 * @brief Frees the memory of the histogram
+		 */
+		void release() ;
+
+		size_t size() const { return count ; } /**< @brief number of surfels in the histogram */
+		uint32_t getBucketCount() const { return buckets.size() ; } /**< @brief number of buckets (including empty ones) */
+		size_t getCount(uint32_t bucket) const { return bucket < buckets.size() ? buckets[bucket].count : 0 ; } /**< @brief number of surfels in a bucket */
+		SurfelIdx getFirst(uint32_t bucket) const { return bucket < buckets.size() ? buckets[bucket].head : NO_SLOT ; } /**< @brief first surfel of a bucket (NO_SLOT if empty) */
+		SurfelIdx getNext(SurfelIdx idx) const { return slots[idx].next ; } /**< @brief surfel following the given one in its bucket (NO_SLOT at the end) */
+		uint32_t getBucket(SurfelIdx idx) const { return (size_t) idx < slots.size() ? slots[idx].bucket : NO_BUCKET ; } /**< @brief bucket of a surfel (NO_BUCKET if outside the histogram) */
+
+		/**
+		 * @brief Gets number of bytes of the buckets and the slot links
+		 *
+		 * @return number of bytes
+		 */
+		size_t getMemoryBytes() const ;
+} ;
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ *  @file index_pool.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef INDEX_POOL_HPP
+#define INDEX_POOL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#ifdef SURFEL_INDEX_64
+typedef int64_t SurfelIdx ; /**< @brief index of a surfel in the scene cloud (negative values mark removed entries) */
+#else
+typedef int SurfelIdx ; /**< @brief index of a surfel in the scene cloud (negative values mark removed entries) */
+#endif
+
+/**
+* @brief Pool of index blocks
+*
+* Blocks of indices are carved out of large chunks. Block capacities are powers of two (size classes), freed blocks
+* are kept on per-class free lists and reused by the subsequent allocations. Blocks larger than the largest
+* class are allocated directly from the heap. The pool is not thread-safe.
+*/
+class IndexPool {
+	public:
+		static const uint32_t MIN_BLOCK_CAPACITY = 8 ; /**< @brief capacity of the smallest block (number of indices) */
+		static const int CLASS_COUNT = 13 ; /**< @brief number of size classes (the largest pooled block holds MIN_BLOCK_CAPACITY << (CLASS_COUNT - 1) indices) */
+		static const size_t CHUNK_SIZE = 1 << 20 ; /**< @brief size of a chunk in bytes */
+
+	protected:
+		/**
+		 * @brief Free block (the link is stored in the block itself)
+		 */
+		struct FreeBlock {
+			FreeBlock *next ; /**< @brief next free block of the same class */
+		} ;
+
+		std::vector<char*> chunks ; /**< @brief allocated chunks */
+		char *chunk_pos ; /**< @brief first unused byte of the current chunk */
+		char *chunk_end ; /**< @brief end of the current chunk */
+		FreeBlock *free_lists[CLASS_COUNT] ; /**< @brief free blocks of each class */
+		size_t used_bytes ; /**< @brief bytes in blocks handed out */
+		size_t heap_bytes ; /**< @brief bytes in blocks allocated directly from the heap (larger than the largest class) */
+
+		/**
+		 * @brief Gets size class of the block
+		 *
+		 * @param capacity requested capacity (rounded up to the class capacity on output)
+		 * @return size class (CLASS_COUNT for blocks allocated from the heap)
+		 */
+		static int getClass(uint32_t &capacity) ;
+
+		/**
+		 * @brief Carves a new block out of the current chunk (allocating a new chunk if necessary)
+		 *
+		 * @param size_class class of the block
+		 * @return new block
+		 */
+		char *carveBlock(int size_class) ;
+
+	public:
+		/**
+		 * @brief A constructor
+		 */
+		IndexPool() ;
+
+		/**
+		 * @brief A destructor (frees all chunks)
+		 */
+		~IndexPool() ;
+
+		/**
+		 * @brief Allocates a block of indices
+		 *
+		 * @param capacity requested capacity (rounded up to the capacity of the block on output)
+		 * @return new block
+		 */
+		SurfelIdx *allocate(uint32_t &capacity) ;
+
+		/**
+		 * @brief Returns a block to the pool
+		 *
+		 * @param block block to be returned
+		 * @param capacity capacity of the block (as returned by IndexPool::allocate())
+		 */
+		void deallocate(SurfelIdx *block, uint32_t capacity) ;
+
+		/**
+		 * @brief Frees all chunks, if no block is in use
+		 */
+		void release() ;
+
+		/**
+		 * @brief Gets number of bytes in blocks handed out
+		 *
+		 * @return number of bytes
+		 */
+		size_t getUsedBytes() const ;
+
+		/**
+		 * @brief Gets number of bytes reserved by the pool (chunks)
+		 *
+		 * @return number of bytes
+		 */
+		size_t getReservedBytes() const ;
+
+		/**
+		 * @brief Gets number of bytes in blocks allocated directly from the heap (not included in the reserved bytes)
+		 *
+		 * @return number of bytes
+		 */
+		size_t getHeapBytes() const ;
+} ;
+
+#endif
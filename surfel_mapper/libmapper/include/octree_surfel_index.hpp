@@ -0,0 +1,191 @@
+/**
+ *  @file octree_surfel_index.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef OCTREE_SURFEL_INDEX_HPP
+#define OCTREE_SURFEL_INDEX_HPP
+
+#include "surfel_index.hpp"
+#include <pcl/octree/octree.h>
+#include <stdint.h>
+
+/**
+* @brief PCL octree holding surfels of the scene storage
+*
+* PCL reads the points inserted into the octree from its input cloud. Surfels of the map are kept in the chunked scene storage
+* instead, so they are inserted together with their index and the octree is left without the input cloud (searches of PCL
+* relying on the input cloud must not be used).
+*/
+class SurfelOctree : public pcl::octree::OctreePointCloudSearch<PointCustomSurfel, SurfelLeaf> {
+	public:
+		/**
+		 * @brief A parametric constructor
+		 *
+		 * @param resolution resolution of the octree (leaf voxel side)
+		 */
+		SurfelOctree(double resolution): pcl::octree::OctreePointCloudSearch<PointCustomSurfel, SurfelLeaf>(resolution) {}
+
+		/**
+		 * @brief Adds a surfel to the leaf of its voxel (the bounding box of the octree is extended if necessary)
+		 *
+		 * @param point surfel to be added
+		 * @param idx index of the surfel in the scene storage
+		 * @return leaf holding the surfel
+		 */
+		SurfelLeaf *addSurfel(const PointCustomSurfel &point, int idx) ;
+} ;
+
+/**
+* @brief Spatial index based on the PCL octree
+*
+* Surfels are inserted into the PCL octree (SurfelOctree). For the frustum culling, the box search and the preview
+* the octree is flattened into a linear (pointerless) representation: nodes are stored in a contiguous array in the depth-first
+* (Morton) order together with their precomputed bounds. The first child of a node immediately follows it and each node
+* stores the end of its subtree, so node visits become a sequential scan of the array. The linear octree is rebuilt
+* lazily, only when new nodes were added to the octree. Subtrees completely inside the frustum are accepted without further tests.
+*
+* Consecutive frusta overlap heavily, so the traversal keeps the cut of the octree from the previous frame: disjoint subtrees
+* classified as inside or outside the frustum and the leaves crossing the frustum boundary, together with the distance they may
+* move keeping the classification. The sensor motion accumulated since the classification bounds the displacement of
+* a subtree relative to the frustum, so only the subtrees near the boundary are reclassified and the cost of the traversal follows
+* the visible region rather than the size of the tree.
+*
+* PCL indexes points of the octree with int, so the index holds at most 2^31 surfels also in SURFEL_INDEX_64 builds
+* (VoxelBlockSurfelIndex has no such limit).
+*/
+class OctreeSurfelIndex : public SurfelIndex {
+	public:
+		typedef SurfelOctree OctreeT ; /**< @brief octree type */
+
+	protected:
+		/**
+		 * @brief Node of the linear octree
+		 */
+		struct LinearNode {
+			Eigen::Vector3d min_bb ; /**< @brief minimum corner of the node voxel */
+			Eigen::Vector3d max_bb ; /**< @brief maximum corner of the node voxel */
+			uint32_t subtree_end ; /**< @brief index of the first node following the subtree of this node */
+			uint32_t depth ; /**< @brief depth of the node (0 - root) */
+			SurfelLeaf *leaf ; /**< @brief leaf container (NULL for branch nodes) */
+		} ;
+
+		/**
+		 * @brief Subtree classified against the frustum in the last traversal
+		 */
+		struct CutEntry {
+			uint32_t node ; /**< @brief index of the subtree root in the linear octree */
+			int classification ; /**< @brief frustum classification of the subtree (PCL_INTERSECT_FRUSTUM - a leaf crossing the frustum boundary or a subtree to be reclassified) */
+			double margin ; /**< @brief distance the subtree may move relative to the frustum keeping the classification */
+			double rotation_motion ; /**< @brief accumulated sensor rotation at the time of the classification */
+			double translation_motion ; /**< @brief accumulated sensor translation at the time of the classification */
+		} ;
+
+		double resolution ; /**< @brief resolution of the octree (leaf voxel side)*/
+		const SurfelStorage *storage ; /**< @brief indexed storage */
+		OctreeT octree ; /**< @brief Octree organizing surfels in the cloud */
+		std::vector<LinearNode> linear_nodes ; /**< @brief octree nodes in the depth-first order */
+		bool linear_valid ; /**< @brief is the linear octree in sync with the octree */
+		size_t linear_leaf_count ; /**< @brief number of octree leaves at the time the linear octree was built */
+		size_t linear_branch_count ; /**< @brief number of octree branches at the time the linear octree was built */
+		std::vector<CutEntry> cut ; /**< @brief subtrees covering the octree classified in the last traversal (in the linear order) */
+		bool cut_valid ; /**< @brief can the cut be reused in the next traversal */
+		size_t full_cut_size ; /**< @brief size of the cut after the last traversal from the root */
+		Eigen::Vector3d last_origin ; /**< @brief sensor position in the last traversal */
+		Eigen::Matrix3d last_rotation ; /**< @brief world to sensor rotation in the last traversal */
+		double rotation_motion ; /**< @brief accumulated sensor rotation (sum of the largest displacements of a unit vector between frames) */
+		double translation_motion ; /**< @brief accumulated sensor path length */
+
+		/**
+		 * @brief Rebuilds the linear octree if the structure of the octree changed
+		 */
+		void updateLinearOctree() ;
+
+		/**
+		 * @brief Moves the cut to the rebuilt linear octree
+		 *
+		 * Subtrees are matched by their voxels. Subtrees that appeared outside the cut are added to it for reclassification.
+		 *
+		 * @param old_nodes linear octree the cut refers to
+		 */
+		void remapCut(const std::vector<LinearNode> &old_nodes) ;
+
+		/**
+		 * @brief Classifies the subtree against the frustum, collecting visible leaves
+		 *
+		 * @param root index of the subtree root
+		 * @param frustum view frustum
+		 * @param leaves output leaves
+		 * @param new_cut classified subtrees are appended to this cut
+		 * @return number of nodes tested
+		 */
+		unsigned int classifySubtree(size_t root, const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves, std::vector<CutEntry> &new_cut) ;
+
+		/**
+		 * @brief Collects leaves of a subtree inside the frustum (skipping the occluded ones)
+		 *
+		 * @param root index of the subtree root
+		 * @param frustum view frustum
+		 * @param leaves output leaves
+		 * @return number of nodes tested for occlusion
+		 */
+		unsigned int collectSubtree(size_t root, const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves) ;
+
+		/**
+		 * @brief Checks if the sensor motion since the classification of the subtree could not change it
+		 *
+		 * @param entry classified subtree
+		 * @param frustum current view frustum
+		 * @return true if the classification still holds
+		 */
+		bool isClassificationValid(const CutEntry &entry, const ViewFrustum &frustum) const ;
+
+		/**
+		 * @brief Compute an average color for the voxel
+		 *
+		 * @param begin index of the linear octree node associated with the voxel
+		 * @param end end of the subtree of the node
+		 * @param color_samples number of samples in leaf used for computing the voxel color
+		 * @param point this routine fill the color of this point
+		 */
+		void computeVoxelColor(size_t begin, size_t end, int color_samples, pcl::PointXYZRGB &point) ;
+
+	public:
+		/**
+		 * @brief A parametric constructor
+		 *
+		 * @param resolution resolution of the octree (leaf voxel side)
+		 */
+		OctreeSurfelIndex(double resolution) ;
+
+		virtual void setInputStorage(const SurfelStorage *storage) ;
+		virtual void addPointsFromInputStorage() ;
+		virtual void addPointFromStorage(SurfelIdx idx) ;
+		virtual unsigned int getVisibleLeaves(const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves) ;
+		virtual void getLeaves(std::vector<SurfelLeaf*> &leaves) ;
+		virtual void getOrderedLeaves(std::vector<SurfelLeaf*> &leaves) { getLeaves(leaves) ; } //The linear octree is in the Morton order
+		virtual void boxSearch(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<SurfelIdx> &k_indices) ;
+		virtual void getPreview(unsigned int level, double preview_resolution, int color_samples, pcl::PointCloud<pcl::PointXYZRGB> &cloud) ;
+		virtual void getMemoryUsage(IndexMemoryUsage &usage) const ;
+
+		/**
+		 * @brief Gives access to the underlying octree
+		 *
+		 * @return the octree
+		 */
+		OctreeT &getOctree() ;
+
+		/**
+		 * @brief Gets number of nodes in the linear octree (the linear octree is brought in sync first)
+		 *
+		 * @return number of nodes
+		 */
+		size_t getLinearNodeCount() ;
+} ;
+
+#endif
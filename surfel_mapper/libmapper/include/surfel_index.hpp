@@ -0,0 +1,455 @@
+/**
+ *  @file surfel_index.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef SURFEL_INDEX_HPP
+#define SURFEL_INDEX_HPP
+
+#include "point_custom_surfel.hpp"
+#include "index_pool.hpp"
+#include "surfel_storage.hpp"
+#include "depth_pyramid.hpp"
+#include <pcl/point_cloud.h>
+#include <pcl/octree/octree_container.h>
+#include <Eigen/Core>
+#include <vector>
+
+/**
+ * @brief Leaf of the surfel spatial index
+ *
+ * Holds indices of surfels falling into a single leaf voxel. The same leaf type is used by all spatial index
+ * backends (it also serves as the leaf container of the PCL octree), so the map update can process leaves
+ * independently of the backend.
+ *
+ * Indices are of the SurfelIdx type (64-bit, if the library is built with SURFEL_INDEX_64). The PCL octree container
+ * interface is kept for the int indices used by PCL. A few indices are stored inline in the leaf (as many as fit
+ * into the same 24 bytes for both index widths). Larger leaves keep their indices in blocks drawn from the shared
+ * IndexPool, so that millions of leaves do not need separate heap allocations. Blocks of destroyed leaves are returned
+ * to the pool and reused. The pool is shared by all leaves, so leaves should be modified from a single thread only.
+ *
+ * After the scene storage has been reordered the indices of most leaves are consecutive. Such a leaf is switched to the range
+ * representation: only the first index and the count are kept and the storage is returned to the pool. Indices of both
+ * representations are read with getIndex() (or the const operator[]). Appending the index following the range and removing
+ * the first or the last index keep the range, other changes (including the non-const access to the storage) switch the leaf
+ * back to the explicit list.
+ *
+ * A leaf can be marked as frozen by the map update once its surfels have converged. The leaf also keeps the index of the frame
+ * in which its surfels were last observed, so that leaves outside the active window can be skipped by the map update. Adding
+ * an index thaws the leaf and clears the frame index (the leaf is processed in the next update).
+ */
+class SurfelLeaf : public pcl::octree::OctreeContainerBase {
+	public:
+		static const uint32_t INLINE_CAPACITY = 24 / sizeof(SurfelIdx) ; /**< @brief number of indices stored inline */
+		static const uint32_t RANGE_CAPACITY = 0 ; /**< @brief capacity marking the range representation */
+
+		/**
+		 * @brief A constructor (creates an empty leaf)
+		 */
+		SurfelLeaf() ;
+
+		/**
+		 * @brief A copy constructor
+		 *
+		 * @param other leaf to copy
+		 */
+		SurfelLeaf(const SurfelLeaf &other) ;
+
+		/**
+		 * @brief A move constructor
+		 *
+		 * @param other leaf to move (left empty)
+		 */
+		SurfelLeaf(SurfelLeaf &&other) noexcept ;
+
+		/**
+		 * @brief A destructor (returns the storage to the pool)
+		 */
+		virtual ~SurfelLeaf() ;
+
+		/**
+		 * @brief Copy assignment
+		 *
+		 * @param other leaf to copy
+		 * @return this leaf
+		 */
+		SurfelLeaf &operator=(const SurfelLeaf &other) ;
+
+		/**
+		 * @brief Move assignment
+		 *
+		 * @param other leaf to move (left empty)
+		 * @return this leaf
+		 */
+		SurfelLeaf &operator=(SurfelLeaf &&other) noexcept ;
+
+		/**
+		 * @brief Creates a copy of the leaf
+		 *
+		 * @return pointer to the new leaf
+		 */
+		virtual SurfelLeaf *deepCopy() const { return new SurfelLeaf(*this) ; }
+
+		/**
+		 * @brief Compares leaves
+		 *
+		 * @param other leaf to compare with
+		 * @return true if the leaves hold the same indices
+		 */
+		virtual bool operator==(const pcl::octree::OctreeContainerBase &other) const ;
+
+		/**
+		 * @brief Gets number of indices (octree container interface)
+		 *
+		 * @return number of indices
+		 */
+		virtual size_t getSize() const { return count ; }
+
+		/**
+		 * @brief Removes all indices and returns the storage to the pool
+		 */
+		virtual void reset() ;
+
+		/**
+		 * @brief Appends an index
+		 *
+		 * @param idx index to be added
+		 */
+		void addPointIndex(SurfelIdx idx) ;
+
+		/**
+		 * @brief Gets the last index (octree container interface)
+		 *
+		 * @param idx output index
+		 */
+		template <typename IndexT>
+		void getPointIndex(IndexT &idx) const
+		{
+			if (count > 0)
+				idx = static_cast<IndexT>(getIndex(count - 1)) ;
+		}
+
+		/**
+		 * @brief Appends all indices to the vector (octree container interface, also used with int indices by PCL)
+		 *
+		 * @param indices output vector
+		 */
+		template <typename IndexT>
+		void getPointIndices(std::vector<IndexT> &indices) const
+		{
+			if (isRange()) {
+				for (uint32_t i = 0; i < count ; i++)
+					indices.push_back(static_cast<IndexT>(range_start + static_cast<SurfelIdx>(i))) ;
+			} else
+				indices.insert(indices.end(), data(), data() + count) ;
+		}
+
+		/**
+		 * @brief Shrinks the leaf to the given number of indices
+		 *
+		 * Storage no longer needed is returned to the pool.
+		 *
+		 * @param new_size new number of indices (not greater than the current one)
+		 */
+		void resize(size_t new_size) ;
+
+		/**
+		 * @brief Removes an index (the order of the remaining indices is kept)
+		 *
+		 * @param idx index to be removed
+		 * @return true if the index was found
+		 */
+		bool removePointIndex(SurfelIdx idx) ;
+
+		/**
+		 * @brief Switches the leaf to the range representation if its indices are consecutive
+		 *
+		 * @return true if the leaf is a range
+		 */
+		bool packRange() ;
+
+		/**
+		 * @brief Switches the leaf back to the explicit list of indices (no-op for an explicit list)
+		 */
+		void unpackRange() { if (isRange()) expandRange() ; }
+
+		/**
+		 * @brief Marks the leaf as frozen (converged) or thaws it
+		 *
+		 * @param frozen true - freezes the leaf, false - thaws the leaf
+		 */
+		void setFrozen(bool frozen) { this->frozen = frozen ; }
+
+		bool isFrozen() const { return frozen ; } /**< @brief is the leaf frozen */
+
+		/**
+		 * @brief Sets the index of the frame in which surfels of the leaf were last observed
+		 *
+		 * @param last_observed frame index (0 - not known, surfels were added since the leaf was last processed)
+		 */
+		void setLastObserved(uint32_t last_observed) { this->last_observed = last_observed ; }
+
+		uint32_t getLastObserved() const { return last_observed ; } /**< @brief index of the frame in which surfels of the leaf were last observed (0 - not known) */
+		size_t size() const { return count ; } /**< @brief number of indices */
+		bool empty() const { return count == 0 ; } /**< @brief is the leaf empty */
+		bool isRange() const { return capacity == RANGE_CAPACITY ; } /**< @brief are the indices kept as a range */
+		SurfelIdx getIndex(size_t i) const { return isRange() ? range_start + static_cast<SurfelIdx>(i) : data()[i] ; } /**< @brief i-th index (in either representation) */
+		SurfelIdx *begin() { unpackRange() ; return data() ; } /**< @brief first index (a range is switched to the explicit list) */
+		SurfelIdx *end() { unpackRange() ; return data() + count ; } /**< @brief end of indices (a range is switched to the explicit list) */
+		SurfelIdx &operator[](size_t i) { unpackRange() ; return data()[i] ; } /**< @brief i-th index (a range is switched to the explicit list) */
+		SurfelIdx operator[](size_t i) const { return getIndex(i) ; } /**< @brief i-th index */
+
+		/**
+		 * @brief Gets the pool of index blocks shared by all leaves
+		 *
+		 * @return the pool
+		 */
+		static IndexPool &getPool() ;
+
+	protected:
+		uint32_t count ; /**< @brief number of indices */
+		uint32_t capacity ; /**< @brief capacity of the storage (INLINE_CAPACITY if indices are stored inline, RANGE_CAPACITY for a range) */
+		bool frozen ; /**< @brief are the surfels of the leaf converged (skipped by the averaging step of the map update) */
+		uint32_t last_observed ; /**< @brief index of the frame in which surfels of the leaf were last observed (0 - not known) */
+		union {
+			SurfelIdx inline_indices[INLINE_CAPACITY] ; /**< @brief indices stored inline */
+			SurfelIdx *block ; /**< @brief block of indices from the pool */
+			SurfelIdx range_start ; /**< @brief first index of a range */
+		} ;
+
+		SurfelIdx *data() { return (capacity > INLINE_CAPACITY) ? block : inline_indices ; } /**< @brief storage of indices */
+		const SurfelIdx *data() const { return (capacity > INLINE_CAPACITY) ? block : inline_indices ; } /**< @brief storage of indices */
+
+		/**
+		 * @brief Moves the indices to a storage of the given capacity
+		 *
+		 * @param new_capacity minimum capacity of the new storage
+		 */
+		void reallocate(uint32_t new_capacity) ;
+
+		/**
+		 * @brief Stores the indices of the range in the explicit list
+		 */
+		void expandRange() ;
+} ;
+
+/**
+ * @brief View frustum used for selecting the visible part of the map
+ *
+ * Boxes are tested with the center/half-extent test. Hierarchical traversals pass the mask of planes still to be tested
+ * from the parent to its children, since a child cannot cross a plane its parent lies entirely inside of. Optionally,
+ * boxes hidden behind the surface observed in the current scan can be rejected using depth bounds of the scan.
+ */
+struct ViewFrustum {
+	static const unsigned int ALL_PLANES = 0x3f ; /**< @brief plane mask with all six planes */
+
+	double planes[24] ; /**< @brief frustum planes (as returned by pcl::visualization::getViewFrustum, normalized to unit normals) */
+	double abs_normals[18] ; /**< @brief absolute values of the plane normal components */
+	Eigen::Vector3d min_bb ; /**< @brief minimum corner of the frustum bounding box */
+	Eigen::Vector3d max_bb ; /**< @brief maximum corner of the frustum bounding box */
+	Eigen::Vector3d origin ; /**< @brief sensor position (world frame) */
+	Eigen::Matrix3d rotation ; /**< @brief world to sensor rotation */
+	bool pose_valid = false ; /**< @brief is the sensor pose set (required for reusing classifications between frames) */
+	bool enabled = true ; /**< @brief if turned off, the whole space is treated as being inside the frustum */
+	const DepthPyramid *depth_bounds = NULL ; /**< @brief depth bounds of the current scan used for occlusion culling (NULL - no occlusion culling) */
+
+	/**
+	 * @brief Computes frustum planes and bounding box
+	 *
+	 * @param projection_view projection-view matrix of the sensor
+	 */
+	void set(const Eigen::Matrix4d &projection_view) ;
+
+	/**
+	 * @brief Sets the sensor pose the frustum belongs to
+	 *
+	 * @param view_matrix world to sensor transformation
+	 */
+	void setPose(const Eigen::Matrix4d &view_matrix) ;
+
+	/**
+	 * @brief Tests a box against the frustum
+	 *
+	 * @param min_bb minimum corner of the box
+	 * @param max_bb maximum corner of the box
+	 * @return pcl::visualization::PCL_INSIDE_FRUSTUM, PCL_INTERSECT_FRUSTUM or PCL_OUTSIDE_FRUSTUM
+	 */
+	int cull(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb) const ;
+
+	/**
+	 * @brief Tests a box against the selected frustum planes
+	 *
+	 * The near plane is tested first, so boxes behind the sensor are rejected after a single test.
+	 *
+	 * @param min_bb minimum corner of the box
+	 * @param max_bb maximum corner of the box
+	 * @param plane_mask planes to be tested (bit i - plane i), on output the planes the box is not entirely inside of
+	 * @return pcl::visualization::PCL_INSIDE_FRUSTUM, PCL_INTERSECT_FRUSTUM or PCL_OUTSIDE_FRUSTUM
+	 */
+	int cull(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb, unsigned int &plane_mask) const ;
+
+	/**
+	 * @brief Tests a box against the selected frustum planes and gives the distance by which the box may move keeping the result
+	 *
+	 * @param min_bb minimum corner of the box
+	 * @param max_bb maximum corner of the box
+	 * @param plane_mask planes to be tested (bit i - plane i), on output the planes the box is not entirely inside of
+	 * @param margin on input the lower bound of distances from the box to the planes not in the mask (the parent margin),
+	 * on output the distance from the rejecting plane (outside boxes) or the minimum distance from the planes the box is inside of
+	 * @return pcl::visualization::PCL_INSIDE_FRUSTUM, PCL_INTERSECT_FRUSTUM or PCL_OUTSIDE_FRUSTUM
+	 */
+	int cull(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb, unsigned int &plane_mask, double &margin) const ;
+
+	/**
+	 * @brief Gets the distance a box may move before it leaves the frustum
+	 *
+	 * @param min_bb minimum corner of the box
+	 * @param max_bb maximum corner of the box
+	 * @return the smallest distance from the box to the outer side of a plane (negative for boxes outside the frustum)
+	 */
+	double getExitDistance(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb) const ;
+
+	/**
+	 * @brief Tests if a box is hidden behind the surface observed in the current scan
+	 *
+	 * @param min_bb minimum corner of the box
+	 * @param max_bb maximum corner of the box
+	 * @return true if the box is occluded (always false if occlusion culling is off)
+	 */
+	bool isOccluded(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb) const { return depth_bounds != NULL && depth_bounds->isOccluded(min_bb, max_bb) ; }
+} ;
+
+/**
+ * @brief Type of the spatial index organizing surfels in the map
+ */
+enum SpatialIndexType {
+	SPATIAL_INDEX_OCTREE, /**< PCL octree */
+	SPATIAL_INDEX_VOXEL_BLOCKS /**< hashed fixed-size voxel blocks */
+} ;
+
+/**
+ * @brief Memory used by the nodes of a spatial index
+ */
+struct IndexMemoryUsage {
+	size_t branch_count = 0 ; /**< @brief number of branch nodes (voxel blocks for the voxel-block index)*/
+	size_t leaf_count = 0 ; /**< @brief number of leaves*/
+	size_t branch_bytes = 0 ; /**< @brief bytes of the branch nodes and the structures for traversing them (the linear octree, the hash table)*/
+	size_t leaf_bytes = 0 ; /**< @brief bytes of the leaves (including the indices stored inline and the leaf of each slot, excluding the pooled index storage)*/
+} ;
+
+/**
+* @brief Interface of the spatial index organizing surfels in the map
+*
+* The index stores indices of the surfels from the input (scene) storage grouped in leaf voxels. Removed surfels
+* are expected to be NaN-ed in the storage and removed from their leaves by the user. The leaf holding each slot is recorded,
+* so that a single surfel is removed without searching the leaves. A user moving surfels between slots updates the record.
+*/
+class SurfelIndex {
+	protected:
+		std::vector<SurfelLeaf*> slot_leaves ; /**< @brief leaf holding each slot of the input storage (NULL - none, stale for removed surfels) */
+
+	public:
+		/**
+		 * @brief A destructor
+		 */
+		virtual ~SurfelIndex() {}
+
+		/**
+		 * @brief Sets the storage indexed (the index must be empty)
+		 *
+		 * @param storage input storage (must outlive the index)
+		 */
+		virtual void setInputStorage(const SurfelStorage *storage) = 0 ;
+
+		/**
+		 * @brief Adds all valid (finite) surfels from the input storage to the index
+		 */
+		virtual void addPointsFromInputStorage() = 0 ;
+
+		/**
+		 * @brief Adds a surfel stored in the input storage to the index
+		 *
+		 * Used both for surfels appended to the storage and for surfels written into the slots of removed (NaN-ed) ones.
+		 *
+		 * @param idx index of the surfel in the input storage
+		 */
+		virtual void addPointFromStorage(SurfelIdx idx) = 0 ;
+
+		/**
+		 * @brief Collects leaves that are (at least partially) inside the view frustum
+		 *
+		 * @param frustum view frustum
+		 * @param leaves output leaves
+		 * @return number of index nodes (octree nodes or voxel blocks and leaves) examined
+		 */
+		virtual unsigned int getVisibleLeaves(const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves) = 0 ;
+
+		/**
+		 * @brief Collects all leaves of the index
+		 *
+		 * @param leaves output leaves
+		 */
+		virtual void getLeaves(std::vector<SurfelLeaf*> &leaves) = 0 ;
+
+		/**
+		 * @brief Collects all leaves of the index in the Morton (Z-order) of their voxels
+		 *
+		 * Leaves keep their addresses until the index is destroyed, also when new leaves are added.
+		 *
+		 * @param leaves output leaves
+		 */
+		virtual void getOrderedLeaves(std::vector<SurfelLeaf*> &leaves) = 0 ;
+
+		/**
+		 * @brief Gets indices of points from the bounding box
+		 *
+		 * @param min_pt minimum corner of the bounding box
+		 * @param max_pt maximum corner of the bounding box
+		 * @param k_indices selected indices are stored in this argument
+		 */
+		virtual void boxSearch(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<SurfelIdx> &k_indices) = 0 ;
+
+		/**
+		 * @brief Computes downsampled version of the indexed surfels
+		 *
+		 * Each voxel of the preview is converted to a single point with color averaged from several samples
+		 *
+		 * @param level preview level (0 - voxels of preview_resolution size, each next level doubles the voxel side)
+		 * @param preview_resolution resolution of the preview (the voxel side is rounded down to the resolution available in the index)
+		 * @param color_samples number of samples in leaf used for computing the voxel color
+		 * @param cloud output downsampled cloud
+		 */
+		virtual void getPreview(unsigned int level, double preview_resolution, int color_samples, pcl::PointCloud<pcl::PointXYZRGB> &cloud) = 0 ;
+
+		/**
+		 * @brief Gets memory used by the index nodes
+		 *
+		 * Node counts are maintained on node creation, so no traversal is needed.
+		 *
+		 * @param usage output memory usage
+		 */
+		virtual void getMemoryUsage(IndexMemoryUsage &usage) const = 0 ;
+
+		/**
+		 * @brief Gets the leaf holding a surfel
+		 *
+		 * @param idx index of the surfel in the input storage
+		 * @return leaf of the surfel (undefined for a removed surfel)
+		 */
+		SurfelLeaf *getLeaf(SurfelIdx idx) const { return (size_t) idx < slot_leaves.size() ? slot_leaves[idx] : NULL ; }
+
+		/**
+		 * @brief Records the leaf holding a slot (after the surfel has been added or moved to the slot)
+		 *
+		 * @param idx index of the slot in the input storage
+		 * @param leaf leaf holding the slot
+		 */
+		void setLeaf(SurfelIdx idx, SurfelLeaf *leaf) ;
+} ;
+
+#endif
@@ -13,11 +13,22 @@
 
 #include "point_custom_surfel.hpp"
 #include <pcl/common/common_headers.h>
-#include <pcl/octree/octree.h>
+#include "surfel_index.hpp"
+#include "surfel_storage.hpp"
+#include "tile_cache.hpp"
+#include "eviction_histogram.hpp"
+#include <boost/shared_ptr.hpp>
+#include <set>
+#include <map>
 #include "logger.hpp"
 
 #define CLOUD_WIDTH 640 /**< Default cloud width */
 #define CLOUD_HEIGHT 480 /**< Default cloud height */
+#define MAX_COVERAGE_RADIUS 8 /**< Maximum radius (in pixels) of the surfel disc marked as covered */
+#define MIN_EVICTION_FRACTION 0.01 /**< Minimum fraction of the surfel budget freed by an eviction */
+#define MAX_EVICTION_FRACTION 0.9 /**< Maximum fraction of the surfel budget freed by an eviction */
+#define EVICTION_CONFIDENCE_EXACT 64 /**< Confidences below this value have their own eviction buckets (larger ones share a bucket per power of two) */
+#define EVICTION_CELL_LEVEL 3 /**< Side of a cell (distance shell) of the distance policy as the number of doublings of OCTREE_RESOLUTION */
 
 /**
  * @brief Camera intrinsic parameters
@@ -29,13 +40,64 @@ typedef struct {
 	double cy ; /**< @brief y coordinate of the camera optical center*/
 } CameraParams ;
 
+/**
+ * @brief Changes introduced to the surfel map by a single keyframe
+ *
+ * The indices refer to the scene storage (surfels are retrieved with SurfelMapper::getSurfels()). Within a single delta an index appears
+ * in at most one of the added, updated and removed sets.
+ */
+struct SurfelMapDelta {
+	unsigned long seq = 0 ; /**< @brief sequence number of the delta (incremented for each integrated keyframe and map reset)*/
+	std::vector<SurfelIdx> added ; /**< @brief indices of surfels added to the map*/
+	std::vector<SurfelIdx> updated ; /**< @brief indices of surfels updated with the keyframe data*/
+	std::vector<SurfelIdx> removed ; /**< @brief indices of surfels removed from the map*/
+
+	/**
+	 * @brief Clears the index sets (the sequence number is preserved)
+	 */
+	void clear() { added.clear() ; updated.clear() ; removed.clear() ; }
+} ;
+
+/**
+ * @brief Memory used by the map components (bytes reserved, including the capacity not filled yet)
+ */
+struct MemoryReport {
+	size_t surfel_bytes = 0 ; /**< @brief chunks of the scene storage (surfels including removed ones and the frames of their last observation)*/
+	size_t slot_list_bytes = 0 ; /**< @brief lists of slots of removed surfels, the eviction histogram (and the reordering pass state)*/
+	size_t branch_bytes = 0 ; /**< @brief branch nodes of the spatial index (voxel blocks for the voxel-block index) and the structures for traversing them*/
+	size_t leaf_bytes = 0 ; /**< @brief leaves of the spatial index (including the indices stored inline)*/
+	size_t leaf_index_bytes = 0 ; /**< @brief pooled and heap-allocated index storage of leaves outgrowing the inline capacity (shared by all maps in the process)*/
+	size_t preview_bytes = 0 ; /**< @brief downsampled preview cloud*/
+	size_t scratch_bytes = 0 ; /**< @brief clouds and buffers used for integrating a single frame (sizes of the last integrated frame)*/
+	size_t live_surfels = 0 ; /**< @brief number of surfels in the map*/
+	size_t dead_surfels = 0 ; /**< @brief number of slots of removed surfels in the scene storage*/
+	size_t branch_count = 0 ; /**< @brief number of branch nodes of the spatial index (voxel blocks for the voxel-block index)*/
+	size_t leaf_count = 0 ; /**< @brief number of leaves of the spatial index*/
+
+	/**
+	 * @brief Gets the total number of bytes of all components
+	 *
+	 * @return number of bytes
+	 */
+	size_t getTotalBytes() const { return surfel_bytes + slot_list_bytes + branch_bytes + leaf_bytes + leaf_index_bytes + preview_bytes + scratch_bytes ; }
+} ;
+
+/**
+ * @brief Order in which surfels are evicted from the map exceeding the surfel budget
+ */
+enum EvictionPolicy {
+	EVICT_LOWEST_CONFIDENCE, /**< surfels with the lowest confidence first (the least recently observed among those in the same confidence bucket) */
+	EVICT_LEAST_RECENTLY_OBSERVED, /**< surfels observed the longest time ago first */
+	EVICT_FARTHEST /**< surfels in the cells farthest from the current sensor position first (the least recently observed within a cell) */
+} ;
+
 /**
 * @brief This is the main class rempresenting surfel map  
 *
 * This class enables to create surfel maps basing on the data from RGBD sensor. Input is formed by RGBD frames
 * with sensor orientation specified. The frames are sequentially integrated into the surfel map. The output
-* is either the full surfel cloud or downsampled preview cloud. The class use octree coupled with frustum
-* for efficient map update.
+* is either the full surfel cloud or downsampled preview cloud. The class use a spatial index (octree or hashed voxel blocks)
+* coupled with frustum for efficient map update.
 */
 class SurfelMapper {
 	protected:
@@ -52,9 +114,32 @@ class SurfelMapper {
 		int CONFIDENCE_THRESHOLD1 = 5 ; /**< @brief confidence threshold used for establishing reliable surfels*/
 		double MIN_SCAN_ZNORMAL = 0.2f ; /**< @brief acceptable minimum z-component of scan normal*/
 		bool USE_FRUSTUM = true ; /**< @brief use frustum or no*/
-		int SCENE_SIZE = 3e7 ; /**< @brief preallocated size of scene*/
+		bool USE_OCCLUSION_CULLING = true ; /**< @brief skip index nodes hidden behind the surface observed in the scan or no*/
+		bool USE_FREEZING = false ; /**< @brief freeze leaves with converged surfels or no*/
+		int FREEZE_CONFIDENCE = 20 ; /**< @brief minimum confidence of surfels in a leaf to be frozen*/
+		double FREEZE_MAX_RESIDUAL = 0.0025 ; /**< @brief maximum distance between a surfel and its matching reading in a leaf to be frozen*/
+		int ACTIVE_WINDOW = 0 ; /**< @brief number of recent frames in which a surfel must have been observed to take part in the update (0 - all surfels take part)*/
+		double MIN_NEW_COVERAGE = 0.0 ; /**< @brief minimum estimated fraction of frame readings not covered by the map for the frame to be integrated (0 - all frames are integrated)*/
+		int COVERAGE_SAMPLE_STEP = 8 ; /**< @brief pixel step of the readings sampled for the coverage estimate*/
+		double SURFEL_SPACING = 0.0 ; /**< @brief target spacing of added surfels (0 - a surfel is added for each uncovered reading)*/
+		double CONSOLIDATION_BUDGET = 0.0 ; /**< @brief time (in seconds) spent on merging surfels after each keyframe integration (0 - no merging)*/
+		double MERGE_RADIUS_RATIO = 0.5 ; /**< @brief maximum distance between centers of merged surfels relative to the smaller radius*/
+		double MERGE_MIN_NORMAL_DOT = 0.95 ; /**< @brief minimum cosine of the angle between normals of merged surfels*/
+		size_t MAX_SURFELS = 0 ; /**< @brief maximum number of surfels in the map (0 - no limit)*/
+		EvictionPolicy EVICTION_POLICY = EVICT_LOWEST_CONFIDENCE ; /**< @brief order of evicting surfels from the map exceeding MAX_SURFELS*/
+		double EVICTION_FRACTION = 0.1 ; /**< @brief fraction of MAX_SURFELS freed by each eviction (below the budget)*/
+		double PAGING_RADIUS = 0.0 ; /**< @brief distance from the sensor beyond which map tiles are paged out to the disk (0 - no paging)*/
+		int PAGING_TILE_LEVEL = 5 ; /**< @brief side of a map tile as the number of doublings of OCTREE_RESOLUTION*/
+		std::string PAGING_DIRECTORY = "/tmp/surfel_tiles" ; /**< @brief directory of the tiles paged out*/
+		bool PAGING_COMPACT = false ; /**< @brief if true the tiles paged out are stored quantized (CompactSurfel)*/
+		int REORDER_INTERVAL = 0 ; /**< @brief number of keyframes between the starts of passes reordering the scene storage by the Morton order of leaves (0 - no reordering)*/
+		double REORDER_BUDGET = 0.005 ; /**< @brief time (in seconds) spent on reordering after each keyframe integration*/
+		size_t SCENE_SIZE = 3e7 ; /**< @brief initial capacity of the scene storage (at most a single chunk of SCENE_CHUNK_SIZE surfels is preallocated, further chunks are allocated on demand)*/
 		bool LOGGING = true ; /**< @brief logging turned on or off*/
 		bool USE_UPDATE = true ; /**< @brief use surfel update or no*/
+		bool RECORD_DELTA = false ; /**< @brief record indices of surfels changed by each keyframe or no*/
+		SpatialIndexType SPATIAL_INDEX = SPATIAL_INDEX_OCTREE ; /**< @brief type of the spatial index organizing surfels*/
+		bool COMPACT_SCENE = false ; /**< @brief if true the surfels are kept quantized in memory (PackedSurfel)*/
 		/**
 		 * Default camera parameters
 		 */
@@ -65,10 +150,40 @@ class SurfelMapper {
 			239.5  /**< cy*/
 		};
 
-		pcl::PointCloud<PointCustomSurfel>::Ptr cloudScene ; /**< @brief The main scene cloud */ 
+		SurfelStorage scene ; /**< @brief The main scene storage (surfels and the frames of their last observation) */
 		pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudSceneDownsampled ; /**< @brief Downsampled scene cloud */
+		unsigned long previewVersion = 0 ; /**< @brief Version of the downsampled scene cloud (incremented whenever the cloud is recomputed) */
+		uint32_t frameIndex = 0 ; /**< @brief Index of the last integrated frame (frames are counted from 1) */
+		unsigned long rejectedFrames = 0 ; /**< @brief Number of frames rejected for a low new coverage */
+		size_t scratchBytes = 0 ; /**< @brief Bytes of the clouds and buffers used for integrating the last frame */
+		size_t consolidationCursor = 0 ; /**< @brief Position (in the order of SurfelIndex::getLeaves()) of the next leaf to be consolidated */
+		size_t surfelCount = 0 ; /**< @brief Number of surfels in the map (maintained on surfel addition and removal) */
+		std::vector<SurfelIdx> freeSlots ; /**< @brief Slots of removed surfels in the scene storage (reused by added surfels before the storage is grown) */
+		std::vector<SurfelIdx> releasedSlots ; /**< @brief Slots of surfels removed by the frame being integrated (reused from the next frame on, so that an index appears in a single set of the map delta) */
+		Eigen::Vector3f sensorOrigin = Eigen::Vector3f::Zero() ; /**< @brief Sensor position of the last integrated frame */
+		Eigen::Vector3f previousSensorOrigin = Eigen::Vector3f::Zero() ; /**< @brief Sensor position of the frame integrated before the last one */
 
-		pcl::octree::OctreePointCloudSearch<PointCustomSurfel> octree ; /**< @brief Octree organizing surfels in the cloud */
+		boost::shared_ptr<SurfelTileCache> tileCache ; /**< @brief Disk cache of the tiles paged out (NULL if paging is turned off) */
+		std::set<TileKey> residentTiles ; /**< @brief Tiles with surfels in memory (tiles emptied by surfel removals are dropped on the next paging pass) */
+		Eigen::Vector3f pagingOrigin ; /**< @brief Sensor position of the last paging-out pass */
+		bool pagingOriginValid = false ; /**< @brief Has a paging-out pass been performed */
+
+		bool reorderActive = false ; /**< @brief Is a reordering pass in progress (slots of removed surfels are not reused until it is finished) */
+		std::vector<SurfelLeaf*> reorderLeaves ; /**< @brief Non-empty leaves in the Morton order taken at the start of the reordering pass */
+		size_t reorderLeafCursor = 0 ; /**< @brief Position (in reorderLeaves) of the next leaf to be visited by the reordering pass */
+		size_t reorderSlot = 0 ; /**< @brief Next slot to be filled by the reordering pass */
+		size_t reorderEnd = 0 ; /**< @brief Size of the scene storage at the start of the reordering pass (surfels added later are not moved) */
+		uint32_t reorderStartFrame = 0 ; /**< @brief Index of the frame in which the last reordering pass was started */
+
+		EvictionHistogram evictionHistogram ; /**< @brief Surfels in the buckets of EVICTION_POLICY (maintained only if MAX_SURFELS is set) */
+		std::map<TileKey, uint32_t> evictionCells ; /**< @brief Bucket of each cell of the distance policy */
+		std::vector<TileKey> evictionCellKeys ; /**< @brief Cell of each bucket of the distance policy */
+
+		boost::shared_ptr<SurfelIndex> spatialIndex ; /**< @brief Spatial index organizing surfels in the scene storage */
+
+		SurfelMapDelta mapDelta ; /**< @brief Changes introduced by the last integrated keyframe */
+
+		DepthPyramid depthPyramid ; /**< @brief Depth bounds and valid readings of the last keyframe (used for occlusion culling) */
 
 		/**
 		 * @brief Performs affine transformation on the input point 
@@ -120,36 +235,216 @@ class SurfelMapper {
 		static void markScanAsCovered(char scan_covered[CLOUD_HEIGHT][CLOUD_WIDTH], float u, float v) ;
 
 		/**
-		 * @brief Skip all child voxels of the octree node
+		 * @brief Marks positions inside the projected surfel disc in a scan-array as used
 		 *
-		 * This is a corrected version of skipChildVoxels from the pcl::OctreeDepthFirstIterator. The latter actually skips all siblings and children, this version skips only children. 
+		 * The disc is rasterized as a circle of at most MAX_COVERAGE_RADIUS pixels. Apart from the central position, only readings
+		 * lying at the surfel depth (within the tolerance) are marked, so readings of other surfaces seen next to the surfel remain uncovered.
 		 *
-		 * @param it iterator pointing at the octree node
-		 * @param it_end end iterator of the octree
+		 * @param scan_covered scan-array
+		 * @param cloud organized scan cloud (sensor frame)
+		 * @param u - image x-coordinate of the surfel center
+		 * @param v - image y-coordinate of the surfel center
+		 * @param z - depth of the surfel center
+		 * @param radius - radius of the projected disc (in pixels)
+		 * @param tolerance - maximum depth difference between the surfel center and the marked readings
 		 */
-		static void skipChildVoxelsCorrect(pcl::octree::OctreePointCloud<pcl::PointXYZRGB>::DepthFirstIterator &it, const pcl::octree::OctreePointCloud<pcl::PointXYZRGB>::DepthFirstIterator &it_end) ;
+		static void markSurfelAsCovered(char scan_covered[CLOUD_HEIGHT][CLOUD_WIDTH], pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr &cloud, float u, float v, float z, float radius, float tolerance) ;
 
 		/**
-		 * @brief Compute an average color for the voxel
+		 * @brief Filters cloud point by a distance from the sensor 
 		 *
-		 * @param it iterator pointing at the octree node associated with the voxel
-		 * @param it_end end iterator of the octree
-		 * @param point this routine fill the color of this point
+		 * @param cloud input/output cloud 
+		 * @param depthBounds if not NULL, depth bounds and valid readings of the filtered (organized) cloud are collected here in the same pass
 		 */
-		void computeVoxelColor(pcl::octree::OctreePointCloud<pcl::PointXYZRGB>::DepthFirstIterator &it, const pcl::octree::OctreePointCloud<pcl::PointXYZRGB>::DepthFirstIterator &it_end, pcl::PointXYZRGB &point) ;
+		void filterCloudByDistance(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr &cloud, DepthPyramid *depthBounds = NULL) ;
 
 		/**
-		 * @brief Filters cloud point by a distance from the sensor 
+		 * @brief Checks if a surfel (or leaf) observed in the given frame belongs to the active tier
 		 *
-		 * @param cloud input/output cloud 
+		 * @param last_observed index of the frame in which the surfel was last observed (0 - not known)
+		 * @return true if the frame is within the active window (always true if the window is turned off)
+		 */
+		inline bool isActive(uint32_t last_observed) { return ACTIVE_WINDOW <= 0 || last_observed == 0 || frameIndex - last_observed <= (uint32_t) ACTIVE_WINDOW ; }
+
+		/**
+		 * @brief Gets the pixel stride of surfel addition for a reading
+		 *
+		 * @param radius radius of a surfel created from the single reading
+		 * @return stride giving surfels spaced at most by SURFEL_SPACING (1 - every reading, also if the spacing is turned off)
+		 */
+		inline int getSurfelStride(float radius) { return (SURFEL_SPACING > 0.0 && radius > 0.0f) ? std::max(1, static_cast<int>(SURFEL_SPACING / (2.0 * radius))) : 1 ; }
+
+		/**
+		 * @brief Adds a surfel to the scene storage and the spatial index
+		 *
+		 * The surfel is written into a free slot of a removed surfel, if there is one, otherwise it is appended to the storage.
+		 * The addition is recorded in the map delta.
+		 *
+		 * @param point surfel to be added
+		 * @param last_observed index of the frame in which the surfel was last observed (frameIndex for new surfels)
+		 * @return index of the surfel in the scene storage (-1 if the storage holds SurfelMapper::getMaxSceneSize() slots and none is free)
+		 */
+		SurfelIdx addSurfel(const PointCustomSurfel &point, uint32_t last_observed) ;
+
+		/**
+		 * @brief Removes a surfel from the scene storage
+		 *
+		 * The surfel is NaN-ed, its slot is released for reuse and the removal is recorded in the map delta. The index of the surfel
+		 * must be removed from its leaf by the caller.
+		 *
+		 * @param idx index of the surfel in the scene storage
+		 */
+		void removeSurfel(SurfelIdx idx) ;
+
+		/**
+		 * @brief Gets the eviction bucket of a surfel according to EVICTION_POLICY
+		 *
+		 * Confidences below EVICTION_CONFIDENCE_EXACT have their own buckets, larger ones share a bucket per power of two. Each frame
+		 * of the last observation has its own bucket. Positions are bucketed by cubic cells of OCTREE_RESOLUTION doubled
+		 * EVICTION_CELL_LEVEL times (a bucket is assigned to each cell when the first surfel enters it).
+		 *
+		 * @param idx index of the surfel in the scene storage (the frame of its last observation must be set)
+		 * @param point surfel
+		 * @return bucket
+		 */
+		inline uint32_t getEvictionBucket(SurfelIdx idx, const PointCustomSurfel &point) ;
+
+		/**
+		 * @brief Moves an observed or updated surfel to its current eviction bucket (if the surfel budget is set)
+		 *
+		 * @param idx index of the surfel in the scene storage
+		 * @param point surfel
+		 */
+		inline void updateEvictionBucket(SurfelIdx idx, const PointCustomSurfel &point) ;
+
+		/**
+		 * @brief Fills the eviction histogram with all surfels of the map (or frees it if the surfel budget is not set)
+		 *
+		 * Surfels are inserted in the order of their last observation, so within a bucket the least recently observed ones come first.
+		 */
+		void rebuildEvictionHistogram() ;
+
+		/**
+		 * @brief Evicts surfels from the map according to EVICTION_POLICY
+		 *
+		 * The buckets of the eviction histogram are visited in the eviction order (ascending confidence or frame buckets, the cells
+		 * sorted by the distance of their centers from the sensor for the distance policy) and the cumulative counts give the threshold
+		 * bucket, so only the surfels of the victim buckets are visited and the cost follows the number of evicted surfels rather than
+		 * the size of the map. Within a bucket the surfels are evicted in the order of their last observation, so the precision of
+		 * the confidence and distance policies is limited by the bucket. Surfels observed in the last integrated frame are not evicted.
+		 *
+		 * @param nevict number of surfels to be evicted
+		 * @return number of surfels evicted (smaller than requested if too few surfels may be evicted)
+		 */
+		unsigned int evictSurfels(size_t nevict) ;
+
+		/**
+		 * @brief Brings tiles near the sensor back from the disk cache
+		 *
+		 * Paged-out tiles within PAGING_RADIUS of the sensor are taken back (waiting for their files to be read), tiles whose background
+		 * read has finished are taken back if they are still near the sensor, and reading of tiles within PAGING_RADIUS of the sensor
+		 * position predicted for the next frame (assuming a constant velocity) is started in the background. The surfels taken back are
+		 * recorded as added in the map delta and keep the index of the frame in which they were last observed, so paging does not
+		 * affect eviction or the active window. Tiles whose files cannot be read stay on the disk.
+		 *
+		 * @return number of surfels taken back
+		 */
+		unsigned int pageIn() ;
+
+		/**
+		 * @brief Pages tiles far from the sensor out to the disk cache
+		 *
+		 * The pass is performed once the sensor moves by half of the tile side from the position of the previous pass. Surfels of tiles
+		 * farther than PAGING_RADIUS plus the tile side (so that tiles at the boundary are not paged in and out repeatedly) are
+		 * written to the cache and removed from the map (recorded as removed in the map delta).
+		 *
+		 * @return number of surfels paged out
+		 */
+		unsigned int pageOut() ;
+
+		/**
+		 * @brief Merges co-located surfels of a leaf
+		 *
+		 * Surfels are merged if their centers are closer than MERGE_RADIUS_RATIO of the smaller radius and their normals agree. Surfels observed
+		 * in the last integrated frame are skipped (they are already in the map delta).
+		 *
+		 * @param leaf leaf to be consolidated
+		 * @return number of surfels merged (and removed)
+		 */
+		unsigned int consolidateLeaf(SurfelLeaf &leaf) ;
+
+		/**
+		 * @brief Merges co-located surfels with agreeing normals
+		 *
+		 * Leaves are consolidated in turn, starting from the leaf following the one consolidated last, until the time budget is
+		 * exceeded (the budget may be exceeded by the time of consolidating a single leaf). Merged surfels are combined using count-weighted
+		 * averaging, the surfel merged into another one is removed from the map. Changes are recorded in the map delta of the frame being integrated.
+		 *
+		 * @param time_budget time limit (in seconds)
+		 * @return number of surfels merged (and removed)
+		 */
+		unsigned int consolidateMap(double time_budget) ;
+
+		/**
+		 * @brief Starts a pass reordering the scene storage by the Morton order of leaves
+		 *
+		 * The non-empty leaves are taken in the Morton order and slots of removed surfels are no longer reused, so the surfels
+		 * added during the pass are appended behind the reordered part of the storage.
 		 */
-		void filterCloudByDistance(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr &cloud) ;
+		void startReordering() ;
+
+		/**
+		 * @brief Continues the reordering pass
+		 *
+		 * The surfels of the leaves are moved in turn to consecutive slots from the beginning of the storage (a surfel occupying the target
+		 * slot, found in its leaf recorded by the spatial index, is swapped with the moved one). The budget may be exceeded by the time of processing
+		 * a single leaf. The moved surfels are recorded in the map delta of the frame being integrated (a slot emptied by the move as removed,
+		 * a slot filled as added or updated). The pass is finished when all leaves are visited.
+		 *
+		 * @param time_budget time limit (in seconds)
+		 * @return number of surfels moved to other slots
+		 */
+		unsigned int reorderSurfels(double time_budget) ;
+
+		/**
+		 * @brief Finishes the reordering pass
+		 *
+		 * The removed surfels at the end of the storage are dropped and slots of the remaining removed surfels are made available for reuse.
+		 * Leaves whose surfels occupy consecutive slots are switched to the range representation (see SurfelLeaf), so the map update
+		 * scans them sequentially until surfels not following the range are added to them.
+		 */
+		void finishReordering() ;
+
+		/**
+		 * @brief Estimates the fraction of the frame readings not covered by the map
+		 *
+		 * Readings are sampled every COVERAGE_SAMPLE_STEP pixels. A reading within the reliable sensor range is covered if an active surfel lies
+		 * within dmax plus the reading pixel footprint from it.
+		 *
+		 * @param cloud input RGBD cloud (world frame)
+		 * @param viewMatrix world to sensor transformation
+		 * @return fraction of the sampled readings not covered (0 if no reading is within the sensor range)
+		 */
+		double estimateNewCoverage(const pcl::PointCloud<pcl::PointXYZRGB> &cloud, const Eigen::Matrix4d &viewMatrix) ;
 
 		/**
 		 * @brief Computes downsampled version of the cloud 
 		 */
 		void downsampleSceneCloud() ;
 
+		/**
+		 * @brief Computes downsampled version of the cloud at the given preview level 
+		 *
+		 * @param level preview level (0 - voxels of PREVIEW_RESOLUTION size, each next level doubles the voxel side)
+		 * @param cloudDownsampled output downsampled cloud
+		 */
+		void downsampleSceneCloud(unsigned int level, pcl::PointCloud<pcl::PointXYZRGB> &cloudDownsampled) ;
+
+		/**
+		 * @brief Creates an empty spatial index of the type SPATIAL_INDEX for the scene storage
+		 */
+		void createSpatialIndex() ;
+
 		/**
 		 * @brief Prints surfel mapper settings 
 		 */
@@ -175,25 +470,25 @@ class SurfelMapper {
 		 * @param CONFIDENCE_THRESHOLD1 confidence threshold used for establishing reliable surfels
 		 * @param MIN_SCAN_ZNORMAL acceptable minimum z-component of scan normal
 		 * @param USE_FRUSTUM use frustum or no
-		 * @param SCENE_SIZE preallocated size of scene
+		 * @param SCENE_SIZE initial capacity of the scene (at most a single chunk of SCENE_CHUNK_SIZE surfels is preallocated, further chunks are allocated on demand)
 		 * @param LOGGING logging turned on or off
 		 * @param USE_UPDATE use surfel update or no
 		 * @param camera_params use this specific set of camera parameters for projection
 		 */
 		SurfelMapper(double DMAX, double MIN_KINECT_DIST, double MAX_KINECT_DIST, double OCTREE_RESOLUTION, 
 		  	     double PREVIEW_RESOLUTION, int PREVIEW_COLOR_SAMPLES_IN_VOXEL, int CONFIDENCE_THRESHOLD1, double MIN_SCAN_ZNORMAL, 
-			     bool USE_FRUSTUM, int SCENE_SIZE, bool LOGGING, bool USE_UPDATE, CameraParams &camera_params) ;
+			     bool USE_FRUSTUM, size_t SCENE_SIZE, bool LOGGING, bool USE_UPDATE, CameraParams &camera_params) ;
 	
 		/**
 		 * @brief A parametric constructor
 		 *
 		 * Constructs the SurfelMapper object
 		 *
-		 * @param SCENE_SIZE preallocated size of scene
+		 * @param SCENE_SIZE initial capacity of the scene (at most a single chunk of SCENE_CHUNK_SIZE surfels is preallocated, further chunks are allocated on demand)
 		 * @param LOGGING logging turned on or off
 		 * @param camera_params use this specific set of camera parameters for projection
 		 */
-		SurfelMapper(int SCENE_SIZE, bool LOGGING, CameraParams &camera_params) ; 
+		SurfelMapper(size_t SCENE_SIZE, bool LOGGING, CameraParams &camera_params) ; 
 
 		/**
 		 * @brief A non-parametric constructor
@@ -212,20 +507,46 @@ class SurfelMapper {
 		/**
 		 * @brief Add new point cloud to scene 
 		 *
-		 * Add new point cloud to scene. Input cloud is expected to provide sensor orientation and be transformed to the world frame according to the orientation
+		 * Add new point cloud to scene. Input cloud is expected to provide sensor orientation and be transformed to the world frame according to the orientation.
+		 * If keyframe rejection is turned on, frames adding too little new coverage to the map are skipped (no map delta is started for them).
 		 *
 		 * @param cloud input RGBD cloud 
+		 * @return true if the cloud was integrated, false if it was rejected
 		 */
-		void addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &cloud) ;
+		bool addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &cloud) ;
 
 		/**
-		 * @brief Retrieves scene cloud 
+		 * @brief Retrieves a surfel of the scene
 		 *
-		 * Retrieves scene cloud
+		 * @param idx index of the surfel in the scene storage (as given by the map delta or the index queries)
+		 * @return the surfel (with NaN coordinates if it has been removed)
+		 */
+		PointCustomSurfel getSurfel(SurfelIdx idx) ;
+
+		/**
+		 * @brief Retrieves surfels of the scene as a PCL cloud
+		 *
+		 * The surfels are copied out of the scene storage in the order of the indices, so the index set of a map delta or an index
+		 * query is converted to a cloud without the copy of the whole scene.
+		 *
+		 * @param indices indices of the surfels in the scene storage
+		 * @param surfels the surfels are appended here (removed surfels with NaN coordinates)
+		 */
+		void getSurfels(const std::vector<SurfelIdx> &indices, pcl::PointCloud<PointCustomSurfel> &surfels) ;
+
+		/**
+		 * @brief Retrieves number of slots of the scene storage in use
+		 *
+		 * @return number of slots (surfels including the removed ones not reused yet)
+		 */
+		size_t getSceneSize() ;
+
+		/**
+		 * @brief Retrieves number of slots in the allocated chunks of the scene storage
 		 *
-		 * @return the current surfel point cloud 
+		 * @return number of slots
 		 */
-		pcl::PointCloud<PointCustomSurfel>::Ptr &getCloudScene() ;
+		size_t getSceneCapacity() ;
 
 		/**
 		 * @brief Retrieves downsample scene cloud 
@@ -237,42 +558,305 @@ class SurfelMapper {
 		pcl::PointCloud<pcl::PointXYZRGB>::Ptr &getCloudSceneDownsampled() ;
 
 		/**
-		 * @brief Retrieves current number of surfels in the scene cloud 
+		 * @brief Retrieves downsample scene cloud at the given preview level
+		 *
+		 * Level 0 returns a copy of the cloud retrieved by SurfelMapper::getCloudSceneDownsampled(). Coarser levels are computed on demand.
+		 *
+		 * @param level preview level (0 - voxels of PREVIEW_RESOLUTION size, each next level doubles the voxel side)
+		 * @param cloud output downsampled cloud
+		 */
+		void getCloudSceneDownsampled(unsigned int level, pcl::PointCloud<pcl::PointXYZRGB> &cloud) ;
+
+		/**
+		 * @brief Retrieves version of the downsampled scene cloud 
+		 *
+		 * The version changes whenever the downsampled cloud is recomputed (after a keyframe integration or map reset)
+		 *
+		 * @return downsampled cloud version 
+		 */
+		unsigned long getPreviewVersion() ;
+
+		/**
+		 * @brief Retrieves current number of surfels in the scene 
 		 *
-		 * Retrieves current number of surfels in the scene cloud 
+		 * Retrieves current number of surfels in the scene (removed surfels are not counted)
 		 *
-		 * @return number of points in the scene cloud 
+		 * @return number of surfels in the scene 
 		 */
 		size_t getPointCount() ;
 
+		/**
+		 * @brief Gets maximum number of slots in the scene storage addressable by the spatial index
+		 *
+		 * The limit follows from the SurfelIdx type (2^31 - 1 or 2^63 - 1 slots, depending on SURFEL_INDEX_64) and from the PCL
+		 * octree, which indexes points with int. Surfels beyond the limit are not added.
+		 *
+		 * @return maximum number of slots
+		 */
+		size_t getMaxSceneSize() ;
+
 		/**
 		 * @brief Resets map
 		 *
-		 * The scene is reset to the blank state (integration of incoming readings is started anew) 
+		 * The scene is reset to the blank state (integration of incoming readings is started anew). The reset starts a new (empty) map delta.
+		 * The chunks of the scene storage are recycled for the new map (its capacity is retained). The leaf index storage is returned to the pool
+		 * (and freed, if no other map uses it).
 		 */
 		void resetMap() ;
 
 		/**
 		 * @brief Gets indices for the points from the bounding box 
 		 *
-		 * Gets indices for the points from the bounding box. The indices refer to the cloud that can be retrieved (at the same time) using
-		 * SurfelMapper::getCloudScene()
+		 * Gets indices for the points from the bounding box. The indices refer to the scene storage, the surfels can be retrieved (at the same time) using
+		 * SurfelMapper::getSurfels()
 		 *
 		 * @param min_pt minimum corner of the bounding box
 		 * @param max_pt maximum corner of the bounding box
 		 * @param k_indices selected indices are stored in this argument
 		 */
-		void getBoundingBoxIndices(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<int> &k_indices) ;
+		void getBoundingBoxIndices(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<SurfelIdx> &k_indices) ;
 
 		/**
 		 * @brief Gets indices for all points in the map 
 		 *
-		 * Gets indices for all points in the map. The indices refer to the cloud that can be retrieved (at the same time) using
-		 * SurfelMapper::getCloudScene()
+		 * Gets indices for all points in the map. The indices refer to the scene storage, the surfels can be retrieved (at the same time) using
+		 * SurfelMapper::getSurfels()
+		 *
+		 * @param k_indices selected indices are stored in this argument
+		 */
+		void getAllIndices(std::vector<SurfelIdx> &k_indices) ;
+
+		/**
+		 * @brief Gets indices for all points in the map, leaf by leaf in the Morton order of the leaf voxels
+		 *
+		 * After a finished reordering pass the indices are consecutive (0, 1, 2, ...) for either spatial index.
 		 *
 		 * @param k_indices selected indices are stored in this argument
 		 */
-		void getAllIndices(std::vector<int> &k_indices) ;
+		void getOrderedIndices(std::vector<SurfelIdx> &k_indices) ;
+
+		/**
+		 * @brief Turns recording of map deltas on and off
+		 *
+		 * When turned on, the indices of surfels added, updated and removed by each integrated keyframe are recorded
+		 * and can be retrieved using SurfelMapper::getLastDelta()
+		 *
+		 * @param RECORD_DELTA true - turns recording on, false - turns recording off
+		 */
+		void setDeltaRecording(bool RECORD_DELTA) ;
+
+		/**
+		 * @brief Turns occlusion culling on and off
+		 *
+		 * When turned on, the map update skips index nodes lying entirely behind the surface observed in the scan (all scan readings
+		 * in their footprint are closer by more than DMAX) and nodes projecting only on invalid readings. Surfels in such nodes could
+		 * not be updated nor removed by the scan.
+		 *
+		 * @param USE_OCCLUSION_CULLING true - turns occlusion culling on, false - turns occlusion culling off
+		 */
+		void setOcclusionCulling(bool USE_OCCLUSION_CULLING) ;
+
+		/**
+		 * @brief Turns freezing of converged leaves on and off
+		 *
+		 * A leaf is frozen after an update in which all its surfels have at least FREEZE_CONFIDENCE confidence, none was removed
+		 * and each matching reading was at most FREEZE_MAX_RESIDUAL away from its surfel. Surfels of frozen leaves are not averaged
+		 * with matching readings (they only cover the readings), so they are not reported as updated in map deltas. A reading behind
+		 * a frozen surfel (free space observed at the surfel) or a surfel added to the leaf thaws the leaf.
+		 *
+		 * @param USE_FREEZING true - turns freezing on, false - turns freezing off (frozen leaves are updated again)
+		 * @param FREEZE_CONFIDENCE minimum confidence of surfels in a leaf to be frozen
+		 * @param FREEZE_MAX_RESIDUAL maximum distance between a surfel and its matching reading in a leaf to be frozen
+		 */
+		void setFreezing(bool USE_FREEZING, int FREEZE_CONFIDENCE, double FREEZE_MAX_RESIDUAL) ;
+
+		/**
+		 * @brief Sets the window of the active surfel tier
+		 *
+		 * Only surfels observed (matched with a reading or covering one) within the last ACTIVE_WINDOW frames take part in the update.
+		 * Older surfels form the inactive tier: they remain in the map, preview and query results, but are skipped by the
+		 * integration, so they neither cover readings nor get updated or removed. Leaves with inactive surfels only are skipped as a whole.
+		 *
+		 * @param ACTIVE_WINDOW number of frames (0 - all surfels are active)
+		 */
+		void setActiveWindow(int ACTIVE_WINDOW) ;
+
+		/**
+		 * @brief Retrieves the index of the frame in which the surfel was last observed
+		 *
+		 * @param idx index of the surfel in the scene storage
+		 * @return frame index (frames are counted from 1 since the mapper construction)
+		 */
+		uint32_t getLastObserved(SurfelIdx idx) ;
+
+		/**
+		 * @brief Retrieves the index of the last integrated frame
+		 *
+		 * @return frame index (frames are counted from 1 since the mapper construction)
+		 */
+		uint32_t getFrameIndex() ;
+
+		/**
+		 * @brief Turns rejection of frames overlapping the map on and off
+		 *
+		 * Before integration, a sparse sample of frame readings is checked against the map (see SurfelMapper::estimateNewCoverage()). Frames
+		 * with the estimated fraction of new readings below MIN_NEW_COVERAGE are not integrated.
+		 *
+		 * @param MIN_NEW_COVERAGE minimum fraction of new readings (0 - turns rejection off)
+		 * @param COVERAGE_SAMPLE_STEP pixel step of the sampled readings
+		 */
+		void setKeyframeRejection(double MIN_NEW_COVERAGE, int COVERAGE_SAMPLE_STEP) ;
+
+		/**
+		 * @brief Sets the target spacing of surfels added to the map
+		 *
+		 * Uncovered readings closer than the spacing to their neighbours are thinned out: surfels are added on a pixel stride chosen for each reading,
+		 * so that the disc diameter of a single-reading surfel times the stride does not exceed the spacing. The radius of the added surfel
+		 * is multiplied by the stride to cover the skipped readings, and updates do not shrink it below the radius obtained the same way.
+		 *
+		 * @param SURFEL_SPACING target spacing (0 - a surfel is added for each uncovered reading)
+		 */
+		void setSurfelSpacing(double SURFEL_SPACING) ;
+
+		/**
+		 * @brief Sets up merging of co-located surfels
+		 *
+		 * After each keyframe integration the leaves of the map are consolidated in turn for at most CONSOLIDATION_BUDGET seconds.
+		 * Surfels whose centers are closer than MERGE_RADIUS_RATIO of the smaller radius and whose normals agree are merged using count-weighted
+		 * averaging. The merges are reported in the map delta of the keyframe.
+		 *
+		 * @param CONSOLIDATION_BUDGET time (in seconds) spent on merging after each keyframe integration (0 - no merging)
+		 * @param MERGE_RADIUS_RATIO maximum distance between centers of merged surfels relative to the smaller radius
+		 * @param MERGE_MIN_NORMAL_DOT minimum cosine of the angle between normals of merged surfels
+		 */
+		void setConsolidation(double CONSOLIDATION_BUDGET, double MERGE_RADIUS_RATIO, double MERGE_MIN_NORMAL_DOT) ;
+
+		/**
+		 * @brief Sets the budget of surfels in the map
+		 *
+		 * After each keyframe integration, if the map holds more than MAX_SURFELS surfels, surfels are evicted according to the policy
+		 * until EVICTION_FRACTION of the budget is free, so consecutive keyframes do not trigger eviction again. Surfels observed
+		 * in the keyframe are not evicted. Evictions are reported as removals in the map delta of the keyframe. Slots of removed surfels
+		 * are reused by the surfels added later, so the scene storage does not exceed MAX_SURFELS plus the surfels added by a single keyframe
+		 * (provided that a single keyframe does not observe more than the budget).
+		 *
+		 * While the budget is set, surfels are kept in a histogram over the buckets of the policy, updated as surfels are added, observed
+		 * and removed, so an eviction visits only the surfels of the victim buckets. Setting the budget or changing the policy
+		 * rebuilds the histogram (a pass over the map). The histogram takes 12 bytes per slot of the scene storage (24 with 64-bit indices).
+		 *
+		 * @param MAX_SURFELS maximum number of surfels in the map (0 - no limit)
+		 * @param EVICTION_POLICY order of evicting surfels
+		 * @param EVICTION_FRACTION fraction of the budget freed by each eviction (clamped to [MIN_EVICTION_FRACTION, MAX_EVICTION_FRACTION])
+		 */
+		void setSurfelBudget(size_t MAX_SURFELS, EvictionPolicy EVICTION_POLICY, double EVICTION_FRACTION) ;
+
+		/**
+		 * @brief Sets up paging of map tiles out of memory
+		 *
+		 * The world is divided into cubic tiles aligned to the octree resolution grid. Tiles farther from the sensor than the paging
+		 * radius are written to the disk cache and removed from memory, and they are brought back when the sensor (or its position
+		 * predicted for the next frame) approaches them. The surfels moving between memory and the disk are reported in map deltas
+		 * as removed and added, so the indices refer to the surfels in memory only. SurfelMapper::getBoundingBoxSurfels() and
+		 * SurfelMapper::getAllSurfels() cover also the tiles on the disk. Changing the setup drops the tiles paged out before.
+		 *
+		 * @param PAGING_RADIUS distance from the sensor beyond which tiles are paged out (0 - no paging, at least MAX_KINECT_DIST plus the tile side)
+		 * @param PAGING_TILE_LEVEL side of a tile as the number of doublings of the octree resolution
+		 * @param PAGING_DIRECTORY directory of the tile files
+		 * @param PAGING_COMPACT if true surfels are stored quantized (24 instead of 68 bytes per surfel record, positions kept to 1/65535 of the tile side)
+		 */
+		void setPaging(double PAGING_RADIUS, int PAGING_TILE_LEVEL, const std::string &PAGING_DIRECTORY, bool PAGING_COMPACT = false) ;
+
+		/**
+		 * @brief Retrieves number of surfels paged out to the disk
+		 *
+		 * @return number of surfels
+		 */
+		size_t getPagedOutCount() ;
+
+		/**
+		 * @brief Reports memory used by the map components
+		 *
+		 * The report is assembled from sizes and counters maintained by the components, so it is cheap enough to be taken
+		 * after every keyframe (no surfel or node traversal).
+		 *
+		 * @param report output memory report
+		 */
+		void getMemoryReport(MemoryReport &report) ;
+
+		/**
+		 * @brief Sets up reordering of the scene storage
+		 *
+		 * Every REORDER_INTERVAL keyframes a pass is started that moves surfels, so that the surfels of each leaf occupy a contiguous
+		 * range of the storage and the leaves follow the Morton order of their voxels. Spatially close surfels are then close in memory,
+		 * and the removed surfels left behind by eviction, merging and paging are squeezed out. The pass is spread over keyframes,
+		 * REORDER_BUDGET seconds per keyframe. Moved surfels change their indices, which is reported in the map delta (the old slot as
+		 * removed or updated, the new slot as added or updated), so consumers relying on indices need delta recording turned on.
+		 *
+		 * @param REORDER_INTERVAL number of keyframes between the starts of the passes (0 - no reordering)
+		 * @param REORDER_BUDGET time spent on reordering after each keyframe (in seconds)
+		 */
+		void setReordering(int REORDER_INTERVAL, double REORDER_BUDGET) ;
+
+		/**
+		 * @brief Checks whether a reordering pass is in progress
+		 *
+		 * @return true if the pass is in progress
+		 */
+		bool isReordering() ;
+
+		/**
+		 * @brief Gets surfels from the bounding box, including the tiles paged out to the disk
+		 *
+		 * @param min_pt minimum corner of the bounding box
+		 * @param max_pt maximum corner of the bounding box
+		 * @param surfels selected surfels are appended here
+		 */
+		void getBoundingBoxSurfels(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, pcl::PointCloud<PointCustomSurfel> &surfels) ;
+
+		/**
+		 * @brief Gets all surfels of the map, including the tiles paged out to the disk
+		 *
+		 * @param surfels the surfels are appended here
+		 */
+		void getAllSurfels(pcl::PointCloud<PointCustomSurfel> &surfels) ;
+
+		/**
+		 * @brief Retrieves number of frames rejected for a low new coverage
+		 *
+		 * @return number of rejected frames
+		 */
+		unsigned long getRejectedFrameCount() ;
+
+		/**
+		 * @brief Retrieves changes introduced by the last integrated keyframe
+		 *
+		 * The sequence number is maintained even if delta recording is turned off (the index sets are empty then)
+		 *
+		 * @return the last map delta
+		 */
+		const SurfelMapDelta &getLastDelta() ;
+
+		/**
+		 * @brief Selects the spatial index organizing surfels
+		 *
+		 * The index is rebuilt from the surfels currently present in the map
+		 *
+		 * @param SPATIAL_INDEX type of the spatial index
+		 */
+		void setSpatialIndex(SpatialIndexType SPATIAL_INDEX) ;
+
+		/**
+		 * @brief Selects the representation of surfels in memory
+		 *
+		 * In the compact representation surfels take 22 instead of 64 bytes. They are decoded for the update and expanded to
+		 * PointCustomSurfel when retrieved (SurfelMapper::getSurfels()). Positions are quantized with PACKED_POSITION_STEP and
+		 * limited to PACKED_POSITION_RANGE from the origin (surfels beyond it are not added), normals and radii are quantized
+		 * and confidences and observation counts saturate at 65535. Surfels already in the map are converted (their positions
+		 * are clamped to the range).
+		 *
+		 * @param COMPACT_SCENE if true the surfels are kept quantized
+		 */
+		void setCompactScene(bool COMPACT_SCENE) ;
 } ;
 
 #endif
@@ -0,0 +1,170 @@
+/**
+ *  @file surfel_storage.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef SURFEL_STORAGE_HPP
+#define SURFEL_STORAGE_HPP
+
+#include "point_custom_surfel.hpp"
+#include "compact_surfel.hpp"
+#include "index_pool.hpp"
+#include <Eigen/Core>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#define SCENE_CHUNK_SHIFT 20 /**< Base 2 logarithm of the number of surfels in a chunk of the scene storage */
+#define SCENE_CHUNK_SIZE (1 << SCENE_CHUNK_SHIFT) /**< Number of surfels in a chunk of the scene storage (the storage is grown in whole chunks) */
+
+/**
+* @brief Storage of the scene surfels
+*
+* Surfels are kept in chunks of SCENE_CHUNK_SIZE surfels listed in a chunk table. The upper bits of a surfel index select
+* the chunk and the lower bits the position within the chunk, so growing the storage allocates a single chunk and never
+* moves the surfels already stored. Chunks are kept when the storage is cleared or shrunk and reused when it grows again.
+* The index of the frame in which each surfel was last observed is stored along with the surfel.
+*
+* In the compact mode the surfels are kept as PackedSurfel (22 instead of 64 bytes), so the same memory holds about three
+* times as many surfels. Surfels are accessed by value in both modes: load() decodes a surfel and store() encodes it back.
+*/
+class SurfelStorage {
+	public:
+		static const size_t CHUNK_MASK = SCENE_CHUNK_SIZE - 1 ; /**< @brief mask of the position within the chunk */
+
+	protected:
+		std::vector<std::unique_ptr<PointCustomSurfel[]> > chunks ; /**< @brief chunks of surfels (empty in the compact mode) */
+		std::vector<std::unique_ptr<PackedSurfel[]> > packed_chunks ; /**< @brief chunks of packed surfels (used in the compact mode only) */
+		std::vector<std::unique_ptr<uint32_t[]> > last_observed_chunks ; /**< @brief chunks of the frames of the last observation of surfels */
+		size_t count ; /**< @brief number of slots in use (including removed surfels) */
+		bool compact ; /**< @brief are the surfels packed */
+
+		/**
+		 * @brief Appends a new chunk to the chunk table
+		 */
+		void addChunk() ;
+
+		PointCustomSurfel &full(SurfelIdx idx) { return chunks[idx >> SCENE_CHUNK_SHIFT][idx & CHUNK_MASK] ; } /**< @brief full surfel of the given index */
+		const PointCustomSurfel &full(SurfelIdx idx) const { return chunks[idx >> SCENE_CHUNK_SHIFT][idx & CHUNK_MASK] ; } /**< @brief full surfel of the given index */
+		PackedSurfel &packed(SurfelIdx idx) { return packed_chunks[idx >> SCENE_CHUNK_SHIFT][idx & CHUNK_MASK] ; } /**< @brief packed surfel of the given index */
+		const PackedSurfel &packed(SurfelIdx idx) const { return packed_chunks[idx >> SCENE_CHUNK_SHIFT][idx & CHUNK_MASK] ; } /**< @brief packed surfel of the given index */
+
+	public:
+		/**
+		 * @brief A constructor (creates an empty storage without chunks)
+		 */
+		SurfelStorage() ;
+
+		/**
+		 * @brief Reads a surfel (decodes it in the compact mode)
+		 *
+		 * @param idx surfel index
+		 * @param point output surfel
+		 */
+		inline void load(SurfelIdx idx, PointCustomSurfel &point) const {
+			if (compact)
+				decodeSurfel(packed(idx), point) ;
+			else
+				point = full(idx) ;
+		}
+
+		/**
+		 * @brief Writes a surfel (encodes it in the compact mode)
+		 *
+		 * @param idx surfel index
+		 * @param point surfel
+		 */
+		inline void store(SurfelIdx idx, const PointCustomSurfel &point) {
+			if (compact)
+				encodeSurfel(point, packed(idx)) ;
+			else
+				full(idx) = point ;
+		}
+
+		PointCustomSurfel get(SurfelIdx idx) const { PointCustomSurfel point ; load(idx, point) ; return point ; } /**< @brief surfel of the given index */
+		Eigen::Vector3f getPosition(SurfelIdx idx) const { return compact ? decodePosition(packed(idx)) : full(idx).getVector3fMap() ; } /**< @brief position of the surfel of the given index */
+		bool isFinite(SurfelIdx idx) const { return compact ? !isRemoved(packed(idx)) : pcl::isFinite(full(idx)) ; } /**< @brief is the surfel of the given index present (not removed) */
+		uint32_t &lastObserved(SurfelIdx idx) { return last_observed_chunks[idx >> SCENE_CHUNK_SHIFT][idx & CHUNK_MASK] ; } /**< @brief index of the frame in which the surfel was last observed */
+		uint32_t lastObserved(SurfelIdx idx) const { return last_observed_chunks[idx >> SCENE_CHUNK_SHIFT][idx & CHUNK_MASK] ; } /**< @brief index of the frame in which the surfel was last observed */
+		size_t size() const { return count ; } /**< @brief number of slots in use (including removed surfels) */
+		bool empty() const { return count == 0 ; } /**< @brief is the storage empty */
+		size_t capacity() const { return last_observed_chunks.size() << SCENE_CHUNK_SHIFT ; } /**< @brief number of slots in the allocated chunks */
+		size_t getChunkCount() const { return last_observed_chunks.size() ; } /**< @brief number of allocated chunks */
+		bool isCompact() const { return compact ; } /**< @brief are the surfels packed */
+		bool canStore(const PointCustomSurfel &point) const { return !compact || isPackable(point) ; } /**< @brief can the surfel be stored without clamping its position */
+
+		/**
+		 * @brief Marks a surfel as removed (its slot is kept, so that the indices of other surfels do not change)
+		 *
+		 * @param idx surfel index
+		 */
+		void remove(SurfelIdx idx) ;
+
+		/**
+		 * @brief Swaps two slots (surfels and the frames of their last observation) without decoding the surfels
+		 *
+		 * @param a index of the first slot
+		 * @param b index of the second slot
+		 */
+		void swap(SurfelIdx a, SurfelIdx b) ;
+
+		/**
+		 * @brief Moves a surfel to another slot without decoding it, the source slot is marked as removed
+		 *
+		 * @param dst index of the target slot
+		 * @param src index of the source slot
+		 */
+		void move(SurfelIdx dst, SurfelIdx src) ;
+
+		/**
+		 * @brief Switches between the full and the compact representation
+		 *
+		 * The stored surfels are converted chunk by chunk, so a single additional chunk is allocated at a time. Converting
+		 * to the compact representation quantizes the surfels.
+		 *
+		 * @param compact if true the surfels are packed
+		 */
+		void setCompact(bool compact) ;
+
+		/**
+		 * @brief Allocates chunks, so that the storage holds the given number of surfels
+		 *
+		 * @param size required number of surfels
+		 * @return true if any chunk has been allocated
+		 */
+		bool reserve(size_t size) ;
+
+		/**
+		 * @brief Appends a surfel (a chunk is allocated if all are full)
+		 *
+		 * @param point surfel to be appended
+		 * @param last_observed index of the frame in which the surfel was last observed
+		 */
+		void push_back(const PointCustomSurfel &point, uint32_t last_observed) ;
+
+		/**
+		 * @brief Drops the slots at the end of the storage (the chunks are kept)
+		 *
+		 * @param new_size new number of slots (not greater than the current one)
+		 */
+		void resize(size_t new_size) ;
+
+		/**
+		 * @brief Drops all slots (the chunks are kept for reuse)
+		 */
+		void clear() { count = 0 ; }
+
+		/**
+		 * @brief Gets number of bytes of the allocated chunks and the chunk table
+		 *
+		 * @return number of bytes
+		 */
+		size_t getMemoryBytes() const ;
+} ;
+
+#endif
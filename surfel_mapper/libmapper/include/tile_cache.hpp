@@ -0,0 +1,224 @@
+/**
+ *  @file tile_cache.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef TILE_CACHE_HPP
+#define TILE_CACHE_HPP
+
+#include "point_custom_surfel.hpp"
+#include <pcl/point_cloud.h>
+#include <Eigen/Core>
+#include <future>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Integer coordinates of a map tile
+ */
+struct TileKey {
+	int x ; /**< @brief x coordinate */
+	int y ; /**< @brief y coordinate */
+	int z ; /**< @brief z coordinate */
+
+	/**
+	 * @brief Orders keys lexicographically
+	 *
+	 * @param other key to compare with
+	 * @return true if this key precedes the other one
+	 */
+	bool operator<(const TileKey &other) const { return x != other.x ? x < other.x : y != other.y ? y < other.y : z < other.z ; }
+} ;
+
+/**
+* @brief Disk cache of surfels from map tiles paged out of memory
+*
+* The space is divided into a world-aligned grid of cubic tiles. Surfels of a tile paged out are appended to a binary file
+* of the tile in the cache directory, each followed by the index of the frame in which it was last observed. A tile may be prefetched - its file is then read by a background task, while the mapper
+* keeps integrating frames - and taken back into the map once loaded. Files of the tiles taken back and all files left
+* on destruction are removed. Optionally surfels are stored in the quantized form (CompactSurfel, positions relative
+* to the tile origin), taking about a third of the disk space and of the read time.
+*
+* Apart from the background reads, the cache is not thread-safe.
+*/
+class SurfelTileCache {
+	public:
+		typedef pcl::PointCloud<PointCustomSurfel>::Ptr CloudPtr ; /**< @brief surfel cloud pointer type */
+
+		/**
+		 * @brief Surfels read from a tile file
+		 */
+		struct TileContents {
+			CloudPtr surfels ; /**< @brief surfels of the tile */
+			std::vector<uint32_t> last_observed ; /**< @brief index of the frame in which each surfel was last observed */
+		} ;
+
+	protected:
+		/**
+		 * @brief Tile paged out to the disk
+		 */
+		struct PagedTile {
+			size_t count = 0 ; /**< @brief number of surfels stored in the tile file */
+			Eigen::Vector3f min_pt ; /**< @brief minimum corner of the bounding box of the stored surfels */
+			Eigen::Vector3f max_pt ; /**< @brief maximum corner of the bounding box of the stored surfels */
+			std::shared_future<TileContents> loading ; /**< @brief background read of the tile file (not valid if the tile is not being prefetched) */
+		} ;
+
+		std::string directory ; /**< @brief directory of the tile files */
+		std::string prefix ; /**< @brief prefix of the tile file names (unique for the cache object) */
+		double tile_size ; /**< @brief side of a tile */
+		bool compact ; /**< @brief if true surfels are stored in the quantized form */
+		std::map<TileKey, PagedTile> tiles ; /**< @brief tiles paged out */
+		size_t surfel_count ; /**< @brief number of surfels in all tiles paged out */
+
+		/**
+		 * @brief Gets path of the tile file
+		 *
+		 * @param key tile key
+		 * @return file path
+		 */
+		std::string getTilePath(const TileKey &key) const ;
+
+		/**
+		 * @brief Reads surfels from a tile file
+		 *
+		 * @param path file path
+		 * @param count number of surfels in the file
+		 * @param compact if true the file contains quantized surfels
+		 * @param origin origin of the tile (for the quantized surfels)
+		 * @param side side of the tile (for the quantized surfels)
+		 * @return surfels read (empty if the file could not be read)
+		 */
+		static TileContents readTile(const std::string &path, size_t count, bool compact, const Eigen::Vector3f &origin, float side) ;
+
+		/**
+		 * @brief Gets origin (minimum corner) of a tile
+		 *
+		 * @param key tile key
+		 * @return tile origin
+		 */
+		Eigen::Vector3f getTileOrigin(const TileKey &key) const ;
+
+		/**
+		 * @brief Gets surfels of a paged-out tile (waiting for the background read or reading the file)
+		 *
+		 * @param key tile key
+		 * @param tile paged-out tile
+		 * @return surfels of the tile
+		 */
+		TileContents getTileSurfels(const TileKey &key, PagedTile &tile) const ;
+
+	public:
+		/**
+		 * @brief A parametric constructor
+		 *
+		 * @param directory directory of the tile files (created if it does not exist)
+		 * @param tile_size side of a tile
+		 * @param compact if true surfels are stored in the quantized form
+		 */
+		SurfelTileCache(const std::string &directory, double tile_size, bool compact = false) ;
+
+		/**
+		 * @brief A destructor (waits for the background reads and removes the tile files)
+		 */
+		~SurfelTileCache() ;
+
+		/**
+		 * @brief Gets key of the tile containing a point
+		 *
+		 * @param point point
+		 * @return tile key
+		 */
+		TileKey getTileKey(const Eigen::Vector3f &point) const ;
+
+		/**
+		 * @brief Gets squared distance from a point to a tile (0 for points inside the tile)
+		 *
+		 * @param key tile key
+		 * @param point point
+		 * @return squared distance
+		 */
+		double getSquaredDistance(const TileKey &key, const Eigen::Vector3f &point) const ;
+
+		/**
+		 * @brief Gets side of a tile
+		 *
+		 * @return tile side
+		 */
+		double getTileSize() const { return tile_size ; }
+
+		/**
+		 * @brief Appends surfels to the tile file
+		 *
+		 * @param key tile key
+		 * @param surfels surfels of the tile
+		 * @param last_observed index of the frame in which each surfel was last observed
+		 * @return true if the surfels have been written
+		 */
+		bool store(const TileKey &key, const pcl::PointCloud<PointCustomSurfel> &surfels, const std::vector<uint32_t> &last_observed) ;
+
+		/**
+		 * @brief Starts reading the tile file in the background (if the tile is paged out and not read yet)
+		 *
+		 * @param key tile key
+		 */
+		void prefetch(const TileKey &key) ;
+
+		/**
+		 * @brief Checks if the background read of the tile has finished
+		 *
+		 * @param key tile key
+		 * @return true if the tile has been prefetched and is ready to be taken
+		 */
+		bool isLoaded(const TileKey &key) const ;
+
+		/**
+		 * @brief Takes surfels of a paged-out tile back (the tile file is removed)
+		 *
+		 * Waits for the background read of the tile, if there is one, otherwise reads the file. If the file cannot be read in full,
+		 * nothing is appended and the tile stays paged out (with its file), so that the surfels are not lost.
+		 *
+		 * @param key tile key
+		 * @param surfels surfels of the tile are appended here
+		 * @param last_observed index of the frame in which each surfel was last observed is appended here
+		 * @return true if the surfels have been taken back (false if the tile is not paged out or its file could not be read)
+		 */
+		bool take(const TileKey &key, pcl::PointCloud<PointCustomSurfel> &surfels, std::vector<uint32_t> &last_observed) ;
+
+		/**
+		 * @brief Gets keys of all paged-out tiles
+		 *
+		 * @param keys output keys
+		 */
+		void getTiles(std::vector<TileKey> &keys) const ;
+
+		/**
+		 * @brief Gets paged-out surfels from the bounding box (without taking them back)
+		 *
+		 * @param min_pt minimum corner of the bounding box
+		 * @param max_pt maximum corner of the bounding box
+		 * @param surfels selected surfels are appended here
+		 */
+		void getSurfelsInBox(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, pcl::PointCloud<PointCustomSurfel> &surfels) ;
+
+		/**
+		 * @brief Gets number of paged-out surfels
+		 *
+		 * @return number of surfels
+		 */
+		size_t getSurfelCount() const { return surfel_count ; }
+
+		/**
+		 * @brief Drops all paged-out tiles (the tile files are removed)
+		 */
+		void clear() ;
+} ;
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ *  @file voxel_block_surfel_index.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef VOXEL_BLOCK_SURFEL_INDEX_HPP
+#define VOXEL_BLOCK_SURFEL_INDEX_HPP
+
+#include "surfel_index.hpp"
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <stdint.h>
+
+/**
+* @brief Spatial index based on hashed voxel blocks
+*
+* The space is divided into a world-aligned grid of leaf voxels. Leaves are grouped in fixed-size cubic blocks
+* stored in a hash map keyed by integer block coordinates. The index has no root, so its depth and the cost of
+* finding visible leaves do not depend on the extent of the map. Visible blocks are enumerated directly from the
+* bounding box of the view frustum.
+*/
+class VoxelBlockSurfelIndex : public SurfelIndex {
+	public:
+		static const int BLOCK_SIDE = 8 ; /**< @brief number of leaves along the block side */
+		static const int BLOCK_VOLUME = BLOCK_SIDE * BLOCK_SIDE * BLOCK_SIDE ; /**< @brief number of leaves in the block */
+
+	protected:
+		/**
+		 * @brief Integer coordinates of a block (or voxel)
+		 */
+		struct BlockKey {
+			int x ; /**< @brief x coordinate */
+			int y ; /**< @brief y coordinate */
+			int z ; /**< @brief z coordinate */
+
+			/**
+			 * @brief Compares two keys
+			 *
+			 * @param other key to compare with
+			 * @return true if the keys are equal
+			 */
+			bool operator==(const BlockKey &other) const { return x == other.x && y == other.y && z == other.z ; }
+		} ;
+
+		/**
+		 * @brief Hash function of the block key
+		 */
+		struct BlockKeyHash {
+			/**
+			 * @brief Computes hash of the key
+			 *
+			 * @param key block key
+			 * @return hash value
+			 */
+			size_t operator()(const BlockKey &key) const { return ((size_t) key.x * 73856093u) ^ ((size_t) key.y * 19349663u) ^ ((size_t) key.z * 83492791u) ; }
+		} ;
+
+		/**
+		 * @brief Block of leaves
+		 *
+		 * Only occupied leaves are allocated, the slot table maps the leaf position within the block to the leaf.
+		 */
+		struct VoxelBlock {
+			int16_t slots[BLOCK_VOLUME] ; /**< @brief index of the leaf in leaves for each position in the block (-1 - no leaf) */
+			std::deque<SurfelLeaf> leaves ; /**< @brief occupied leaves (a deque keeps their addresses when leaves are added) */
+			std::vector<uint16_t> leaf_positions ; /**< @brief position of each leaf within the block */
+
+			/**
+			 * @brief A constructor (creates an empty block)
+			 */
+			VoxelBlock() { std::fill(slots, slots + BLOCK_VOLUME, -1) ; }
+		} ;
+
+		typedef std::unordered_map<BlockKey, VoxelBlock, BlockKeyHash> BlockMapT ; /**< @brief block map type */
+
+		double resolution ; /**< @brief leaf voxel side */
+		double block_side ; /**< @brief block side */
+		const SurfelStorage *storage ; /**< @brief indexed storage */
+		BlockMapT blocks ; /**< @brief allocated blocks */
+		size_t leaf_count ; /**< @brief number of leaves in all blocks */
+
+		/**
+		 * @brief Divides integer rounding towards negative infinity
+		 *
+		 * @param a dividend
+		 * @param b divisor (positive)
+		 * @return floor of a / b
+		 */
+		static inline int floorDiv(int a, int b) { return (a >= 0) ? a / b : -((-a + b - 1) / b) ; }
+
+		/**
+		 * @brief Spreads the 21 lowest bits of the value, so that two zero bits follow each of them
+		 *
+		 * @param v input value
+		 * @return spread value
+		 */
+		static inline uint64_t spreadBits(uint64_t v)
+		{
+			v &= 0x1fffff ;
+			v = (v | v << 32) & 0x1f00000000ffffULL ;
+			v = (v | v << 16) & 0x1f0000ff0000ffULL ;
+			v = (v | v << 8) & 0x100f00f00f00f00fULL ;
+			v = (v | v << 4) & 0x10c30c30c30c30c3ULL ;
+			v = (v | v << 2) & 0x1249249249249249ULL ;
+			return v ;
+		}
+
+		/**
+		 * @brief Computes the Morton code of a voxel (coordinates are offset, so that 21 bits cover both signs)
+		 *
+		 * @param vx x coordinate of the voxel
+		 * @param vy y coordinate of the voxel
+		 * @param vz z coordinate of the voxel
+		 * @return Morton code
+		 */
+		static inline uint64_t getMortonCode(int vx, int vy, int vz) { return spreadBits(vx + (1 << 20)) | spreadBits(vy + (1 << 20)) << 1 | spreadBits(vz + (1 << 20)) << 2 ; }
+
+		/**
+		 * @brief Adds point of the given index to the index structure
+		 *
+		 * @param idx index of the point in the input storage
+		 */
+		void addPointIdx(SurfelIdx idx) ;
+
+		/**
+		 * @brief Gets the block bounds
+		 *
+		 * @param key block key
+		 * @param min_bb output minimum corner of the block
+		 * @param max_bb output maximum corner of the block
+		 */
+		void getBlockBounds(const BlockKey &key, Eigen::Vector3d &min_bb, Eigen::Vector3d &max_bb) ;
+
+		/**
+		 * @brief Gets the leaf bounds
+		 *
+		 * @param key block key
+		 * @param position leaf position within the block
+		 * @param min_bb output minimum corner of the leaf
+		 * @param max_bb output maximum corner of the leaf
+		 */
+		void getLeafBounds(const BlockKey &key, int position, Eigen::Vector3d &min_bb, Eigen::Vector3d &max_bb) ;
+
+		/**
+		 * @brief Collects blocks overlapping the box
+		 *
+		 * Depending on which is smaller, either the block coordinates of the box are enumerated, or the allocated blocks are scanned.
+		 *
+		 * @param min_bb minimum corner of the box
+		 * @param max_bb maximum corner of the box
+		 * @param selected output blocks
+		 */
+		void getBlocksInBox(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb, std::vector<BlockMapT::value_type*> &selected) ;
+
+	public:
+		/**
+		 * @brief A parametric constructor
+		 *
+		 * @param resolution leaf voxel side
+		 */
+		VoxelBlockSurfelIndex(double resolution) ;
+
+		virtual void setInputStorage(const SurfelStorage *storage) ;
+		virtual void addPointsFromInputStorage() ;
+		virtual void addPointFromStorage(SurfelIdx idx) ;
+		virtual unsigned int getVisibleLeaves(const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves) ;
+		virtual void getLeaves(std::vector<SurfelLeaf*> &leaves) ;
+		virtual void getOrderedLeaves(std::vector<SurfelLeaf*> &leaves) ;
+		virtual void boxSearch(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<SurfelIdx> &k_indices) ;
+		virtual void getPreview(unsigned int level, double preview_resolution, int color_samples, pcl::PointCloud<pcl::PointXYZRGB> &cloud) ;
+		virtual void getMemoryUsage(IndexMemoryUsage &usage) const ;
+
+		/**
+		 * @brief Gets number of allocated blocks
+		 *
+		 * @return number of blocks
+		 */
+		size_t getBlockCount() ;
+} ;
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ *  @file cloud_compression.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ * 
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "cloud_compression.hpp"
+#include <pcl/compression/octree_pointcloud_compression.h>
+#include <sstream>
+
+CloudCompression::CloudCompression(double point_resolution, double octree_resolution, unsigned int color_bit_resolution)
+{
+	this->point_resolution = point_resolution ;
+	this->octree_resolution = octree_resolution ;
+	this->color_bit_resolution = color_bit_resolution ;
+}
+
+void CloudCompression::encode(const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr &cloud, std::vector<uint8_t> &data)
+{
+	//A fresh encoder for every cloud - the first frame of the encoder is always an intra frame
+	pcl::io::OctreePointCloudCompression<pcl::PointXYZRGB> encoder(pcl::io::MANUAL_CONFIGURATION, false, 
+			point_resolution, octree_resolution, false, 0, true, static_cast<unsigned char>(color_bit_resolution)) ;
+
+	std::stringstream compressed ;
+	encoder.encodePointCloud(cloud, compressed) ;
+
+	const std::string &str = compressed.str() ;
+	data.assign(str.begin(), str.end()) ;
+}
+
+void CloudCompression::decode(const std::vector<uint8_t> &data, pcl::PointCloud<pcl::PointXYZRGB>::Ptr &cloud)
+{
+	pcl::io::OctreePointCloudCompression<pcl::PointXYZRGB> decoder ;
+
+	std::stringstream compressed(std::string(data.begin(), data.end())) ;
+	if (!cloud)
+		cloud.reset(new pcl::PointCloud<pcl::PointXYZRGB>) ;
+	decoder.decodePointCloud(compressed, cloud) ;
+}
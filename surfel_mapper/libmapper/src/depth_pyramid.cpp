@@ -0,0 +1,129 @@
+/**
+ *  @file depth_pyramid.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "depth_pyramid.hpp"
+#include <algorithm>
+#include <limits>
+
+void DepthPyramid::reset(int width, int height)
+{
+	this->width = width ;
+	this->height = height ;
+	levels.resize(1) ;
+	level_widths.assign(1, (width + TILE_SIZE - 1) / TILE_SIZE) ;
+	level_heights.assign(1, (height + TILE_SIZE - 1) / TILE_SIZE) ;
+	levels[0].assign(level_widths[0] * level_heights[0], -std::numeric_limits<float>::infinity()) ;
+	valid_sums.assign((width + 1) * (height + 1), 0) ;
+}
+
+void DepthPyramid::finish()
+{
+	//Coarser levels - maximum over 2x2 tiles
+	int lw = level_widths[0] ;
+	int lh = level_heights[0] ;
+	while (lw > 1 || lh > 1) {
+		int pw = lw, ph = lh ;
+		lw = (lw + 1) / 2 ;
+		lh = (lh + 1) / 2 ;
+		std::vector<float> level(lw * lh, -std::numeric_limits<float>::infinity()) ;
+		const std::vector<float> &prev = levels.back() ;
+		for (int i = 0; i < ph ; i++)
+			for (int j = 0; j < pw ; j++)
+				level[(i / 2) * lw + j / 2] = std::max(level[(i / 2) * lw + j / 2], prev[i * pw + j]) ;
+		levels.push_back(level) ;
+		level_widths.push_back(lw) ;
+		level_heights.push_back(lh) ;
+	}
+}
+
+void DepthPyramid::build(const pcl::PointCloud<pcl::PointXYZRGBNormal> &scan)
+{
+	reset(scan.width, scan.height) ;
+	for (uint32_t i = 0; i < scan.height ; i++)
+		for (uint32_t j = 0; j < scan.width ; j++)
+			addPixel(j, i, scan(j, i).z) ;
+	finish() ;
+}
+
+void DepthPyramid::setCamera(const Eigen::Matrix4d &view_matrix, double alpha, double beta, double cx, double cy, double margin)
+{
+	this->view_matrix = view_matrix ;
+	this->alpha = alpha ;
+	this->beta = beta ;
+	this->cx = cx ;
+	this->cy = cy ;
+	this->margin = margin ;
+}
+
+float DepthPyramid::getMaxDepth(int u0, int v0, int u1, int v1) const
+{
+	//Select the finest level, at which the rectangle spans at most 2x2 tiles
+	size_t level = 0 ;
+	int tile_size = TILE_SIZE ;
+	while (level + 1 < levels.size() && (u1 / tile_size - u0 / tile_size > 1 || v1 / tile_size - v0 / tile_size > 1)) {
+		level++ ;
+		tile_size *= 2 ;
+	}
+
+	float max_depth = -std::numeric_limits<float>::infinity() ;
+	const std::vector<float> &tiles = levels[level] ;
+	for (int ty = v0 / tile_size; ty <= v1 / tile_size ; ty++)
+		for (int tx = u0 / tile_size; tx <= u1 / tile_size ; tx++)
+			max_depth = std::max(max_depth, tiles[ty * level_widths[level] + tx]) ;
+	return max_depth ;
+}
+
+uint32_t DepthPyramid::getValidCount(int u0, int v0, int u1, int v1) const
+{
+	int w = width + 1 ;
+	return valid_sums[(v1 + 1) * w + u1 + 1] - valid_sums[v0 * w + u1 + 1] - valid_sums[(v1 + 1) * w + u0] + valid_sums[v0 * w + u0] ;
+}
+
+bool DepthPyramid::isOccluded(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb) const
+{
+	if (levels.empty())
+		return false ;
+
+	//Project corners of the (extended) box
+	double min_z = std::numeric_limits<double>::max() ;
+	double umin = std::numeric_limits<double>::max(), vmin = umin ;
+	double umax = -std::numeric_limits<double>::max(), vmax = umax ;
+	for (int i = 0; i < 8 ; i++) {
+		Eigen::Vector4d corner((i & 1) ? max_bb[0] + margin : min_bb[0] - margin,
+				(i & 2) ? max_bb[1] + margin : min_bb[1] - margin,
+				(i & 4) ? max_bb[2] + margin : min_bb[2] - margin, 1.0) ;
+		Eigen::Vector4d corner_trans = view_matrix * corner ;
+		if (corner_trans[2] <= 0.0)
+			return false ; //The box reaches the sensor plane - its footprint is unbounded
+		double u = alpha * corner_trans[0] / corner_trans[2] + cx ;
+		double v = beta * corner_trans[1] / corner_trans[2] + cy ;
+		min_z = std::min(min_z, corner_trans[2]) ;
+		umin = std::min(umin, u) ;
+		umax = std::max(umax, u) ;
+		vmin = std::min(vmin, v) ;
+		vmax = std::max(vmax, v) ;
+	}
+
+	//The whole scan is closer than the box
+	if (levels.back()[0] + margin < min_z)
+		return true ;
+
+	//Pixels hit by surfels (nearest neighbor sampling), extended by one pixel to be safe against rounding
+	int u0 = std::max((int) floor(umin + 0.5) - 1, 0) ;
+	int v0 = std::max((int) floor(vmin + 0.5) - 1, 0) ;
+	int u1 = std::min((int) floor(umax + 0.5) + 1, width - 1) ;
+	int v1 = std::min((int) floor(vmax + 0.5) + 1, height - 1) ;
+	if (u0 > u1 || v0 > v1)
+		return true ; //The box projects outside the scan
+	if (getValidCount(u0, v0, u1, v1) == 0)
+		return true ; //The box projects only on invalid readings
+
+	return getMaxDepth(u0, v0, u1, v1) + margin < min_z ;
+}
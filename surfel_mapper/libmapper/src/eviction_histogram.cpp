@@ -0,0 +1,139 @@
+/**
+ *  @file eviction_histogram.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "eviction_histogram.hpp"
+#include <algorithm>
+#include <assert.h>
+
+const uint32_t EvictionHistogram::NO_BUCKET ;
+const SurfelIdx EvictionHistogram::NO_SLOT ;
+
+EvictionHistogram::EvictionHistogram(): count(0)
+{}
+
+void EvictionHistogram::reserveSlot(SurfelIdx idx)
+{
+	if ((size_t) idx >= slots.size()) {
+		SlotLinks empty = { NO_SLOT, NO_SLOT, NO_BUCKET } ;
+		slots.resize(idx + 1, empty) ;
+	}
+}
+
+void EvictionHistogram::link(SurfelIdx idx, uint32_t bucket)
+{
+	if (bucket >= buckets.size()) {
+		Bucket empty = { 0, NO_SLOT, NO_SLOT } ;
+		buckets.resize(bucket + 1, empty) ;
+	}
+	Bucket &b = buckets[bucket] ;
+	SlotLinks &s = slots[idx] ;
+	s.prev = b.tail ;
+	s.next = NO_SLOT ;
+	s.bucket = bucket ;
+	if (b.tail != NO_SLOT)
+		slots[b.tail].next = idx ;
+	else
+		b.head = idx ;
+	b.tail = idx ;
+	b.count++ ;
+}
+
+void EvictionHistogram::unlink(SurfelIdx idx)
+{
+	SlotLinks &s = slots[idx] ;
+	Bucket &b = buckets[s.bucket] ;
+	if (s.prev != NO_SLOT)
+		slots[s.prev].next = s.next ;
+	else
+		b.head = s.next ;
+	if (s.next != NO_SLOT)
+		slots[s.next].prev = s.prev ;
+	else
+		b.tail = s.prev ;
+	b.count-- ;
+	s.prev = s.next = NO_SLOT ;
+	s.bucket = NO_BUCKET ;
+}
+
+void EvictionHistogram::relink(SurfelIdx idx)
+{
+	const SlotLinks &s = slots[idx] ;
+	if (s.bucket == NO_BUCKET)
+		return ;
+	if (s.prev != NO_SLOT)
+		slots[s.prev].next = idx ;
+	else
+		buckets[s.bucket].head = idx ;
+	if (s.next != NO_SLOT)
+		slots[s.next].prev = idx ;
+	else
+		buckets[s.bucket].tail = idx ;
+}
+
+void EvictionHistogram::insert(SurfelIdx idx, uint32_t bucket)
+{
+	assert(bucket != NO_BUCKET) ;
+	reserveSlot(idx) ;
+	assert(slots[idx].bucket == NO_BUCKET) ;
+	link(idx, bucket) ;
+	count++ ;
+}
+
+void EvictionHistogram::erase(SurfelIdx idx)
+{
+	if (getBucket(idx) == NO_BUCKET)
+		return ;
+	unlink(idx) ;
+	count-- ;
+}
+
+void EvictionHistogram::update(SurfelIdx idx, uint32_t bucket)
+{
+	assert(getBucket(idx) != NO_BUCKET) ;
+	unlink(idx) ;
+	link(idx, bucket) ;
+}
+
+void EvictionHistogram::swap(SurfelIdx a, SurfelIdx b)
+{
+	if (a == b)
+		return ;
+	reserveSlot(std::max(a, b)) ;
+	std::swap(slots[a], slots[b]) ;
+	//Adjacent slots pointed at each other, their links now point at themselves
+	SurfelIdx *links[4] = { &slots[a].prev, &slots[a].next, &slots[b].prev, &slots[b].next } ;
+	for (int i = 0; i < 4 ; i++) {
+		if (*links[i] == a)
+			*links[i] = b ;
+		else if (*links[i] == b)
+			*links[i] = a ;
+	}
+	relink(a) ;
+	relink(b) ;
+}
+
+void EvictionHistogram::clear()
+{
+	buckets.clear() ;
+	slots.clear() ;
+	count = 0 ;
+}
+
+void EvictionHistogram::release()
+{
+	std::vector<Bucket>().swap(buckets) ;
+	std::vector<SlotLinks>().swap(slots) ;
+	count = 0 ;
+}
+
+size_t EvictionHistogram::getMemoryBytes() const
+{
+	return buckets.capacity() * sizeof(Bucket) + slots.capacity() * sizeof(SlotLinks) ;
+}
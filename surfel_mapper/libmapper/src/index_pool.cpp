@@ -0,0 +1,119 @@
+/**
+ *  @file index_pool.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "index_pool.hpp"
+#include <assert.h>
+
+IndexPool::IndexPool(): chunk_pos(NULL), chunk_end(NULL), used_bytes(0), heap_bytes(0)
+{
+	for (int i = 0; i < CLASS_COUNT ; i++)
+		free_lists[i] = NULL ;
+}
+
+IndexPool::~IndexPool()
+{
+	for (size_t i = 0; i < chunks.size() ; i++)
+		delete[] chunks[i] ;
+}
+
+int IndexPool::getClass(uint32_t &capacity)
+{
+	int size_class = 0 ;
+	uint32_t class_capacity = MIN_BLOCK_CAPACITY ;
+	while (class_capacity < capacity && size_class < CLASS_COUNT) {
+		class_capacity <<= 1 ;
+		size_class++ ;
+	}
+	if (size_class < CLASS_COUNT)
+		capacity = class_capacity ;
+	return size_class ;
+}
+
+char *IndexPool::carveBlock(int size_class)
+{
+	size_t block_bytes = (MIN_BLOCK_CAPACITY << size_class) * sizeof(SurfelIdx) ;
+	if (chunk_pos == NULL || (size_t) (chunk_end - chunk_pos) < block_bytes) {
+		//Put the rest of the current chunk on the free lists (all block sizes are multiples of the smallest one)
+		for (int c = CLASS_COUNT - 1; c >= 0 && chunk_pos != NULL ; c--) {
+			size_t bytes = (MIN_BLOCK_CAPACITY << c) * sizeof(SurfelIdx) ;
+			while ((size_t) (chunk_end - chunk_pos) >= bytes) {
+				FreeBlock *block = reinterpret_cast<FreeBlock*>(chunk_pos) ;
+				block->next = free_lists[c] ;
+				free_lists[c] = block ;
+				chunk_pos += bytes ;
+			}
+		}
+		chunks.push_back(new char[CHUNK_SIZE]) ;
+		chunk_pos = chunks.back() ;
+		chunk_end = chunk_pos + CHUNK_SIZE ;
+	}
+	char *block = chunk_pos ;
+	chunk_pos += block_bytes ;
+	return block ;
+}
+
+SurfelIdx *IndexPool::allocate(uint32_t &capacity)
+{
+	int size_class = getClass(capacity) ;
+	used_bytes += capacity * sizeof(SurfelIdx) ;
+	if (size_class == CLASS_COUNT) {
+		heap_bytes += capacity * sizeof(SurfelIdx) ;
+		return new SurfelIdx[capacity] ;
+	}
+
+	if (free_lists[size_class] != NULL) {
+		FreeBlock *block = free_lists[size_class] ;
+		free_lists[size_class] = block->next ;
+		return reinterpret_cast<SurfelIdx*>(block) ;
+	}
+	return reinterpret_cast<SurfelIdx*>(carveBlock(size_class)) ;
+}
+
+void IndexPool::deallocate(SurfelIdx *block, uint32_t capacity)
+{
+	int size_class = getClass(capacity) ;
+	assert(used_bytes >= capacity * sizeof(SurfelIdx)) ;
+	used_bytes -= capacity * sizeof(SurfelIdx) ;
+	if (size_class == CLASS_COUNT) {
+		heap_bytes -= capacity * sizeof(SurfelIdx) ;
+		delete[] block ;
+		return ;
+	}
+	FreeBlock *free_block = reinterpret_cast<FreeBlock*>(block) ;
+	free_block->next = free_lists[size_class] ;
+	free_lists[size_class] = free_block ;
+}
+
+void IndexPool::release()
+{
+	if (used_bytes > 0)
+		return ;
+	for (size_t i = 0; i < chunks.size() ; i++)
+		delete[] chunks[i] ;
+	chunks.clear() ;
+	chunk_pos = chunk_end = NULL ;
+	for (int i = 0; i < CLASS_COUNT ; i++)
+		free_lists[i] = NULL ;
+}
+
+size_t IndexPool::getUsedBytes() const
+{
+	return used_bytes ;
+}
+
+size_t IndexPool::getReservedBytes() const
+{
+	return chunks.size() * CHUNK_SIZE ;
+}
+
+size_t IndexPool::getHeapBytes() const
+{
+	return heap_bytes ;
+}
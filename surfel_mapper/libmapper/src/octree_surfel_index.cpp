@@ -0,0 +1,430 @@
+/**
+ *  @file octree_surfel_index.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "octree_surfel_index.hpp"
+#include <pcl/visualization/common/common.h>
+#include <pcl/octree/octree_impl.h>
+#include <pcl/common/point_tests.h>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <assert.h>
+#include <limits>
+#include <limits.h>
+#include <math.h>
+
+namespace {
+
+/**
+ * @brief Key of an octree node independent of its position in the linear octree
+ */
+struct NodeKey {
+	int64_t x ; /**< @brief x coordinate of the minimum corner in leaf voxels */
+	int64_t y ; /**< @brief y coordinate of the minimum corner in leaf voxels */
+	int64_t z ; /**< @brief z coordinate of the minimum corner in leaf voxels */
+	int64_t size ; /**< @brief side of the node in leaf voxels */
+
+	bool operator==(const NodeKey &other) const { return x == other.x && y == other.y && z == other.z && size == other.size ; }
+} ;
+
+size_t hash_value(const NodeKey &key)
+{
+	size_t seed = 0 ;
+	boost::hash_combine(seed, key.x) ;
+	boost::hash_combine(seed, key.y) ;
+	boost::hash_combine(seed, key.z) ;
+	boost::hash_combine(seed, key.size) ;
+	return seed ;
+}
+
+NodeKey getNodeKey(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb, double resolution)
+{
+	NodeKey key = { llround(min_bb[0] / resolution), llround(min_bb[1] / resolution), llround(min_bb[2] / resolution), llround((max_bb[0] - min_bb[0]) / resolution) } ;
+	return key ;
+}
+
+}
+
+SurfelLeaf *SurfelOctree::addSurfel(const PointCustomSurfel &point, int idx)
+{
+	//As in OctreePointCloud::addPointIdx(), the point is passed instead of being read from the input cloud
+	adoptBoundingBoxToPoint(point) ;
+	pcl::octree::OctreeKey key ;
+	genOctreeKeyforPoint(point, key) ;
+	LeafNode *leaf_node ;
+	BranchNode *parent_branch ;
+	createLeafRecursive(key, depth_mask_, root_node_, leaf_node, parent_branch) ;
+	(*leaf_node)->addPointIndex(idx) ;
+	return leaf_node->getContainerPtr() ;
+}
+
+OctreeSurfelIndex::OctreeSurfelIndex(double resolution): resolution(resolution), storage(NULL), octree(500.0), linear_valid(false), linear_leaf_count(0), linear_branch_count(0),
+	cut_valid(false), full_cut_size(0), rotation_motion(0.0), translation_motion(0.0)
+{
+	octree.setResolution(resolution) ; //Does it give the same effect as placed in the constructor?
+	//octree.defineBoundingBox(-100,-100,-100, 100, 100, 100) ;
+}
+
+void OctreeSurfelIndex::updateLinearOctree()
+{
+	//Surfels are added mostly to existing leaves, so the structure changes only if new nodes appear
+	if (linear_valid && octree.getLeafCount() == linear_leaf_count && octree.getBranchCount() == linear_branch_count)
+		return ;
+
+	std::vector<LinearNode> old_nodes ; //Kept for moving the cut to the new linear octree
+	if (cut_valid)
+		old_nodes.swap(linear_nodes) ;
+	linear_nodes.clear() ;
+	linear_nodes.reserve(octree.getLeafCount() + octree.getBranchCount()) ;
+	std::vector<uint32_t> open_nodes ; //Nodes on the path from the root, whose subtrees are not closed yet
+	OctreeT::DepthFirstIterator it = octree.depth_begin() ;
+	const OctreeT::DepthFirstIterator it_end = octree.depth_end();
+	while(it != it_end) {
+		LinearNode node ;
+		node.depth = it.getCurrentOctreeDepth() ;
+		//Close subtrees of the previous nodes not being ancestors of this node
+		while (!open_nodes.empty() && linear_nodes[open_nodes.back()].depth >= node.depth) {
+			linear_nodes[open_nodes.back()].subtree_end = linear_nodes.size() ;
+			open_nodes.pop_back() ;
+		}
+		Eigen::Vector3f min_bb, max_bb ;
+		octree.getVoxelBounds(it, min_bb, max_bb) ;
+		node.min_bb = min_bb.cast<double>() ;
+		node.max_bb = max_bb.cast<double>() ;
+		node.leaf = it.isLeafNode() ? &it.getLeafContainer() : NULL ;
+		open_nodes.push_back(linear_nodes.size()) ;
+		linear_nodes.push_back(node) ;
+		it++ ;
+	}
+	for (size_t i = 0; i < open_nodes.size() ; i++)
+		linear_nodes[open_nodes[i]].subtree_end = linear_nodes.size() ;
+
+	linear_leaf_count = octree.getLeafCount() ;
+	linear_branch_count = octree.getBranchCount() ;
+	linear_valid = true ;
+	remapCut(old_nodes) ;
+}
+
+void OctreeSurfelIndex::remapCut(const std::vector<LinearNode> &old_nodes)
+{
+	if (!cut_valid)
+		return ;
+
+	//Voxels of the cut subtrees and of the nodes above the cut
+	boost::unordered_map<NodeKey, size_t> entries ;
+	boost::unordered_set<NodeKey> ancestors ;
+	size_t e = 0 ;
+	for (size_t n = 0; n < old_nodes.size() ;) {
+		NodeKey key = getNodeKey(old_nodes[n].min_bb, old_nodes[n].max_bb, resolution) ;
+		if (e < cut.size() && cut[e].node == n) {
+			entries[key] = e++ ;
+			n = old_nodes[n].subtree_end ;
+		} else {
+			ancestors.insert(key) ;
+			n++ ;
+		}
+	}
+
+	//New nodes are either inside the old subtrees or start new subtrees below the nodes above the cut
+	std::vector<CutEntry> new_cut ;
+	new_cut.reserve(cut.size()) ;
+	for (size_t n = 0; n < linear_nodes.size() ;) {
+		NodeKey key = getNodeKey(linear_nodes[n].min_bb, linear_nodes[n].max_bb, resolution) ;
+		boost::unordered_map<NodeKey, size_t>::const_iterator it = entries.find(key) ;
+		if (it != entries.end()) {
+			new_cut.push_back(cut[it->second]) ;
+			new_cut.back().node = n ;
+			n = linear_nodes[n].subtree_end ;
+		} else if (ancestors.count(key))
+			n++ ;
+		else {
+			CutEntry entry = { (uint32_t) n, pcl::visualization::PCL_INTERSECT_FRUSTUM, 0.0, rotation_motion, translation_motion } ;
+			new_cut.push_back(entry) ;
+			n = linear_nodes[n].subtree_end ;
+		}
+	}
+	cut.swap(new_cut) ;
+}
+
+void OctreeSurfelIndex::computeVoxelColor(size_t begin, size_t end, int color_samples, pcl::PointXYZRGB &point)
+{
+	//Select a few pixels from the current voxel and compute an average
+	unsigned long rs, gs, bs ;
+	rs = gs = bs = 0 ;
+	unsigned long count  = 0;
+	for (size_t n = begin; n < end ; n++) {
+		if (linear_nodes[n].leaf) {
+			//Examine points in the voxel
+			const SurfelLeaf &pointIndices = *linear_nodes[n].leaf ;
+			unsigned int step = pointIndices.size() / color_samples ;
+			if (step < 1) step = 1 ;
+			//Now select every "step" - point
+			for (unsigned int i = 0; i < pointIndices.size() ; i += step) {
+				PointCustomSurfel p ;
+				storage->load(pointIndices[i], p) ;
+				rs += p.r ;
+				gs += p.g ;
+				bs += p.b ;
+				count++ ;
+			}
+		}
+	}
+	if (count > 0) {
+		point.r = rs / count ;
+		point.g = gs / count ;
+		point.b = bs / count ;
+	}
+}
+
+void OctreeSurfelIndex::setInputStorage(const SurfelStorage *storage)
+{
+	this->storage = storage ;
+}
+
+void OctreeSurfelIndex::addPointsFromInputStorage()
+{
+	for (size_t i = 0; i < storage->size() ; i++)
+		if (storage->isFinite(i))
+			addPointFromStorage(i) ;
+}
+
+void OctreeSurfelIndex::addPointFromStorage(SurfelIdx idx)
+{
+	assert(idx <= std::numeric_limits<int>::max()) ; //PCL octrees index points with int
+	setLeaf(idx, octree.addSurfel(storage->get(idx), static_cast<int>(idx))) ;
+}
+
+unsigned int OctreeSurfelIndex::classifySubtree(size_t root, const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves, std::vector<CutEntry> &new_cut)
+{
+	if (root >= linear_nodes.size())
+		return 0 ;
+
+	unsigned int nodes_visited = 0 ;
+	//Scan the subtree, subtrees outside or inside the frustum are jumped over
+	//Planes still to be tested and the distance from the planes passed are kept for the current path (children skip planes their parent is inside of)
+	const uint32_t root_depth = linear_nodes[root].depth ;
+	std::vector<unsigned int> plane_masks(octree.getTreeDepth() + 1 - root_depth, ViewFrustum::ALL_PLANES) ;
+	std::vector<double> margins(plane_masks.size(), std::numeric_limits<double>::max()) ;
+	size_t n = root ;
+	const size_t n_end = linear_nodes[root].subtree_end ;
+	while (n < n_end) {
+		const LinearNode &node = linear_nodes[n] ;
+		const uint32_t level = node.depth - root_depth ;
+		nodes_visited++ ;
+		unsigned int plane_mask = (level > 0) ? plane_masks[level - 1] : ViewFrustum::ALL_PLANES ;
+		double margin = (level > 0) ? margins[level - 1] : std::numeric_limits<double>::max() ;
+		int frustum_result = frustum.cull(node.min_bb, node.max_bb, plane_mask, margin) ;
+		plane_masks[level] = plane_mask ;
+		margins[level] = margin ;
+		CutEntry entry = { (uint32_t) n, frustum_result, margin, rotation_motion, translation_motion } ;
+		if (frustum_result == pcl::visualization::PCL_OUTSIDE_FRUSTUM) {
+			new_cut.push_back(entry) ;
+			n = node.subtree_end ;
+		} else if (frustum_result == pcl::visualization::PCL_INSIDE_FRUSTUM) {
+			new_cut.push_back(entry) ;
+			nodes_visited += collectSubtree(n, frustum, leaves) ;
+			n = node.subtree_end ;
+		} else if (frustum.isOccluded(node.min_bb, node.max_bb)) {
+			entry.margin = 0.0 ; //Occlusion changes with each scan
+			new_cut.push_back(entry) ;
+			n = node.subtree_end ;
+		} else {
+			if (node.leaf) {
+				entry.margin = frustum.getExitDistance(node.min_bb, node.max_bb) ; //The leaf stays visible until it leaves the frustum
+				new_cut.push_back(entry) ;
+				leaves.push_back(node.leaf) ;
+			}
+			n++ ;
+		}
+	}
+	return nodes_visited ;
+}
+
+unsigned int OctreeSurfelIndex::collectSubtree(size_t root, const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves)
+{
+	size_t n = root ;
+	const size_t n_end = linear_nodes[root].subtree_end ;
+	if (frustum.depth_bounds == NULL) {
+		//All nodes are accepted without tests
+		for (; n < n_end ; n++)
+			if (linear_nodes[n].leaf)
+				leaves.push_back(linear_nodes[n].leaf) ;
+		return 0 ;
+	}
+
+	unsigned int nodes_visited = 0 ;
+	while (n < n_end) {
+		const LinearNode &node = linear_nodes[n] ;
+		nodes_visited++ ;
+		if (frustum.isOccluded(node.min_bb, node.max_bb))
+			n = node.subtree_end ;
+		else {
+			if (node.leaf)
+				leaves.push_back(node.leaf) ;
+			n++ ;
+		}
+	}
+	return nodes_visited ;
+}
+
+bool OctreeSurfelIndex::isClassificationValid(const CutEntry &entry, const ViewFrustum &frustum) const
+{
+	//Branches crossing the frustum boundary are reclassified, for leaves it is enough that they are still not outside
+	const LinearNode &node = linear_nodes[entry.node] ;
+	if (entry.classification == pcl::visualization::PCL_INTERSECT_FRUSTUM && node.leaf == NULL)
+		return false ;
+
+	//A point moves relative to the sensor by at most the sensor translation plus the rotation times its distance from the sensor,
+	//the distance in any of the frames since the classification is bounded by the current distance plus the path length
+	double rotation = rotation_motion - entry.rotation_motion ;
+	double translation = translation_motion - entry.translation_motion ;
+	double reach = (0.5 * (node.min_bb + node.max_bb) - frustum.origin).norm() + 0.5 * (node.max_bb - node.min_bb).norm() + translation ;
+	return rotation * reach + translation < entry.margin ;
+}
+
+unsigned int OctreeSurfelIndex::getVisibleLeaves(const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves)
+{
+	updateLinearOctree() ;
+	//The cut is reused only for the frustum following the sensor
+	bool reuse_cut = cut_valid && frustum.enabled && frustum.pose_valid ;
+	if (reuse_cut) {
+		translation_motion += (frustum.origin - last_origin).norm() ;
+		rotation_motion += sqrt(std::max(0.0, 3.0 - (frustum.rotation * last_rotation.transpose()).trace())) ; //2 sin(angle / 2)
+	}
+	if (frustum.pose_valid) {
+		last_origin = frustum.origin ;
+		last_rotation = frustum.rotation ;
+	}
+
+	unsigned int nodes_visited = 0 ;
+	std::vector<CutEntry> new_cut ;
+	new_cut.reserve(cut.size()) ;
+	if (!reuse_cut) {
+		nodes_visited = classifySubtree(0, frustum, leaves, new_cut) ;
+		full_cut_size = new_cut.size() ;
+	} else
+		for (size_t e = 0; e < cut.size() ; e++) {
+			const CutEntry &entry = cut[e] ;
+			if (!isClassificationValid(entry, frustum)) {
+				nodes_visited += classifySubtree(entry.node, frustum, leaves, new_cut) ;
+				continue ;
+			}
+			nodes_visited++ ;
+			new_cut.push_back(entry) ;
+			if (entry.classification != pcl::visualization::PCL_OUTSIDE_FRUSTUM)
+				nodes_visited += collectSubtree(entry.node, frustum, leaves) ;
+		}
+	cut.swap(new_cut) ;
+	//Reclassified subtrees are never merged back, so the traversal restarts from the root once the cut becomes much finer
+	cut_valid = frustum.enabled && frustum.pose_valid && cut.size() <= 2 * full_cut_size + 64 ;
+	return nodes_visited ;
+}
+
+void OctreeSurfelIndex::getLeaves(std::vector<SurfelLeaf*> &leaves)
+{
+	updateLinearOctree() ;
+	for (size_t n = 0; n < linear_nodes.size() ; n++)
+		if (linear_nodes[n].leaf)
+			leaves.push_back(linear_nodes[n].leaf) ;
+}
+
+void OctreeSurfelIndex::boxSearch(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<SurfelIdx> &k_indices)
+{
+	//Scan the linear octree, subtrees outside the box are jumped over and subtrees inside it are taken as a whole
+	updateLinearOctree() ;
+	const Eigen::Vector3d min_box = min_pt.cast<double>() ;
+	const Eigen::Vector3d max_box = max_pt.cast<double>() ;
+	size_t n = 0 ;
+	const size_t n_end = linear_nodes.size() ;
+	while (n < n_end) {
+		const LinearNode &node = linear_nodes[n] ;
+		if ((node.max_bb.array() < min_box.array()).any() || (node.min_bb.array() > max_box.array()).any())
+			n = node.subtree_end ;
+		else if ((node.min_bb.array() >= min_box.array()).all() && (node.max_bb.array() <= max_box.array()).all()) {
+			const size_t subtree_end = node.subtree_end ;
+			for (; n < subtree_end ; n++)
+				if (linear_nodes[n].leaf)
+					linear_nodes[n].leaf->getPointIndices(k_indices) ;
+		} else {
+			if (node.leaf) {
+				const SurfelLeaf &pointIndices = *node.leaf ;
+				for (size_t k = 0; k < pointIndices.size() ; k++) {
+					const Eigen::Vector3f point = storage->getPosition(pointIndices[k]) ;
+					if ((point.array() >= min_pt.array()).all() && (point.array() <= max_pt.array()).all())
+						k_indices.push_back(pointIndices[k]) ;
+				}
+			}
+			n++ ;
+		}
+	}
+}
+
+void OctreeSurfelIndex::getPreview(unsigned int level, double preview_resolution, int color_samples, pcl::PointCloud<pcl::PointXYZRGB> &cloud)
+{
+	//Establish maximum tree depth for display
+	unsigned int tree_depth = octree.getTreeDepth() ;
+	unsigned int display_depth = tree_depth ;
+	for (unsigned int depth = 1; depth <= tree_depth ; depth++) {
+		double voxel_side = sqrt(octree.getVoxelSquaredSideLen(depth)) ;
+		if (voxel_side <= preview_resolution) {
+			display_depth = depth ;
+			break ;
+		}
+	}
+	//Each coarser level doubles the voxel side
+	display_depth = (display_depth > level + 1) ? display_depth - level : 1 ;
+
+	//Clear point cloud
+	cloud.clear() ;
+
+	//Convert voxels at fixed depth to points in a downsampled cloud
+	updateLinearOctree() ;
+	size_t n = 0 ;
+	const size_t n_end = linear_nodes.size() ;
+	while (n < n_end) {
+		const LinearNode &node = linear_nodes[n] ;
+		if (node.depth == display_depth) {
+			//Convert a voxel to a single point
+			pcl::PointXYZRGB point ;
+			point.x = (node.min_bb[0] + node.max_bb[0]) / 2 ;
+			point.y = (node.min_bb[1] + node.max_bb[1]) / 2 ;
+			point.z = (node.min_bb[2] + node.max_bb[2]) / 2 ;
+			point.r = point.g = point.b = 255 ;
+			point.a = 255 ;
+
+			computeVoxelColor(n, node.subtree_end, color_samples, point) ; //Computes average color from some selected voxel points
+
+			//Add to point cloud
+			cloud.push_back(point) ;
+			n = node.subtree_end ;
+		} else n++ ;
+	}
+}
+
+OctreeSurfelIndex::OctreeT &OctreeSurfelIndex::getOctree()
+{
+	return octree ;
+}
+
+size_t OctreeSurfelIndex::getLinearNodeCount()
+{
+	updateLinearOctree() ;
+	return linear_nodes.size() ;
+}
+
+void OctreeSurfelIndex::getMemoryUsage(IndexMemoryUsage &usage) const
+{
+	//PCL counts the nodes as they are created
+	usage.branch_count = octree.getBranchCount() ;
+	usage.leaf_count = octree.getLeafCount() ;
+	usage.branch_bytes = usage.branch_count * sizeof(OctreeT::BranchNode) + linear_nodes.capacity() * sizeof(LinearNode) + cut.capacity() * sizeof(CutEntry) ;
+	usage.leaf_bytes = usage.leaf_count * sizeof(OctreeT::LeafNode) + slot_leaves.capacity() * sizeof(SurfelLeaf*) ;
+}
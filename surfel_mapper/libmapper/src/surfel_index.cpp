@@ -0,0 +1,310 @@
+/**
+ *  @file surfel_index.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "surfel_index.hpp"
+#include <pcl/visualization/common/common.h>
+#include <Eigen/LU>
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+
+SurfelLeaf::SurfelLeaf(): count(0), capacity(INLINE_CAPACITY), frozen(false), last_observed(0)
+{}
+
+SurfelLeaf::SurfelLeaf(const SurfelLeaf &other): pcl::octree::OctreeContainerBase(), count(0), capacity(INLINE_CAPACITY), frozen(false), last_observed(0)
+{
+	*this = other ;
+}
+
+SurfelLeaf::SurfelLeaf(SurfelLeaf &&other) noexcept : pcl::octree::OctreeContainerBase(), count(0), capacity(INLINE_CAPACITY), frozen(false), last_observed(0)
+{
+	*this = std::move(other) ;
+}
+
+SurfelLeaf::~SurfelLeaf()
+{
+	reset() ;
+}
+
+SurfelLeaf &SurfelLeaf::operator=(const SurfelLeaf &other)
+{
+	if (this != &other) {
+		reset() ;
+		if (other.isRange()) {
+			capacity = RANGE_CAPACITY ;
+			range_start = other.range_start ;
+		} else {
+			if (other.count > INLINE_CAPACITY)
+				reallocate(other.count) ;
+			std::copy(other.data(), other.data() + other.count, data()) ;
+		}
+		count = other.count ;
+		frozen = other.frozen ;
+		last_observed = other.last_observed ;
+	}
+	return *this ;
+}
+
+SurfelLeaf &SurfelLeaf::operator=(SurfelLeaf &&other) noexcept
+{
+	if (this != &other) {
+		reset() ;
+		if (other.capacity > INLINE_CAPACITY)
+			block = other.block ; //Take over the block
+		else if (other.isRange())
+			range_start = other.range_start ;
+		else
+			std::copy(other.inline_indices, other.inline_indices + other.count, inline_indices) ;
+		count = other.count ;
+		capacity = other.capacity ;
+		frozen = other.frozen ;
+		last_observed = other.last_observed ;
+		other.count = 0 ;
+		other.capacity = INLINE_CAPACITY ;
+		other.frozen = false ;
+		other.last_observed = 0 ;
+	}
+	return *this ;
+}
+
+bool SurfelLeaf::operator==(const pcl::octree::OctreeContainerBase &other) const
+{
+	const SurfelLeaf *other_leaf = dynamic_cast<const SurfelLeaf*>(&other) ;
+	if (other_leaf == NULL || count != other_leaf->count)
+		return false ;
+	for (uint32_t i = 0; i < count ; i++)
+		if (getIndex(i) != other_leaf->getIndex(i))
+			return false ;
+	return true ;
+}
+
+void SurfelLeaf::reset()
+{
+	if (capacity > INLINE_CAPACITY)
+		getPool().deallocate(block, capacity) ;
+	count = 0 ;
+	capacity = INLINE_CAPACITY ;
+	frozen = false ;
+	last_observed = 0 ;
+}
+
+void SurfelLeaf::reallocate(uint32_t new_capacity)
+{
+	assert(new_capacity >= count) ;
+	SurfelIdx *old_data = data() ;
+	if (new_capacity <= INLINE_CAPACITY) {
+		if (capacity > INLINE_CAPACITY) {
+			//Move back to the inline storage
+			SurfelIdx *old_block = block ;
+			std::copy(old_block, old_block + count, inline_indices) ;
+			getPool().deallocate(old_block, capacity) ;
+			capacity = INLINE_CAPACITY ;
+		}
+		return ;
+	}
+	SurfelIdx *new_block = getPool().allocate(new_capacity) ;
+	std::copy(old_data, old_data + count, new_block) ;
+	if (capacity > INLINE_CAPACITY)
+		getPool().deallocate(block, capacity) ;
+	block = new_block ;
+	capacity = new_capacity ;
+}
+
+void SurfelLeaf::addPointIndex(SurfelIdx idx)
+{
+	if (isRange() && idx != range_start + static_cast<SurfelIdx>(count))
+		expandRange() ;
+	if (isRange()) {
+		count++ ; //The index following the range extends it
+	} else {
+		if (count == capacity)
+			reallocate(capacity * 2) ;
+		data()[count++] = idx ;
+	}
+	frozen = false ; //A new surfel has not converged yet
+	last_observed = 0 ; //The frame index is restored when the leaf is processed
+}
+
+void SurfelLeaf::resize(size_t new_size)
+{
+	assert(new_size <= count) ;
+	count = new_size ;
+	//Return storage, if the leaf shrinks considerably
+	if (capacity > INLINE_CAPACITY && count <= capacity / 4)
+		reallocate(std::max<uint32_t>(count * 2, 1)) ;
+}
+
+bool SurfelLeaf::removePointIndex(SurfelIdx idx)
+{
+	if (isRange()) {
+		if (idx < range_start || idx >= range_start + static_cast<SurfelIdx>(count))
+			return false ;
+		if (idx == range_start) {
+			range_start++ ;
+			count-- ;
+			return true ;
+		}
+		if (idx == range_start + static_cast<SurfelIdx>(count) - 1) {
+			count-- ;
+			return true ;
+		}
+	}
+	SurfelIdx *pos = std::find(begin(), end(), idx) ;
+	if (pos == end())
+		return false ;
+	std::copy(pos + 1, end(), pos) ;
+	resize(count - 1) ;
+	return true ;
+}
+
+bool SurfelLeaf::packRange()
+{
+	if (isRange())
+		return true ;
+	if (count == 0)
+		return false ;
+	const SurfelIdx *indices = data() ;
+	for (uint32_t i = 1; i < count ; i++)
+		if (indices[i] != indices[0] + static_cast<SurfelIdx>(i))
+			return false ;
+	SurfelIdx start = indices[0] ;
+	if (capacity > INLINE_CAPACITY)
+		getPool().deallocate(block, capacity) ;
+	capacity = RANGE_CAPACITY ;
+	range_start = start ;
+	return true ;
+}
+
+void SurfelLeaf::expandRange()
+{
+	SurfelIdx start = range_start ;
+	uint32_t n = count ;
+	count = 0 ;
+	capacity = INLINE_CAPACITY ;
+	if (n > INLINE_CAPACITY)
+		reallocate(n) ;
+	SurfelIdx *indices = data() ;
+	for (uint32_t i = 0; i < n ; i++)
+		indices[i] = start + static_cast<SurfelIdx>(i) ;
+	count = n ;
+}
+
+IndexPool &SurfelLeaf::getPool()
+{
+	static IndexPool pool ;
+	return pool ;
+}
+
+void SurfelIndex::setLeaf(SurfelIdx idx, SurfelLeaf *leaf)
+{
+	if ((size_t) idx >= slot_leaves.size())
+		slot_leaves.resize(idx + 1, NULL) ;
+	slot_leaves[idx] = leaf ;
+}
+
+const uint32_t SurfelLeaf::RANGE_CAPACITY ;
+const unsigned int ViewFrustum::ALL_PLANES ;
+
+void ViewFrustum::set(const Eigen::Matrix4d &projection_view)
+{
+	pcl::visualization::getViewFrustum(projection_view, planes) ;
+	//Unit normals make plane tests give metric distances (the signs of the tests are not affected)
+	for (int i = 0; i < 6 ; i++) {
+		double norm = sqrt(planes[4 * i] * planes[4 * i] + planes[4 * i + 1] * planes[4 * i + 1] + planes[4 * i + 2] * planes[4 * i + 2]) ;
+		for (int j = 0; j < 4 ; j++)
+			planes[4 * i + j] /= norm ;
+		for (int j = 0; j < 3 ; j++)
+			abs_normals[3 * i + j] = fabs(planes[4 * i + j]) ;
+	}
+
+	//Frustum corners are the corners of the normalized device cube transformed back to the world
+	Eigen::Matrix4d projection_view_inv = projection_view.inverse() ;
+	min_bb.setConstant(std::numeric_limits<double>::max()) ;
+	max_bb.setConstant(-std::numeric_limits<double>::max()) ;
+	for (int i = 0; i < 8 ; i++) {
+		Eigen::Vector4d corner((i & 1) ? 1.0 : -1.0, (i & 2) ? 1.0 : -1.0, (i & 4) ? 1.0 : -1.0, 1.0) ;
+		corner = projection_view_inv * corner ;
+		Eigen::Vector3d corner3 = corner.topRows<3>() / corner[3] ;
+		min_bb = min_bb.cwiseMin(corner3) ;
+		max_bb = max_bb.cwiseMax(corner3) ;
+	}
+}
+
+void ViewFrustum::setPose(const Eigen::Matrix4d &view_matrix)
+{
+	rotation = view_matrix.topLeftCorner<3, 3>() ;
+	origin = -rotation.transpose() * view_matrix.topRightCorner<3, 1>() ;
+	pose_valid = true ;
+}
+
+int ViewFrustum::cull(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb) const
+{
+	unsigned int plane_mask = ALL_PLANES ;
+	return cull(min_bb, max_bb, plane_mask) ;
+}
+
+int ViewFrustum::cull(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb, unsigned int &plane_mask) const
+{
+	double margin = std::numeric_limits<double>::max() ;
+	return cull(min_bb, max_bb, plane_mask, margin) ;
+}
+
+int ViewFrustum::cull(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb, unsigned int &plane_mask, double &margin) const
+{
+	//Near plane (index 4) first, then the side planes and the far plane
+	static const int plane_order[6] = { 4, 0, 1, 2, 3, 5 } ;
+
+	if (!enabled) {
+		plane_mask = 0 ;
+		return pcl::visualization::PCL_INSIDE_FRUSTUM ;
+	}
+
+	Eigen::Vector3d center = (min_bb + max_bb) * 0.5 ;
+	Eigen::Vector3d half_extent = (max_bb - min_bb) * 0.5 ;
+	int result = pcl::visualization::PCL_INSIDE_FRUSTUM ;
+	for (int k = 0; k < 6 ; k++) {
+		int i = plane_order[k] ;
+		if (!(plane_mask & (1u << i)))
+			continue ;
+		const double *plane = planes + 4 * i ;
+		const double *abs_normal = abs_normals + 3 * i ;
+		double distance = center[0] * plane[0] + center[1] * plane[1] + center[2] * plane[2] + plane[3] ;
+		double radius = half_extent[0] * abs_normal[0] + half_extent[1] * abs_normal[1] + half_extent[2] * abs_normal[2] ;
+		if (distance + radius < 0) {
+			margin = -(distance + radius) ;
+			return pcl::visualization::PCL_OUTSIDE_FRUSTUM ;
+		}
+		if (distance - radius < 0)
+			result = pcl::visualization::PCL_INTERSECT_FRUSTUM ;
+		else {
+			plane_mask &= ~(1u << i) ; //The box (and everything inside it) is on the inner side of the plane
+			margin = std::min(margin, distance - radius) ;
+		}
+	}
+	return result ;
+}
+
+double ViewFrustum::getExitDistance(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb) const
+{
+	if (!enabled)
+		return std::numeric_limits<double>::max() ;
+
+	Eigen::Vector3d center = (min_bb + max_bb) * 0.5 ;
+	Eigen::Vector3d half_extent = (max_bb - min_bb) * 0.5 ;
+	double exit_distance = std::numeric_limits<double>::max() ;
+	for (int i = 0; i < 6 ; i++) {
+		const double *plane = planes + 4 * i ;
+		const double *abs_normal = abs_normals + 3 * i ;
+		double distance = center[0] * plane[0] + center[1] * plane[1] + center[2] * plane[2] + plane[3] ;
+		double radius = half_extent[0] * abs_normal[0] + half_extent[1] * abs_normal[1] + half_extent[2] * abs_normal[2] ;
+		exit_distance = std::min(exit_distance, distance + radius) ;
+	}
+	return exit_distance ;
+}
@@ -11,10 +11,14 @@
 #include "surfel_mapper.hpp"
 #include <pcl/common/transforms.h>
 #include <pcl/visualization/common/common.h>
-#include <pcl/octree/octree_impl.h>
+#include "octree_surfel_index.hpp"
+#include "voxel_block_surfel_index.hpp"
 #include <pcl/common/io.h>
 #include <pcl/features/integral_image_normal.h>
 #include "logger.hpp"
+#include <algorithm>
+#include <string.h>
+#include <unordered_map>
 
 //#define DMAX 0.005f
 //#define MIN_KINECT_DIST 0.8 
@@ -110,8 +114,7 @@ void SurfelMapper::getPointAtPosition(pcl::PointCloud<pcl::PointXYZRGBNormal>::P
 
 void SurfelMapper::markScanAsCovered(char scan_covered[CLOUD_HEIGHT][CLOUD_WIDTH], float u, float v) 
 {
-	//Here we assume that the covering surfel is approximately the size of single scan pixel 
-	//TODO: In some cases surfel ahead of the scan and scan was invalidated, the surfel may be larger and cover multiple can pixels - it might be worthwhile to take it into account 
+	//Here we assume that the covering surfel is approximately the size of single scan pixel (see markSurfelAsCovered for larger surfels)
 
 	//Perform nearest-neighbor search
 	uint32_t i = static_cast<int>(v + 0.5) ;
@@ -121,54 +124,38 @@ void SurfelMapper::markScanAsCovered(char scan_covered[CLOUD_HEIGHT][CLOUD_WIDTH
 	scan_covered[i][j] = 1 ;
 }
 
-void SurfelMapper::skipChildVoxelsCorrect(pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator &it, const pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator &it_end)
-{
-	unsigned int current_depth = it.getCurrentOctreeDepth() ;
-	it++ ;	
-	if (it != it_end && it.getCurrentOctreeDepth() > current_depth)
-		it.skipChildVoxels() ; //Actually we skip siblings of the child here
-}
-
-void SurfelMapper::computeVoxelColor(pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator &it, const pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator &it_end, pcl::PointXYZRGB &point)
-{
-	//Select a few pixels from the current voxel and compute an average	
-	unsigned int current_depth = it.getCurrentOctreeDepth() ;
-	unsigned long rs, gs, bs ;
-	rs = gs = bs = 0 ;
-	unsigned long count  = 0;
-	bool first_it = true ; //We must take into account also the starting node - it might be a leaf!
-	while(it != it_end && (it.getCurrentOctreeDepth() > current_depth || first_it)) {
-		first_it = false ;
-		if (it.isLeafNode()) {
-			//Examine points in the voxel	
-			pcl::octree::OctreeContainerPointIndices& container = it.getLeafContainer();
-			std::vector<int> pointIndices ; 
-			container.getPointIndices (pointIndices);
-			unsigned int step = pointIndices.size() / PREVIEW_COLOR_SAMPLES_IN_VOXEL;
-			if (step < 1) step = 1 ;
-			//Now select every "step" - point
-			for (unsigned int i = 0; i < pointIndices.size() ; i += step) {
-				PointCustomSurfel p = cloudScene->points[pointIndices[i]] ;
-				rs += p.r ;
-				gs += p.g ;
-				bs += p.b ;
-				count++ ;
-			}
+void SurfelMapper::markSurfelAsCovered(char scan_covered[CLOUD_HEIGHT][CLOUD_WIDTH], pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr &cloud, float u, float v, float z, float radius, float tolerance)
+{
+	markScanAsCovered(scan_covered, u, v) ;
+
+	//Rasterize the rest of the disc (surfels of single pixel size end here)
+	radius = std::min<float>(radius, MAX_COVERAGE_RADIUS) ;
+	if (!(radius >= 1.0f))
+		return ;
+	int ci = static_cast<int>(v + 0.5) ;
+	int cj = static_cast<int>(u + 0.5) ;
+	int r = static_cast<int>(radius) ;
+	for (int di = -r; di <= r ; di++) {
+		int i = ci + di ;
+		if (i < 0 || i >= (int) cloud->height)
+			continue ;
+		int w = static_cast<int>(sqrt(radius * radius - di * di)) ; //Half-width of the disc row
+		int jmin = std::max(cj - w, 0) ;
+		int jmax = std::min(cj + w, (int) cloud->width - 1) ;
+		for (int j = jmin; j <= jmax ; j++) {
+			if (fabs((*cloud)(j, i).z - z) <= tolerance) //NaN readings fail the test
+				scan_covered[i][j] = 1 ;
 		}
-		it++ ;
-	}
-	if (count > 0) {
-		point.r = rs / count ;
-		point.g = gs / count ;
-		point.b = bs / count ;
 	}
 }
 
-void SurfelMapper::filterCloudByDistance(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr &cloud)
+void SurfelMapper::filterCloudByDistance(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr &cloud, DepthPyramid *depthBounds)
 {
 	//int pointsUpdated = 0 ;
 	//Manually NaNing points outside effective Kinect scope and those with too large angle of view
 	//TODO: There are some points (about 0.1%) that have positive normals after cloud transformation - investigate why?
+	if (depthBounds)
+		depthBounds->reset(cloud->width, cloud->height) ;
 	for (uint32_t i = 0; i < cloud->height ; i++) //For cloud scene it will be 1 (unorganized cloud) 
 		for (uint32_t j = 0; j < cloud->width ; j++) {
 			float zscan = (*cloud)(j, i).z ;	
@@ -177,76 +164,53 @@ void SurfelMapper::filterCloudByDistance(pcl::PointCloud<pcl::PointXYZRGBNormal>
 				pcl::PointXYZRGBNormal &point = (*cloud)(j, i) ;	
 				point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN () ;
 			}
+			if (depthBounds)
+				depthBounds->addPixel(j, i, (*cloud)(j, i).z) ;
 		}
+	if (depthBounds)
+		depthBounds->finish() ;
 }
 
-void SurfelMapper::downsampleSceneCloud()
+double SurfelMapper::estimateNewCoverage(const pcl::PointCloud<pcl::PointXYZRGB> &cloud, const Eigen::Matrix4d &viewMatrix)
 {
-	//Establish maximum tree depth for display
-	unsigned int tree_depth = octree.getTreeDepth() ;
-	unsigned int display_depth = tree_depth ;
-	for (unsigned int depth = 1; depth <= tree_depth ; depth++) {
-		double voxel_side = sqrt(octree.getVoxelSquaredSideLen(depth)) ;
-		if (voxel_side <= PREVIEW_RESOLUTION) {
-			display_depth = depth ;
-			break ;
+	const uint32_t step = std::max(COVERAGE_SAMPLE_STEP, 1) ;
+	unsigned int nsamples = 0 ;
+	unsigned int nsamples_new = 0 ;
+	std::vector<SurfelIdx> k_indices ;
+	for (uint32_t i = step / 2; i < cloud.height ; i += step)
+		for (uint32_t j = step / 2; j < cloud.width ; j += step) {
+			const pcl::PointXYZRGB &point = cloud(j, i) ;
+			if (!pcl::isFinite(point))
+				continue ;
+			//Only readings within the reliable range could be added to the map
+			double z = viewMatrix(2, 0) * point.x + viewMatrix(2, 1) * point.y + viewMatrix(2, 2) * point.z + viewMatrix(2, 3) ;
+			if (z > MAX_KINECT_DIST || z < MIN_KINECT_DIST)
+				continue ;
+			nsamples++ ;
+
+			//Look for an active surfel near the reading (within dmax plus the reading footprint)
+			float r = static_cast<float>(DMAX + z / camera_params.alpha) ;
+			Eigen::Vector3f center(point.x, point.y, point.z) ;
+			k_indices.clear() ;
+			spatialIndex->boxSearch(center - Eigen::Vector3f(r, r, r), center + Eigen::Vector3f(r, r, r), k_indices) ;
+			bool covered = false ;
+			for (size_t k = 0; k < k_indices.size() && !covered ; k++)
+				covered = isActive(scene.lastObserved(k_indices[k])) ;
+			if (!covered)
+				nsamples_new++ ;
 		}
-	}
-
-	//Clear point cloud
-	cloudSceneDownsampled->clear() ;
-
-	//Convert voxels at fixed depth to points in a downsampled cloud
-	pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator it = octree.depth_begin() ;
-	const pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator it_end = octree.depth_end();
-	while(it != it_end) {
-		unsigned int current_depth = it.getCurrentOctreeDepth() ;
-		if (current_depth == display_depth) {
-			//Convert a voxel to a single point 
-			Eigen::Vector3f min_bb, max_bb ;
-			octree.getVoxelBounds(it, min_bb, max_bb) ;	
-			
-			pcl::PointXYZRGB point ;
-			point.x = (min_bb[0] + max_bb[0]) / 2 ;
-			point.y = (min_bb[1] + max_bb[1]) / 2 ;
-			point.z = (min_bb[2] + max_bb[2]) / 2 ;
-			point.r = point.g = point.b = 255 ;
-			point.a = 255 ;
-
-			computeVoxelColor(it, it_end, point) ; //Computes average color from some selected voxel points and performs skip child voxels procedure at the same time
-
-			//Add to point cloud
-			cloudSceneDownsampled->push_back(point) ;
-
-			//Ignore children
-			//it.skipChildVoxels() ;	
-			//skipChildVoxelsCorrect(it, it_end) ;
-
-			//double voxel_side = sqrt(octree.getVoxelSquaredSideLen(current_depth)) ;
-			//std::cout << "side = " << max_bb[0] - min_bb[0] << " " ;
-		} else it++ ;
-	}
-
-	/*
-	//DEBUG!!!!Copy original cloud to downsampled cloud
-	cloudSceneDownsampled->clear() ;
-	for (uint32_t i = 0; i < cloudScene->width ; i++) {
-		pcl::PointXYZRGB point ;
-
-		point.x = cloudScene->points[i].x ;
-		point.y = cloudScene->points[i].y ;
-		point.z = cloudScene->points[i].z ;
-
-		point.r = cloudScene->points[i].r ;
-		point.g = cloudScene->points[i].g ;
-		point.b = cloudScene->points[i].b ;
-		point.a = 255 ;
+	return nsamples > 0 ? double(nsamples_new) / nsamples : 0.0 ;
+}
 
-		//Add to point cloud
-		cloudSceneDownsampled->push_back(point) ;
-	}
-	*/
+void SurfelMapper::downsampleSceneCloud()
+{
+	downsampleSceneCloud(0, *cloudSceneDownsampled) ;
+	previewVersion++ ;
+}
 
+void SurfelMapper::downsampleSceneCloud(unsigned int level, pcl::PointCloud<pcl::PointXYZRGB> &cloudDownsampled)
+{
+	spatialIndex->getPreview(level, PREVIEW_RESOLUTION, PREVIEW_COLOR_SAMPLES_IN_VOXEL, cloudDownsampled) ;
 }
 
 void SurfelMapper::printSettings()
@@ -261,25 +225,65 @@ void SurfelMapper::printSettings()
 	std::cout << "CONFIDENCE_THRESHOLD1 = " << CONFIDENCE_THRESHOLD1 << std::endl ;
 	std::cout << "MIN_SCAN_ZNORMAL = " << MIN_SCAN_ZNORMAL << std::endl ;
 	std::cout << "USE_FRUSTUM = " << USE_FRUSTUM << std::endl ;
+	std::cout << "USE_OCCLUSION_CULLING = " << USE_OCCLUSION_CULLING << std::endl ;
+	std::cout << "USE_FREEZING = " << USE_FREEZING << std::endl ;
+	std::cout << "FREEZE_CONFIDENCE = " << FREEZE_CONFIDENCE << std::endl ;
+	std::cout << "FREEZE_MAX_RESIDUAL = " << FREEZE_MAX_RESIDUAL << std::endl ;
+	std::cout << "ACTIVE_WINDOW = " << ACTIVE_WINDOW << std::endl ;
+	std::cout << "MIN_NEW_COVERAGE = " << MIN_NEW_COVERAGE << std::endl ;
+	std::cout << "COVERAGE_SAMPLE_STEP = " << COVERAGE_SAMPLE_STEP << std::endl ;
+	std::cout << "SURFEL_SPACING = " << SURFEL_SPACING << std::endl ;
+	std::cout << "CONSOLIDATION_BUDGET = " << CONSOLIDATION_BUDGET << std::endl ;
+	std::cout << "MERGE_RADIUS_RATIO = " << MERGE_RADIUS_RATIO << std::endl ;
+	std::cout << "MERGE_MIN_NORMAL_DOT = " << MERGE_MIN_NORMAL_DOT << std::endl ;
+	std::cout << "MAX_SURFELS = " << MAX_SURFELS << std::endl ;
+	std::cout << "EVICTION_POLICY = " << (EVICTION_POLICY == EVICT_LOWEST_CONFIDENCE ? "confidence" : EVICTION_POLICY == EVICT_LEAST_RECENTLY_OBSERVED ? "age" : "distance") << std::endl ;
+	std::cout << "EVICTION_FRACTION = " << EVICTION_FRACTION << std::endl ;
+	std::cout << "PAGING_RADIUS = " << PAGING_RADIUS << std::endl ;
+	std::cout << "PAGING_TILE_LEVEL = " << PAGING_TILE_LEVEL << std::endl ;
+	std::cout << "PAGING_DIRECTORY = " << PAGING_DIRECTORY << std::endl ;
+	std::cout << "PAGING_COMPACT = " << PAGING_COMPACT << std::endl ;
+	std::cout << "REORDER_INTERVAL = " << REORDER_INTERVAL << std::endl ;
+	std::cout << "REORDER_BUDGET = " << REORDER_BUDGET << std::endl ;
 	std::cout << "SCENE_SIZE = " << SCENE_SIZE << std::endl ;
 	std::cout << "LOGGING = " << LOGGING << std::endl ;
 	std::cout << "USE_UPDATE = " << USE_UPDATE << std::endl ;
+	std::cout << "RECORD_DELTA = " << RECORD_DELTA << std::endl ;
+	std::cout << "SPATIAL_INDEX = " << (SPATIAL_INDEX == SPATIAL_INDEX_OCTREE ? "octree" : "voxel_blocks") << std::endl ;
+	std::cout << "COMPACT_SCENE = " << COMPACT_SCENE << std::endl ;
 	std::cout << "alpha = " << camera_params.alpha << std::endl ;
 	std::cout << "beta = " << camera_params.beta << std::endl ;
 	std::cout << "cx = " << camera_params.cx << std::endl ;
 	std::cout << "cy = " << camera_params.cy << std::endl ;
 }
 
+void SurfelMapper::createSpatialIndex()
+{
+	if (SPATIAL_INDEX == SPATIAL_INDEX_VOXEL_BLOCKS)
+		spatialIndex.reset(new VoxelBlockSurfelIndex(OCTREE_RESOLUTION)) ;
+	else
+		spatialIndex.reset(new OctreeSurfelIndex(OCTREE_RESOLUTION)) ;
+	spatialIndex->setInputStorage(&scene) ;
+}
+
 void SurfelMapper::initLogger() 
 {
 	logger.turnLoggingOn(LOGGING) ;
+	logger.addField("new_coverage_estimate") ;
+	logger.addField("keyframe_rejected") ;
+	logger.addField("page_in_time") ;
 	logger.addField("normal_computation_time") ;
 	logger.addField("normal_filtering_time") ;
 	logger.addField("keyframe_transformation_time") ;
 	logger.addField("scope_filtering_time") ;
 	logger.addField("surfel_update_time") ;
 	logger.addField("surfel_addition_time") ;
+	logger.addField("consolidation_time") ;
+	logger.addField("eviction_time") ;
+	logger.addField("page_out_time") ;
+	logger.addField("reorder_time") ;
 	logger.addField("cloud_scene_width") ;
+	logger.addField("cloud_scene_capacity") ;
 	logger.addField("cloud_scene_actual_size") ;
 	logger.addField("ntotal_scans") ;
 	logger.addField("nscans_covered") ;
@@ -287,11 +291,24 @@ void SurfelMapper::initLogger()
 	logger.addField("nsurfels_projected_on_sensor") ;
 	logger.addField("octree_nodes_visited") ;
 	logger.addField("surfels_updated") ;
+	logger.addField("surfels_frozen") ;
+	logger.addField("leaves_frozen") ;
+	logger.addField("leaves_thawed") ;
+	logger.addField("surfels_inactive") ;
+	logger.addField("leaves_inactive") ;
 	logger.addField("scans_too_far") ;
 	logger.addField("scans_too_close") ;
 	logger.addField("surfels_removed_on_update") ;
 	logger.addField("surfels_added") ;
+	logger.addField("scans_thinned") ;
+	logger.addField("surfels_merged") ;
+	logger.addField("surfels_evicted") ;
+	logger.addField("surfels_paged_in") ;
+	logger.addField("surfels_paged_out") ;
+	logger.addField("surfels_on_disk") ;
+	logger.addField("surfels_reordered") ;
 	logger.addField("cloud_scene_actual_size_after") ;
+	logger.addField("memory_bytes") ;
 
 	logger.initFile() ;
 }
@@ -299,8 +316,8 @@ void SurfelMapper::initLogger()
 
 SurfelMapper::SurfelMapper(double DMAX, double MIN_KINECT_DIST, double MAX_KINECT_DIST, double OCTREE_RESOLUTION, 
 			   double PREVIEW_RESOLUTION, int PREVIEW_COLOR_SAMPLES_IN_VOXEL, int CONFIDENCE_THRESHOLD1, double MIN_SCAN_ZNORMAL, 
-			   bool USE_FRUSTUM, int SCENE_SIZE, bool LOGGING, bool USE_UPDATE, CameraParams &camera_params): 
-				cloudScene(new pcl::PointCloud<PointCustomSurfel>), cloudSceneDownsampled(new pcl::PointCloud<pcl::PointXYZRGB>), octree(500.0)
+			   bool USE_FRUSTUM, size_t SCENE_SIZE, bool LOGGING, bool USE_UPDATE, CameraParams &camera_params): 
+				cloudSceneDownsampled(new pcl::PointCloud<pcl::PointXYZRGB>)
 {
 	this->DMAX  = DMAX ;
 	this->MIN_KINECT_DIST  = MIN_KINECT_DIST ;
@@ -318,17 +335,15 @@ SurfelMapper::SurfelMapper(double DMAX, double MIN_KINECT_DIST, double MAX_KINEC
 
 	printSettings() ;
 
-	cloudScene->reserve(this->SCENE_SIZE) ;
-	octree.setResolution(this->OCTREE_RESOLUTION) ; //Does it give the same effect as placed in the constructor?
-	//octree.defineBoundingBox(-100,-100,-100, 100, 100, 100) ;	
-	octree.setInputCloud(cloudScene) ;
+	scene.reserve(std::min(this->SCENE_SIZE, (size_t) SCENE_CHUNK_SIZE)) ; //Further chunks are allocated on demand
+	createSpatialIndex() ;
 
 	initLogger() ;
 }
 
 
-SurfelMapper::SurfelMapper(int SCENE_SIZE, bool LOGGING, CameraParams &camera_params): 
-				cloudScene(new pcl::PointCloud<PointCustomSurfel>), cloudSceneDownsampled(new pcl::PointCloud<pcl::PointXYZRGB>), octree(500.0)
+SurfelMapper::SurfelMapper(size_t SCENE_SIZE, bool LOGGING, CameraParams &camera_params): 
+				cloudSceneDownsampled(new pcl::PointCloud<pcl::PointXYZRGB>)
 {
 	this->SCENE_SIZE = SCENE_SIZE ;
 	this->LOGGING = LOGGING ;
@@ -336,21 +351,18 @@ SurfelMapper::SurfelMapper(int SCENE_SIZE, bool LOGGING, CameraParams &camera_pa
 
 	printSettings() ;
 
-	cloudScene->reserve(this->SCENE_SIZE) ;
-	octree.setResolution(this->OCTREE_RESOLUTION) ; //Does it give the same effect as placed in the constructor?
-	//octree.defineBoundingBox(-100,-100,-100, 100, 100, 100) ;	
-	octree.setInputCloud(cloudScene) ;
+	scene.reserve(std::min(this->SCENE_SIZE, (size_t) SCENE_CHUNK_SIZE)) ; //Further chunks are allocated on demand
+	createSpatialIndex() ;
 
 	initLogger() ;
 }
 
-SurfelMapper::SurfelMapper(): cloudScene(new pcl::PointCloud<PointCustomSurfel>), cloudSceneDownsampled(new pcl::PointCloud<pcl::PointXYZRGB>), octree(500.0)
+SurfelMapper::SurfelMapper(): cloudSceneDownsampled(new pcl::PointCloud<pcl::PointXYZRGB>)
 {
 	printSettings() ;
 
-	cloudScene->reserve(this->SCENE_SIZE) ;
-	octree.setResolution(this->OCTREE_RESOLUTION) ; //Does it give the same effect as placed in the constructor?
-	octree.setInputCloud(cloudScene) ;
+	scene.reserve(std::min(this->SCENE_SIZE, (size_t) SCENE_CHUNK_SIZE)) ; //Further chunks are allocated on demand
+	createSpatialIndex() ;
 
 	initLogger() ;
 }
@@ -364,12 +376,20 @@ SurfelMapper::~SurfelMapper()
  * @param i input number
  * @return true if the number is negative, false otherwise
  */
-bool IsNegative (int i) { return i < 0 ; }
+bool IsNegative (SurfelIdx i) { return i < 0 ; }
 
-void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &cloud)
+/**
+ * Simple predicate testing emptiness of the leaf
+ *
+ * @param leaf input leaf
+ * @return true if the leaf holds no surfels, false otherwise
+ */
+bool IsEmptyLeaf (SurfelLeaf *leaf) { return leaf->size() == 0 ; }
+
+bool SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &cloud)
 {
 	pcl::StopWatch timer ;
-	
+
 	//Testing cloud frustum
 	//testCloud(cloud) ;
 
@@ -406,6 +426,42 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	//viewMatrix = viewMatrix.inverse().eval() * cameraRgbToCameraLinkTrans ;
 	viewMatrix = viewMatrix.inverse().eval() ;
 
+	//Reject frames adding too little to the map (e.g. when the sensor does not move)
+	if (MIN_NEW_COVERAGE > 0.0) {
+		timer.reset() ;
+		double new_coverage = estimateNewCoverage(*cloud, viewMatrix) ;
+		std::cout << "New coverage estimate [" << new_coverage << "] time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
+		logger.log("new_coverage_estimate", new_coverage) ;
+		if (new_coverage < MIN_NEW_COVERAGE) {
+			rejectedFrames++ ;
+			std::cout << "Frame rejected (frames rejected so far [" << rejectedFrames << "])" << std::endl ;
+			logger.log("keyframe_rejected", 1) ;
+			logger.nextRow() ;
+			return false ;
+		}
+		logger.log("keyframe_rejected", 0) ;
+	}
+
+	//Start a new map delta
+	mapDelta.seq++ ;
+	mapDelta.clear() ;
+	frameIndex++ ;
+	previousSensorOrigin = frameIndex > 1 ? sensorOrigin : cloud->sensor_origin_.head<3>() ;
+	sensorOrigin = cloud->sensor_origin_.head<3>() ;
+
+	//Slots released by the previous frame may be reused now (unless the cloud is being reordered - free slots are collected when the pass is finished)
+	if (!reorderActive)
+		freeSlots.insert(freeSlots.end(), releasedSlots.begin(), releasedSlots.end()) ;
+	releasedSlots.clear() ;
+
+	//Bring back the map tiles approached by the sensor
+	unsigned int nsurfels_paged_in = 0 ;
+	if (tileCache) {
+		timer.reset() ;
+		nsurfels_paged_in = pageIn() ;
+		std::cout << "Tile page-in time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
+		logger.log("page_in_time", timer.getTimeSeconds()) ;
+	}
 
 	//Compute normals for the input cloud
 	timer.reset() ;
@@ -466,7 +522,7 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	//Filter points too close and too far
 	
 	timer.reset() ;	
-	filterCloudByDistance(cloudNormalsTrans) ;
+	filterCloudByDistance(cloudNormalsTrans, USE_OCCLUSION_CULLING ? &depthPyramid : NULL) ;
 	std::cout << "Filtering points outside reliable Kinect scope time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
 	logger.log("scope_filtering_time", timer.getTimeSeconds()) ;
 	
@@ -485,14 +541,31 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	Eigen::Matrix4d projectionViewMatrix = projectionMatrix * viewMatrix ;
 
 	//Computing frustum
-	double frustum[24] ;
-	pcl::visualization::getViewFrustum(projectionViewMatrix, frustum) ;
+	ViewFrustum frustum ;
+	frustum.set(projectionViewMatrix) ;
+	frustum.setPose(viewMatrix) ; //Lets the index reuse classifications from the previous keyframe
+	frustum.enabled = USE_FRUSTUM ; //If we don't want frustum culling - let denote any voxel as belonging to frustum (accept everything)
+
+	//Depth bounds of the scan (collected when filtering) - nodes behind the observed surface or projecting on invalid readings are skipped by the update
+	if (USE_OCCLUSION_CULLING) {
+		depthPyramid.setCamera(viewMatrix, alpha, beta, cx, cy, DMAX) ;
+		frustum.depth_bounds = &depthPyramid ;
+	}
 
 	//Clean-up the scan covered array
 	static char scan_covered[CLOUD_HEIGHT][CLOUD_WIDTH] ;
 	memset(scan_covered, 0, sizeof(scan_covered[0][0]) * CLOUD_HEIGHT * CLOUD_WIDTH);
 
+	//Per-frame storage (released when the frame is integrated, except for the static and member buffers reused by the next frame)
+	scratchBytes = (cloudNormals->points.capacity() + cloudNormalsTrans->points.capacity()) * sizeof(pcl::PointXYZRGBNormal) + 
+		sizeof(scan_covered) + depthPyramid.getMemoryBytes() ;
+
 	unsigned int nsurfels_updated = 0 ;
+	unsigned int nsurfels_frozen = 0 ;
+	unsigned int nleaves_frozen = 0 ;
+	unsigned int nleaves_thawed = 0 ;
+	unsigned int nsurfels_inactive = 0 ;
+	unsigned int nleaves_inactive = 0 ;
 	unsigned int octree_nodes_visited = 0 ;
 	unsigned int surfels_inside_octree_frustum = 0 ;
 	unsigned int surfels_projected_on_sensor = 0 ;
@@ -501,7 +574,7 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	unsigned int nsurfels_invalid_reading = 0 ;
 	unsigned int nsurfels_removed = 0 ;
 	unsigned int ntotal_scans = 0 ;
-	int ncorrect_surfels = getPointCount() ;
+	size_t ncorrect_surfels = getPointCount() ;
 
 	/*float umin = 1e6 ;
 	float umax = -1e6 ;
@@ -510,127 +583,144 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	
 	if (USE_UPDATE) {	
 		timer.reset() ;
-		//Iterate Octree in a depth-first manner
-		unsigned int acceptBelowDepth = UINT_MAX ;
-		pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator it = octree.depth_begin() ;
-		const pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator it_end = octree.depth_end();
-		while(it != it_end) {
-			octree_nodes_visited++ ;
-			unsigned int current_depth = it.getCurrentOctreeDepth() ;
-			//std::cout << "Current depth: " << current_depth << std::endl ;
-
-			//Cancel acceptBelowDepth if we went above a child branch that is completely in a frustum
-			if (current_depth <= acceptBelowDepth)
-				acceptBelowDepth = UINT_MAX ;
-
-			//Compute frustum if necessary
-			int frustum_result ;
-			if (current_depth > acceptBelowDepth)  
-				frustum_result = pcl::visualization::PCL_INSIDE_FRUSTUM ;
-			else {
-				Eigen::Vector3f min_bb, max_bb ;
-				octree.getVoxelBounds(it, min_bb, max_bb) ;	
-				if (!USE_FRUSTUM)
-					frustum_result = pcl::visualization::PCL_INSIDE_FRUSTUM ; //If we don't want frustum calling - let denote any voxel as belonging to frustum (accept everything)
-				else 
-					frustum_result = pcl::visualization::cullFrustum(frustum, min_bb.cast<double>(), max_bb.cast<double>()) ; 
-				if (frustum_result == pcl::visualization::PCL_INSIDE_FRUSTUM)
-					acceptBelowDepth = it.getCurrentOctreeDepth() ; //We may mark that all nodes below will be automatically accepted
+		//Collect leaves inside the frustum
+		std::vector<SurfelLeaf*> leaves ;
+		octree_nodes_visited = spatialIndex->getVisibleLeaves(frustum, leaves) ;
+
+		for (size_t l = 0; l < leaves.size() ; l++) {
+			//Transform and update all points in a leaf
+			SurfelLeaf &pointIndices = *leaves[l] ;
+			if (!isActive(pointIndices.getLastObserved())) {
+				//None of the surfels observed within the active window - the leaf belongs to the inactive tier
+				nsurfels_inactive += pointIndices.size() ;
+				nleaves_inactive++ ;
+				continue ;
 			}
-
-
-			if (frustum_result == pcl::visualization::PCL_OUTSIDE_FRUSTUM) 
-				skipChildVoxelsCorrect(it, it_end) ;
-			else { 
-				if (it.isLeafNode()) {
-					//Transform and update all points in a leaf
-					pcl::octree::OctreeContainerPointIndices& container = it.getLeafContainer();
-					std::vector<int> &pointIndices  = container.getPointIndicesVector() ;
-					//std::vector<int> pointIndices ; 
-					//container.getPointIndices(pointIndices) ;
-
-					PointCustomSurfel pointTrans ;
-					for (int i = 0; i < pointIndices.size() ; i++)  {
-						surfels_inside_octree_frustum++ ;
-						transformPointAffine(cloudScene->points[pointIndices[i]], pointTrans, viewMatrix) ; //TODO: might perform unnecessary copying (we need only xyz, not the metadata...)
-						if (pointTrans.z <= MAX_KINECT_DIST + DMAX && pointTrans.z >= MIN_KINECT_DIST - DMAX) { //In frustum cullling we remove surfels too close or too far, should we be consistent in that? 
-							float xp = pointTrans.x / pointTrans.z ;
-							float yp = pointTrans.y / pointTrans.z ;
-							float u = alpha * xp + cx ;
-							float v = beta * yp + cy ;
-
-							/*if (u <= umin) umin = u ;
-							  if (u >= umax) umax = u ;
-							  if (v <= vmin) vmin = v ;
-							  if (v >= vmax) vmax = v ;*/
-
-							float zscan = getZAtPosition(cloudNormalsTrans, u, v) ;
-							if (std::isnan(zscan) || zscan >= 0.0f) //in both cases we hit image plane
-								surfels_projected_on_sensor++ ;
-							if (!std::isnan(zscan) && zscan >= 0.0f) {
-								//surfels_projected_on_sensor++ ;
-								if (fabs(zscan - pointTrans.z) <= DMAX) { 
-									//We have a surfel-scan match, we may update the surfel here... 
-
-									pcl::PointXYZRGBNormal pointInterpolated, pointInterpolatedTrans ; 
-									getPointAtPosition(cloudNormals, cloudNormalsTrans, u, v, pointInterpolated, pointInterpolatedTrans) ;
-									//Computing running average
-									PointCustomSurfel &pointSurfel = cloudScene->points[pointIndices[i]] ;
-
-									pointSurfel.x = (pointSurfel.x * pointSurfel.count + pointInterpolated.x) / (pointSurfel.count + 1) ;
-									pointSurfel.y = (pointSurfel.y * pointSurfel.count + pointInterpolated.y) / (pointSurfel.count + 1) ;
-									pointSurfel.z = (pointSurfel.z * pointSurfel.count + pointInterpolated.z) / (pointSurfel.count + 1) ;
-
-									pointSurfel.normal_x = (pointSurfel.normal_x * pointSurfel.count + pointInterpolated.normal_x) / (pointSurfel.count + 1) ;
-									pointSurfel.normal_y = (pointSurfel.normal_y * pointSurfel.count + pointInterpolated.normal_y) / (pointSurfel.count + 1) ;
-									pointSurfel.normal_z = (pointSurfel.normal_z * pointSurfel.count + pointInterpolated.normal_z) / (pointSurfel.count + 1) ;
-
-									pointSurfel.r = (uint8_t) ((((uint32_t) pointSurfel.r) * pointSurfel.count + pointInterpolated.r) / (pointSurfel.count + 1)) ;
-									pointSurfel.g = (uint8_t) ((((uint32_t) pointSurfel.g) * pointSurfel.count + pointInterpolated.g) / (pointSurfel.count + 1)) ;
-									pointSurfel.b = (uint8_t) ((((uint32_t) pointSurfel.b) * pointSurfel.count + pointInterpolated.b) / (pointSurfel.count + 1)) ;
-
-									pointSurfel.count++ ;
-									pointSurfel.confidence++ ;
-
-									float scanR = -pointInterpolatedTrans.z / pointInterpolatedTrans.normal_z * zTor  ;
-									/*if (fabs(scanR) > 0.2) {
-									  std::cout << "pointinterpolated.z " << pointInterpolated.z << std::endl ;
-									  std::cout << "pointinterpolated.normal_z " << pointInterpolated.normal_z ;
-									  }*/
-									pointSurfel.radius = std::min<float>(pointSurfel.radius, scanR) ; //Update radius only when the new one is smaller
-									/*if (pointSurfel.radius < 0) {
-									  std::cout << pointSurfel.radius ;
-									  }*/
-
-									//We do not update colors now (in original solution (Weise) - they take color from the most perpendicular view)
-									//TODO: possibly handle color update...
-
-									markScanAsCovered(scan_covered, u, v) ; 
-									nsurfels_updated++ ;
-								} else if (zscan - pointTrans.z > DMAX) {
-									//The observed point is behing the surfel, we may either remove the observation or the surfel (depending e.g. on the confidence)
-									//markScanAsCovered(scan_covered, u, v) ; 
-									PointCustomSurfel &pointSurfel = cloudScene->points[pointIndices[i]] ;
-									if (pointSurfel.confidence < CONFIDENCE_THRESHOLD1) {
-										//NaN surfel in the cloud (we do not remove it in order to maintain the structure of indices
-										pointSurfel.x = pointSurfel.y = pointSurfel.z = std::numeric_limits<float>::quiet_NaN () ;
-										//remove surfel from Octree
-										pointIndices[i] = -1 ; //Mark as invalid (designed for future removal)
-										nsurfels_removed++ ;
-									} else {
-										markScanAsCovered(scan_covered, u, v) ;
-									}
-									nscan_too_far++ ;
-								} else
-									nscan_too_close++ ;
-							} else nsurfels_invalid_reading++ ;
-						}
-					}
-					//The actual removal of marked (negative) indices
-                    std::vector<int>::iterator end_valid = remove_if(pointIndices.begin(), pointIndices.end(), IsNegative);
-					pointIndices.erase(end_valid, pointIndices.end());
+			if (!USE_FREEZING)
+				pointIndices.setFrozen(false) ;
+			bool converged = USE_FREEZING ; //Does the leaf meet the freezing thresholds in this update
+			bool matched = false ; //Has any surfel of the leaf been matched with a reading
+			uint32_t leafLastObserved = 0 ; //The most recent observation of the leaf surfels
+
+			PointCustomSurfel pointSurfel, pointTrans ;
+			bool removed = false ; //Have any surfels of the leaf been removed
+			for (int i = 0; i < pointIndices.size() ; i++)  {
+				const SurfelIdx idx = pointIndices.getIndex(i) ; //A range leaf (after reordering) is scanned sequentially without reading the indices
+				uint32_t &surfelLastObserved = scene.lastObserved(idx) ;
+				leafLastObserved = std::max(leafLastObserved, surfelLastObserved) ;
+				if (!isActive(surfelLastObserved)) {
+					nsurfels_inactive++ ;
+					continue ;
+				}
+				surfels_inside_octree_frustum++ ;
+				scene.load(idx, pointSurfel) ; //Decoded in the compact mode, stored back only if updated
+				if (pointSurfel.confidence < FREEZE_CONFIDENCE)
+					converged = false ;
+				transformPointAffine(pointSurfel, pointTrans, viewMatrix) ; //TODO: might perform unnecessary copying (we need only xyz, not the metadata...)
+				if (pointTrans.z <= MAX_KINECT_DIST + DMAX && pointTrans.z >= MIN_KINECT_DIST - DMAX) { //In frustum cullling we remove surfels too close or too far, should we be consistent in that? 
+					float xp = pointTrans.x / pointTrans.z ;
+					float yp = pointTrans.y / pointTrans.z ;
+					float u = alpha * xp + cx ;
+					float v = beta * yp + cy ;
+
+					/*if (u <= umin) umin = u ;
+					  if (u >= umax) umax = u ;
+					  if (v <= vmin) vmin = v ;
+					  if (v >= vmax) vmax = v ;*/
+
+					float zscan = getZAtPosition(cloudNormalsTrans, u, v) ;
+					if (std::isnan(zscan) || zscan >= 0.0f) //in both cases we hit image plane
+						surfels_projected_on_sensor++ ;
+					if (!std::isnan(zscan) && zscan >= 0.0f) {
+						//surfels_projected_on_sensor++ ;
+						if (fabs(zscan - pointTrans.z) <= DMAX && pointIndices.isFrozen()) {
+							//Converged surfel - the reading is only covered
+							markSurfelAsCovered(scan_covered, cloudNormalsTrans, u, v, pointTrans.z, pointSurfel.radius / pointTrans.z * alpha, DMAX + pointSurfel.radius) ;
+							surfelLastObserved = leafLastObserved = frameIndex ;
+							updateEvictionBucket(idx, pointSurfel) ;
+							nsurfels_frozen++ ;
+						} else if (fabs(zscan - pointTrans.z) <= DMAX) { 
+							//We have a surfel-scan match, we may update the surfel here... 
+							matched = true ;
+							if (fabs(zscan - pointTrans.z) > FREEZE_MAX_RESIDUAL)
+								converged = false ;
+
+							pcl::PointXYZRGBNormal pointInterpolated, pointInterpolatedTrans ; 
+							getPointAtPosition(cloudNormals, cloudNormalsTrans, u, v, pointInterpolated, pointInterpolatedTrans) ;
+							//Computing running average
+							pointSurfel.x = (pointSurfel.x * pointSurfel.count + pointInterpolated.x) / (pointSurfel.count + 1) ;
+							pointSurfel.y = (pointSurfel.y * pointSurfel.count + pointInterpolated.y) / (pointSurfel.count + 1) ;
+							pointSurfel.z = (pointSurfel.z * pointSurfel.count + pointInterpolated.z) / (pointSurfel.count + 1) ;
+
+							pointSurfel.normal_x = (pointSurfel.normal_x * pointSurfel.count + pointInterpolated.normal_x) / (pointSurfel.count + 1) ;
+							pointSurfel.normal_y = (pointSurfel.normal_y * pointSurfel.count + pointInterpolated.normal_y) / (pointSurfel.count + 1) ;
+							pointSurfel.normal_z = (pointSurfel.normal_z * pointSurfel.count + pointInterpolated.normal_z) / (pointSurfel.count + 1) ;
+
+							pointSurfel.r = (uint8_t) ((((uint32_t) pointSurfel.r) * pointSurfel.count + pointInterpolated.r) / (pointSurfel.count + 1)) ;
+							pointSurfel.g = (uint8_t) ((((uint32_t) pointSurfel.g) * pointSurfel.count + pointInterpolated.g) / (pointSurfel.count + 1)) ;
+							pointSurfel.b = (uint8_t) ((((uint32_t) pointSurfel.b) * pointSurfel.count + pointInterpolated.b) / (pointSurfel.count + 1)) ;
+
+							pointSurfel.count++ ;
+							pointSurfel.confidence++ ;
+
+							float scanR = -pointInterpolatedTrans.z / pointInterpolatedTrans.normal_z * zTor  ;
+							scanR *= getSurfelStride(scanR) ; //Radius at the target surfel density
+							/*if (fabs(scanR) > 0.2) {
+							  std::cout << "pointinterpolated.z " << pointInterpolated.z << std::endl ;
+							  std::cout << "pointinterpolated.normal_z " << pointInterpolated.normal_z ;
+							  }*/
+							pointSurfel.radius = std::min<float>(pointSurfel.radius, scanR) ; //Update radius only when the new one is smaller
+							/*if (pointSurfel.radius < 0) {
+							  std::cout << pointSurfel.radius ;
+							  }*/
+
+							//We do not update colors now (in original solution (Weise) - they take color from the most perpendicular view)
+							//TODO: possibly handle color update...
+							scene.store(idx, pointSurfel) ;
+
+							markSurfelAsCovered(scan_covered, cloudNormalsTrans, u, v, pointTrans.z, pointSurfel.radius / pointTrans.z * alpha, DMAX + pointSurfel.radius) ; 
+							surfelLastObserved = leafLastObserved = frameIndex ;
+							updateEvictionBucket(idx, pointSurfel) ;
+							nsurfels_updated++ ;
+							if (RECORD_DELTA)
+								mapDelta.updated.push_back(idx) ;
+						} else if (zscan - pointTrans.z > DMAX) {
+							//The observed point is behing the surfel, we may either remove the observation or the surfel (depending e.g. on the confidence)
+							//markScanAsCovered(scan_covered, u, v) ; 
+							if (pointIndices.isFrozen()) {
+								//Free space observed at a converged surfel - the leaf is updated again
+								pointIndices.setFrozen(false) ;
+								nleaves_thawed++ ;
+							}
+							converged = false ;
+							if (pointSurfel.confidence < CONFIDENCE_THRESHOLD1) {
+								//NaN surfel in the cloud (we do not remove it in order to maintain the structure of indices
+								removeSurfel(idx) ;
+								//remove surfel from Octree
+								pointIndices[i] = -1 ; //Mark as invalid (designed for future removal, a range leaf is switched to the explicit list)
+								removed = true ;
+								nsurfels_removed++ ;
+							} else {
+								markScanAsCovered(scan_covered, u, v) ;
+								surfelLastObserved = leafLastObserved = frameIndex ;
+								updateEvictionBucket(idx, pointSurfel) ;
+							}
+							nscan_too_far++ ;
+						} else
+							nscan_too_close++ ;
+					} else nsurfels_invalid_reading++ ;
 				}
-				it++ ;
+			}
+			//The actual removal of marked (negative) indices
+			if (removed) {
+				SurfelIdx *end_valid = remove_if(pointIndices.begin(), pointIndices.end(), IsNegative);
+				pointIndices.resize(end_valid - pointIndices.begin());
+			}
+			pointIndices.setLastObserved(leafLastObserved) ;
+			//Freeze the leaf if all its surfels are confident and the matching readings agree with them
+			if (converged && matched && !pointIndices.isFrozen()) {
+				pointIndices.setFrozen(true) ;
+				nleaves_frozen++ ;
 			}
 		}
 		std::cout << "Surfel update time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
@@ -657,6 +747,7 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	Eigen::Matrix4d viewMatrixInv = viewMatrix.inverse().eval() ;
 
 	unsigned int surfels_added = 0 ;
+	unsigned int nscans_thinned = 0 ;
 	double distance  = 0.0 ;
 	int distance_count = 0 ;
 	//Update surfel data in the cloud to add and remove covered measurements
@@ -664,7 +755,7 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 		for (uint32_t j = 0; j < cloud->width ; j++) { 
 			pcl::PointXYZRGBNormal pointNormalTrans = (*cloudNormalsTrans)(j, i) ;
 			if (!scan_covered[i][j] && pcl::isFinite(pointNormalTrans)) { //We check cloudTrans - since it reflect point invalidations due to distance
-				//Add a new point to the scene cloud (and the associated octree)
+				//Add a new point to the scene cloud (and the associated spatial index)
 				pcl::PointXYZRGBNormal pointNormal = (*cloudNormals)(j, i) ;
 				PointCustomSurfel pointSurfel ;
 				pointSurfel.x = pointNormal.x ; pointSurfel.y = pointNormal.y; pointSurfel.z = pointNormal.z ;
@@ -674,8 +765,16 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 				pointSurfel.radius = -pointNormalTrans.z / pointNormalTrans.normal_z * zTor  ;
 				pointSurfel.confidence = 1 ;
 
-				octree.addPointToCloud(pointSurfel, cloudScene) ;
-				surfels_added++ ;
+				//Thin out readings denser than the target spacing (the surfel covers the skipped ones)
+				int stride = getSurfelStride(pointSurfel.radius) ;
+				if (i % stride != 0 || j % stride != 0) {
+					nscans_thinned++ ;
+					continue ;
+				}
+				pointSurfel.radius *= stride ;
+
+				if (addSurfel(pointSurfel, frameIndex) >= 0)
+					surfels_added++ ;
 				//Debug - add point using cloudTrans data
 				
 					/*float xp = (j - cx) / alpha ;
@@ -698,13 +797,54 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	std::cout << "Surfel addition time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
 	logger.log("surfel_addition_time", timer.getTimeSeconds()) ;
 
-	std::cout << "cloud_scene size (all surfels including removed): [" << cloudScene->width << "]" << std::endl ;
-	logger.log("cloud_scene_width", cloudScene->width) ;
+	//Merge co-located surfels in the remaining part of the time budget
+	unsigned int nsurfels_merged = 0 ;
+	if (CONSOLIDATION_BUDGET > 0.0) {
+		timer.reset() ;
+		nsurfels_merged = consolidateMap(CONSOLIDATION_BUDGET) ;
+		std::cout << "Surfel consolidation time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
+		logger.log("consolidation_time", timer.getTimeSeconds()) ;
+	}
+
+	//Bring the map back under the surfel budget
+	unsigned int nsurfels_evicted = 0 ;
+	if (MAX_SURFELS > 0 && surfelCount > MAX_SURFELS) {
+		timer.reset() ;
+		size_t low_water = static_cast<size_t>(MAX_SURFELS * (1.0 - EVICTION_FRACTION)) ;
+		nsurfels_evicted = evictSurfels(surfelCount - low_water) ;
+		std::cout << "Surfel eviction time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
+		logger.log("eviction_time", timer.getTimeSeconds()) ;
+	}
+
+	//Move the map tiles left behind by the sensor to the disk
+	unsigned int nsurfels_paged_out = 0 ;
+	if (tileCache) {
+		timer.reset() ;
+		nsurfels_paged_out = pageOut() ;
+		std::cout << "Tile page-out time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
+		logger.log("page_out_time", timer.getTimeSeconds()) ;
+	}
+
+	//Move surfels of each leaf next to each other in the Morton order of leaves
+	unsigned int nsurfels_reordered = 0 ;
+	if (REORDER_INTERVAL > 0 && (reorderActive || frameIndex - reorderStartFrame >= (uint32_t) REORDER_INTERVAL)) {
+		timer.reset() ;
+		if (!reorderActive)
+			startReordering() ;
+		nsurfels_reordered = reorderSurfels(REORDER_BUDGET) ;
+		std::cout << "Surfel reordering time (s): [" << timer.getTimeSeconds() << "]" << std::endl ;
+		logger.log("reorder_time", timer.getTimeSeconds()) ;
+	}
+
+	std::cout << "cloud_scene size (all surfels including removed): [" << scene.size() << "]" << std::endl ;
+	logger.log("cloud_scene_width", scene.size()) ;
+	std::cout << "cloud_scene capacity: [" << scene.capacity() << "]" << std::endl ;
+	logger.log("cloud_scene_capacity", scene.capacity()) ;
 	std::cout << "Actual scene size (without removed surfels) [" << ncorrect_surfels << "]" <<  std::endl ;
 	logger.log("cloud_scene_actual_size", ncorrect_surfels) ;
 	std::cout << "Correct scans [" << ncorrect_scans << "]" << std::endl ;
 	std::cout << "Correct scans and normals [" << ncorrect_scans_and_normals << "]" << std::endl ;
-	ntotal_scans = nscans_covered + surfels_added ;
+	ntotal_scans = nscans_covered + surfels_added + nscans_thinned ;
 	std::cout << "Correct (add-able) scans (inside bounds and frontal-oriented) [" << ntotal_scans << "]"  << std::endl ; 
 	logger.log("ntotal_scans", ntotal_scans) ;
 	std::cout << "No. of scans covered [" << nscans_covered << "]" << std::endl ;
@@ -719,6 +859,16 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	logger.log("octree_nodes_visited", octree_nodes_visited) ;
 	std::cout << "Surfels updated [" << nsurfels_updated << "]" << std::endl ;
 	logger.log("surfels_updated", nsurfels_updated) ;
+	std::cout << "Surfels matched in frozen leaves (not updated) [" << nsurfels_frozen << "]" << std::endl ;
+	logger.log("surfels_frozen", nsurfels_frozen) ;
+	std::cout << "Leaves frozen [" << nleaves_frozen << "]" << std::endl ;
+	logger.log("leaves_frozen", nleaves_frozen) ;
+	std::cout << "Leaves thawed [" << nleaves_thawed << "]" << std::endl ;
+	logger.log("leaves_thawed", nleaves_thawed) ;
+	std::cout << "Inactive surfels skipped during update [" << nsurfels_inactive << "]" << std::endl ;
+	logger.log("surfels_inactive", nsurfels_inactive) ;
+	std::cout << "Inactive leaves skipped during update [" << nleaves_inactive << "]" << std::endl ;
+	logger.log("leaves_inactive", nleaves_inactive) ;
 	std::cout << "Scans too far for surfel update [" << nscan_too_far << "]" << std::endl ;
 	logger.log("scans_too_far", nscan_too_far) ;
 	std::cout << "Scans too close for surfel update [" << nscan_too_close << "]" << std::endl ;
@@ -728,9 +878,27 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 	logger.log("surfels_removed_on_update", nsurfels_removed) ;
 	std::cout << "Surfels added [" << surfels_added << "]" << std::endl ;
 	logger.log("surfels_added", surfels_added) ;
-	int ncorrect_surfels_after = getPointCount() ;
+	std::cout << "Scans thinned out by the surfel spacing [" << nscans_thinned << "]" << std::endl ;
+	logger.log("scans_thinned", nscans_thinned) ;
+	std::cout << "Surfels merged [" << nsurfels_merged << "]" << std::endl ;
+	logger.log("surfels_merged", nsurfels_merged) ;
+	std::cout << "Surfels evicted [" << nsurfels_evicted << "]" << std::endl ;
+	logger.log("surfels_evicted", nsurfels_evicted) ;
+	std::cout << "Surfels paged in [" << nsurfels_paged_in << "]" << std::endl ;
+	logger.log("surfels_paged_in", nsurfels_paged_in) ;
+	std::cout << "Surfels paged out [" << nsurfels_paged_out << "]" << std::endl ;
+	logger.log("surfels_paged_out", nsurfels_paged_out) ;
+	std::cout << "Surfels on the disk [" << getPagedOutCount() << "]" << std::endl ;
+	logger.log("surfels_on_disk", getPagedOutCount()) ;
+	std::cout << "Surfels reordered [" << nsurfels_reordered << "]" << std::endl ;
+	logger.log("surfels_reordered", nsurfels_reordered) ;
+	size_t ncorrect_surfels_after = getPointCount() ;
 	std::cout << "cloud_scene size after update and addition (without removed surfels): [" << ncorrect_surfels_after << "]" << std::endl ;
 	logger.log("cloud_scene_actual_size_after", ncorrect_surfels_after) ;
+	MemoryReport memory ;
+	getMemoryReport(memory) ;
+	std::cout << "Memory used by the map (bytes): [" << memory.getTotalBytes() << "]" << std::endl ;
+	logger.log("memory_bytes", memory.getTotalBytes()) ;
 	logger.nextRow() ;
 
 
@@ -741,11 +909,478 @@ void SurfelMapper::addPointCloudToScene(pcl::PointCloud<pcl::PointXYZRGB>::Ptr &
 
 
 	//std::cout << "Octree depth: [" << octree.getTreeDepth() << "]" << std::endl ;
+	return true ;
+}
+
+SurfelIdx SurfelMapper::addSurfel(const PointCustomSurfel &point, uint32_t last_observed)
+{
+	SurfelIdx idx ;
+	if (!scene.canStore(point)) {
+		return -1 ; //Beyond the range of the packed positions
+	} else if (!freeSlots.empty()) {
+		idx = freeSlots.back() ;
+		freeSlots.pop_back() ;
+		scene.store(idx, point) ;
+		scene.lastObserved(idx) = last_observed ;
+	} else if (scene.size() >= getMaxSceneSize()) {
+		return -1 ; //The index range is exhausted
+	} else {
+		idx = scene.size() ; //The surfel is appended to the end of the storage (a new chunk is allocated if the last one is full)
+		scene.push_back(point, last_observed) ;
+	}
+	spatialIndex->addPointFromStorage(idx) ;
+	if (MAX_SURFELS > 0)
+		evictionHistogram.insert(idx, getEvictionBucket(idx, point)) ;
+	surfelCount++ ;
+	if (tileCache)
+		residentTiles.insert(tileCache->getTileKey(point.getVector3fMap())) ;
+	if (RECORD_DELTA)
+		mapDelta.added.push_back(idx) ;
+	return idx ;
+}
+
+void SurfelMapper::removeSurfel(SurfelIdx idx)
+{
+	scene.remove(idx) ;
+	evictionHistogram.erase(idx) ;
+	releasedSlots.push_back(idx) ;
+	surfelCount-- ;
+	if (RECORD_DELTA)
+		mapDelta.removed.push_back(idx) ;
+}
+
+inline uint32_t SurfelMapper::getEvictionBucket(SurfelIdx idx, const PointCustomSurfel &point)
+{
+	switch (EVICTION_POLICY) {
+		case EVICT_LEAST_RECENTLY_OBSERVED:
+			return scene.lastObserved(idx) ;
+		case EVICT_FARTHEST: {
+			double cell_size = OCTREE_RESOLUTION * (1 << EVICTION_CELL_LEVEL) ;
+			TileKey key = { static_cast<int>(floor(point.x / cell_size)), static_cast<int>(floor(point.y / cell_size)), static_cast<int>(floor(point.z / cell_size)) } ;
+			//Surfels mostly stay in their cell, so the current bucket is checked before the lookup
+			uint32_t bucket = evictionHistogram.getBucket(idx) ;
+			if (bucket != EvictionHistogram::NO_BUCKET && !(key < evictionCellKeys[bucket]) && !(evictionCellKeys[bucket] < key))
+				return bucket ;
+			std::pair<std::map<TileKey, uint32_t>::iterator, bool> cell = evictionCells.insert(std::make_pair(key, (uint32_t) evictionCellKeys.size())) ;
+			if (cell.second)
+				evictionCellKeys.push_back(key) ;
+			return cell.first->second ;
+		}
+		default: {
+			if (point.confidence < EVICTION_CONFIDENCE_EXACT)
+				return point.confidence ;
+			uint32_t bucket = EVICTION_CONFIDENCE_EXACT ;
+			for (uint32_t c = point.confidence / EVICTION_CONFIDENCE_EXACT; c > 1 ; c >>= 1)
+				bucket++ ;
+			return bucket ;
+		}
+	}
+}
+
+inline void SurfelMapper::updateEvictionBucket(SurfelIdx idx, const PointCustomSurfel &point)
+{
+	if (MAX_SURFELS > 0)
+		evictionHistogram.update(idx, getEvictionBucket(idx, point)) ; //Moved to the tail, so the bucket stays ordered by the last observation
+}
+
+void SurfelMapper::rebuildEvictionHistogram()
+{
+	evictionHistogram.clear() ;
+	evictionCells.clear() ;
+	evictionCellKeys.clear() ;
+	if (MAX_SURFELS == 0) {
+		evictionHistogram.release() ;
+		return ;
+	}
+
+	std::vector<std::pair<uint32_t, SurfelIdx> > order ; //Frame of the last observation and slot
+	order.reserve(surfelCount) ;
+	for (size_t i = 0; i < scene.size() ; i++)
+		if (scene.isFinite(i))
+			order.push_back(std::make_pair(scene.lastObserved(i), (SurfelIdx) i)) ;
+	std::sort(order.begin(), order.end()) ;
+	PointCustomSurfel point ;
+	for (size_t i = 0; i < order.size() ; i++) {
+		scene.load(order[i].second, point) ;
+		evictionHistogram.insert(order[i].second, getEvictionBucket(order[i].second, point)) ;
+	}
+}
+
+unsigned int SurfelMapper::evictSurfels(size_t nevict)
+{
+	//Non-empty buckets in the eviction order
+	std::vector<uint32_t> buckets ;
+	for (uint32_t b = 0; b < evictionHistogram.getBucketCount() ; b++)
+		if (evictionHistogram.getCount(b) > 0)
+			buckets.push_back(b) ;
+	if (EVICTION_POLICY == EVICT_FARTHEST) {
+		//Distance shells - cells by the distance of their centers from the sensor, the farthest first
+		double cell_size = OCTREE_RESOLUTION * (1 << EVICTION_CELL_LEVEL) ;
+		std::vector<std::pair<float, uint32_t> > shells(buckets.size()) ;
+		for (size_t b = 0; b < buckets.size() ; b++) {
+			const TileKey &key = evictionCellKeys[buckets[b]] ;
+			Eigen::Vector3f center = (Eigen::Vector3f(key.x, key.y, key.z) + Eigen::Vector3f::Constant(0.5f)) * cell_size ;
+			shells[b] = std::make_pair(-(center - sensorOrigin).squaredNorm(), buckets[b]) ;
+		}
+		std::sort(shells.begin(), shells.end()) ;
+		for (size_t b = 0; b < shells.size() ; b++)
+			buckets[b] = shells[b].second ;
+	}
+
+	unsigned int nevicted = 0 ;
+	size_t b = 0 ;
+	while (b < buckets.size() && nevicted < nevict) {
+		//Threshold bucket - the cumulative count of the buckets reaches the number of surfels to be evicted
+		size_t threshold = b ;
+		for (size_t nvictims = nevicted; threshold < buckets.size() && nvictims < nevict ; threshold++)
+			nvictims += evictionHistogram.getCount(buckets[threshold]) ;
+
+		//Only the victim buckets are walked (past the threshold only if some of their surfels were observed in the last frame)
+		for (; b < threshold && nevicted < nevict ; b++) {
+			SurfelIdx idx = evictionHistogram.getFirst(buckets[b]) ;
+			while (idx != EvictionHistogram::NO_SLOT && nevicted < nevict) {
+				SurfelIdx next = evictionHistogram.getNext(idx) ;
+				if (scene.lastObserved(idx) != frameIndex) {
+					spatialIndex->getLeaf(idx)->removePointIndex(idx) ;
+					removeSurfel(idx) ;
+					nevicted++ ;
+				}
+				idx = next ;
+			}
+		}
+	}
+	return nevicted ;
+}
+
+unsigned int SurfelMapper::pageIn()
+{
+	std::vector<TileKey> keys ;
+	tileCache->getTiles(keys) ;
+	Eigen::Vector3f predictedOrigin = 2.0f * sensorOrigin - previousSensorOrigin ;
+	double radius2 = PAGING_RADIUS * PAGING_RADIUS ;
+	double keep_radius2 = (PAGING_RADIUS + tileCache->getTileSize()) * (PAGING_RADIUS + tileCache->getTileSize()) ;
+
+	pcl::PointCloud<PointCustomSurfel> surfels ;
+	std::vector<uint32_t> surfelsLastObserved ;
+	for (size_t k = 0; k < keys.size() ; k++) {
+		double distance2 = tileCache->getSquaredDistance(keys[k], sensorOrigin) ;
+		if (distance2 <= radius2 || (tileCache->isLoaded(keys[k]) && distance2 <= keep_radius2)) {
+			if (tileCache->take(keys[k], surfels, surfelsLastObserved))
+				residentTiles.insert(keys[k]) ;
+			else
+				std::cerr << "Reading a map tile from the disk cache failed (the tile is kept on the disk)" << std::endl ;
+		} else if (tileCache->getSquaredDistance(keys[k], predictedOrigin) <= radius2)
+			tileCache->prefetch(keys[k]) ;
+	}
+
+	for (size_t i = 0; i < surfels.size() ; i++)
+		addSurfel(surfels.points[i], surfelsLastObserved[i]) ; //Paged-in surfels keep their age
+	return surfels.size() ;
+}
+
+unsigned int SurfelMapper::pageOut()
+{
+	if (pagingOriginValid && (sensorOrigin - pagingOrigin).norm() < 0.5 * tileCache->getTileSize())
+		return 0 ;
+	pagingOrigin = sensorOrigin ;
+	pagingOriginValid = true ;
+
+	double out_radius = PAGING_RADIUS + tileCache->getTileSize() ;
+	std::set<TileKey> farTiles ;
+	for (std::set<TileKey>::iterator it = residentTiles.begin(); it != residentTiles.end() ; it++)
+		if (tileCache->getSquaredDistance(*it, sensorOrigin) > out_radius * out_radius)
+			farTiles.insert(*it) ;
+	if (farTiles.empty())
+		return 0 ;
+
+	//Collect the surfels of far tiles (surfels observed in the current frame keep their tile in memory)
+	std::map<TileKey, pcl::PointCloud<PointCustomSurfel> > pagedTiles ;
+	std::map<TileKey, std::vector<uint32_t> > pagedLastObserved ;
+	std::set<TileKey> keptTiles ;
+	std::vector<SurfelLeaf*> leaves ;
+	spatialIndex->getLeaves(leaves) ;
+	unsigned int npaged = 0 ;
+	for (size_t l = 0; l < leaves.size() ; l++) {
+		SurfelLeaf &leaf = *leaves[l] ;
+		bool paged = false ;
+		for (size_t i = 0; i < leaf.size() ; i++) {
+			const SurfelIdx idx = leaf.getIndex(i) ;
+			TileKey key = tileCache->getTileKey(scene.getPosition(idx)) ;
+			if (farTiles.count(key) == 0)
+				continue ;
+			if (scene.lastObserved(idx) == frameIndex) {
+				keptTiles.insert(key) ;
+				continue ;
+			}
+			pagedTiles[key].push_back(scene.get(idx)) ;
+			pagedLastObserved[key].push_back(scene.lastObserved(idx)) ;
+			removeSurfel(idx) ;
+			leaf[i] = -1 ;
+			paged = true ;
+			npaged++ ;
+		}
+		if (paged) {
+			SurfelIdx *end_valid = std::remove_if(leaf.begin(), leaf.end(), IsNegative) ;
+			leaf.resize(end_valid - leaf.begin()) ;
+		}
+	}
+
+	for (std::map<TileKey, pcl::PointCloud<PointCustomSurfel> >::iterator it = pagedTiles.begin(); it != pagedTiles.end() ; it++)
+		if (!tileCache->store(it->first, it->second, pagedLastObserved[it->first]))
+			std::cerr << "Writing a map tile to the disk cache failed (" << it->second.size() << " surfels lost)" << std::endl ;
+	for (std::set<TileKey>::iterator it = farTiles.begin(); it != farTiles.end() ; it++)
+		if (keptTiles.count(*it) == 0)
+			residentTiles.erase(*it) ;
+	return npaged ;
+}
+
+unsigned int SurfelMapper::consolidateLeaf(SurfelLeaf &leaf)
+{
+	//Sort surfels along x, so that the candidates for merging are found in a narrow window
+	std::vector<std::pair<float, int> > order ; //x coordinate and position in the leaf
+	float max_radius = 0.0f ;
+	for (size_t i = 0; i < leaf.size() ; i++) {
+		const SurfelIdx idx = leaf.getIndex(i) ;
+		if (scene.lastObserved(idx) == frameIndex)
+			continue ; //Added or updated by the last frame, the surfel is already in the map delta
+		PointCustomSurfel point ;
+		scene.load(idx, point) ;
+		order.push_back(std::make_pair(point.x, (int) i)) ;
+		max_radius = std::max(max_radius, point.radius) ;
+	}
+	std::sort(order.begin(), order.end()) ;
+	const float window = MERGE_RADIUS_RATIO * max_radius ;
+
+	unsigned int nmerged = 0 ;
+	for (size_t a = 0; a < order.size() ; a++) {
+		const SurfelIdx idxa = leaf.getIndex(order[a].second) ;
+		if (idxa < 0)
+			continue ; //Already merged into another surfel
+		PointCustomSurfel pa, pb ;
+		scene.load(idxa, pa) ;
+		bool merged = false ;
+		for (size_t b = a + 1; b < order.size() && order[b].first - order[a].first <= window ; b++) {
+			const SurfelIdx idxb = leaf.getIndex(order[b].second) ;
+			if (idxb < 0)
+				continue ;
+			scene.load(idxb, pb) ;
+			float max_distance = MERGE_RADIUS_RATIO * std::min(pa.radius, pb.radius) ;
+			if ((pa.getVector3fMap() - pb.getVector3fMap()).squaredNorm() > max_distance * max_distance)
+				continue ;
+			Eigen::Vector3f na = pa.getNormalVector3fMap() ;
+			Eigen::Vector3f nb = pb.getNormalVector3fMap() ;
+			if (na.dot(nb) < MERGE_MIN_NORMAL_DOT * na.norm() * nb.norm())
+				continue ;
+
+			//Count-weighted average (as in the surfel update)
+			float wa = pa.count ;
+			float wb = pb.count ;
+			float w = wa + wb ;
+			pa.x = (pa.x * wa + pb.x * wb) / w ;
+			pa.y = (pa.y * wa + pb.y * wb) / w ;
+			pa.z = (pa.z * wa + pb.z * wb) / w ;
+			pa.normal_x = (pa.normal_x * wa + pb.normal_x * wb) / w ;
+			pa.normal_y = (pa.normal_y * wa + pb.normal_y * wb) / w ;
+			pa.normal_z = (pa.normal_z * wa + pb.normal_z * wb) / w ;
+			pa.r = (uint8_t) ((((uint32_t) pa.r) * pa.count + ((uint32_t) pb.r) * pb.count) / (pa.count + pb.count)) ;
+			pa.g = (uint8_t) ((((uint32_t) pa.g) * pa.count + ((uint32_t) pb.g) * pb.count) / (pa.count + pb.count)) ;
+			pa.b = (uint8_t) ((((uint32_t) pa.b) * pa.count + ((uint32_t) pb.b) * pb.count) / (pa.count + pb.count)) ;
+			pa.count += pb.count ;
+			pa.confidence += pb.confidence ;
+			pa.radius = std::min(pa.radius, pb.radius) ;
+			scene.lastObserved(idxa) = std::max(scene.lastObserved(idxa), scene.lastObserved(idxb)) ;
+
+			//NaN the merged surfel and mark it for removal from the leaf
+			removeSurfel(idxb) ;
+			leaf[order[b].second] = -1 ;
+			merged = true ;
+			nmerged++ ;
+		}
+		if (merged) {
+			scene.store(idxa, pa) ;
+			updateEvictionBucket(idxa, pa) ;
+		}
+		if (merged && RECORD_DELTA)
+			mapDelta.updated.push_back(idxa) ;
+	}
+
+	if (nmerged > 0) {
+		SurfelIdx *end_valid = std::remove_if(leaf.begin(), leaf.end(), IsNegative) ;
+		leaf.resize(end_valid - leaf.begin()) ;
+	}
+	return nmerged ;
+}
+
+unsigned int SurfelMapper::consolidateMap(double time_budget)
+{
+	pcl::StopWatch timer ;
+	std::vector<SurfelLeaf*> leaves ;
+	spatialIndex->getLeaves(leaves) ;
+
+	//Continue from the leaf following the last one consolidated, each leaf is visited at most once
+	unsigned int nmerged = 0 ;
+	for (size_t n = 0; n < leaves.size() && timer.getTimeSeconds() < time_budget ; n++) {
+		if (consolidationCursor >= leaves.size())
+			consolidationCursor = 0 ;
+		nmerged += consolidateLeaf(*leaves[consolidationCursor++]) ;
+	}
+	return nmerged ;
+}
+
+void SurfelMapper::startReordering()
+{
+	reorderLeaves.clear() ;
+	spatialIndex->getOrderedLeaves(reorderLeaves) ;
+	reorderLeaves.erase(std::remove_if(reorderLeaves.begin(), reorderLeaves.end(), IsEmptyLeaf), reorderLeaves.end()) ;
+	reorderEnd = scene.size() ;
+	reorderLeafCursor = 0 ;
+	reorderSlot = 0 ;
+	reorderActive = true ;
+	reorderStartFrame = frameIndex ;
+	freeSlots.clear() ;
 }
 
-pcl::PointCloud<PointCustomSurfel>::Ptr &SurfelMapper::getCloudScene()
+/**
+ * @brief Removes the given slots from the index set of the map delta
+ *
+ * @param indices index set
+ * @param slots slots to be removed
+ */
+static void eraseSlots(std::vector<SurfelIdx> &indices, const std::unordered_map<SurfelIdx, bool> &slots)
+{
+	size_t n = 0 ;
+	for (size_t i = 0; i < indices.size() ; i++)
+		if (slots.find(indices[i]) == slots.end())
+			indices[n++] = indices[i] ;
+	indices.resize(n) ;
+}
+
+unsigned int SurfelMapper::reorderSurfels(double time_budget)
+{
+	pcl::StopWatch timer ;
+
+	//Set of the map delta each slot belongs to (before any slot is touched by the pass in this frame)
+	std::unordered_map<SurfelIdx, char> membership ;
+	if (RECORD_DELTA) {
+		for (size_t i = 0; i < mapDelta.added.size() ; i++)
+			membership[mapDelta.added[i]] = 'a' ;
+		for (size_t i = 0; i < mapDelta.updated.size() ; i++)
+			membership[mapDelta.updated[i]] = 'u' ;
+		for (size_t i = 0; i < mapDelta.removed.size() ; i++)
+			membership[mapDelta.removed[i]] = 'r' ;
+	}
+	std::unordered_map<SurfelIdx, bool> touched ; //Slots changed by the pass with the flag telling if they held a surfel known to delta consumers
+
+	unsigned int nmoved = 0 ;
+	while (reorderLeafCursor < reorderLeaves.size()) {
+		SurfelLeaf &leaf = *reorderLeaves[reorderLeafCursor++] ;
+		for (size_t k = 0; k < leaf.size() ; k++) {
+			SurfelIdx idx = leaf.getIndex(k) ;
+			if ((size_t) idx >= reorderEnd) //Added during the pass
+				continue ;
+			SurfelIdx slot = reorderSlot++ ;
+			if (idx == slot)
+				continue ;
+
+			if (RECORD_DELTA) {
+				SurfelIdx changed[2] = { idx, slot } ;
+				for (int c = 0; c < 2 ; c++) {
+					if (touched.count(changed[c]))
+						continue ;
+					std::unordered_map<SurfelIdx, char>::const_iterator it = membership.find(changed[c]) ;
+					touched[changed[c]] = it != membership.end() ? it->second != 'a' : scene.isFinite(changed[c]) ;
+				}
+			}
+
+			if (scene.isFinite(slot)) {
+				//Swap with the surfel occupying the slot
+				SurfelLeaf &owner = *spatialIndex->getLeaf(slot) ;
+				SurfelIdx *pos = std::find(owner.begin(), owner.end(), slot) ;
+				scene.swap(slot, idx) ;
+				*pos = idx ;
+				spatialIndex->setLeaf(idx, &owner) ;
+				nmoved += 2 ;
+			} else {
+				scene.move(slot, idx) ;
+				nmoved++ ;
+			}
+			spatialIndex->setLeaf(slot, &leaf) ;
+			if (MAX_SURFELS > 0)
+				evictionHistogram.swap(slot, idx) ; //Surfels keep their positions in the buckets
+			leaf[k] = slot ;
+		}
+		if (timer.getTimeSeconds() >= time_budget)
+			break ;
+	}
+
+	//Report the touched slots as the net change since the previous delta
+	if (!touched.empty()) {
+		eraseSlots(mapDelta.added, touched) ;
+		eraseSlots(mapDelta.updated, touched) ;
+		eraseSlots(mapDelta.removed, touched) ;
+		for (std::unordered_map<SurfelIdx, bool>::const_iterator it = touched.begin(); it != touched.end() ; it++) {
+			bool live = scene.isFinite(it->first) ;
+			if (it->second && live)
+				mapDelta.updated.push_back(it->first) ;
+			else if (it->second)
+				mapDelta.removed.push_back(it->first) ;
+			else if (live)
+				mapDelta.added.push_back(it->first) ;
+		}
+	}
+
+	if (reorderLeafCursor >= reorderLeaves.size())
+		finishReordering() ;
+	return nmoved ;
+}
+
+void SurfelMapper::finishReordering()
 {
-	return cloudScene ;
+	//Drop the removed surfels at the end of the storage
+	size_t size = scene.size() ;
+	while (size > 0 && !scene.isFinite(size - 1))
+		size-- ;
+	scene.resize(size) ;
+
+	//Remaining holes are reused from the lowest slot on
+	freeSlots.clear() ;
+	releasedSlots.clear() ;
+	for (size_t i = size; i-- > 0 ; )
+		if (!scene.isFinite(i))
+			freeSlots.push_back(i) ;
+
+	//Leaves with consecutive slots keep only the range, so the map update scans them sequentially
+	for (size_t l = 0; l < reorderLeaves.size() ; l++)
+		reorderLeaves[l]->packRange() ;
+
+	reorderActive = false ;
+	reorderLeaves.clear() ;
+}
+
+PointCustomSurfel SurfelMapper::getSurfel(SurfelIdx idx)
+{
+	return scene.get(idx) ;
+}
+
+void SurfelMapper::getSurfels(const std::vector<SurfelIdx> &indices, pcl::PointCloud<PointCustomSurfel> &surfels)
+{
+	//Packed surfels are expanded here, at the boundary to PCL
+	size_t first = surfels.points.size() ;
+	surfels.points.resize(first + indices.size()) ;
+	for (size_t i = 0; i < indices.size() ; i++)
+		scene.load(indices[i], surfels.points[first + i]) ;
+	surfels.width = surfels.points.size() ;
+	surfels.height = 1 ;
+}
+
+size_t SurfelMapper::getSceneSize()
+{
+	return scene.size() ;
+}
+
+size_t SurfelMapper::getSceneCapacity()
+{
+	return scene.capacity() ;
 }
 
 pcl::PointCloud<pcl::PointXYZRGB>::Ptr &SurfelMapper::getCloudSceneDownsampled()
@@ -753,46 +1388,84 @@ pcl::PointCloud<pcl::PointXYZRGB>::Ptr &SurfelMapper::getCloudSceneDownsampled()
 	return cloudSceneDownsampled ;
 }
 
+void SurfelMapper::getCloudSceneDownsampled(unsigned int level, pcl::PointCloud<pcl::PointXYZRGB> &cloud)
+{
+	if (level == 0)
+		cloud = *cloudSceneDownsampled ;
+	else
+		downsampleSceneCloud(level, cloud) ;
+}
+
+unsigned long SurfelMapper::getPreviewVersion()
+{
+	return previewVersion ;
+}
+
 size_t SurfelMapper::getPointCount()
 {
-	//Convert voxels at fixed depth to points in a downsampled cloud
-	pcl::octree::OctreePointCloud<PointCustomSurfel>::LeafNodeIterator it = octree.leaf_begin() ;
-	const pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator it_end = octree.leaf_end();
-	size_t count = 0 ;
-	while(it != it_end) {
-		if (it.isLeafNode()) {
-			//Examine points in the voxel	
-			pcl::octree::OctreeContainerPointIndices& container = it.getLeafContainer();
-			count += container.getSize() ;
-		} else {
-			std::cerr << "LeafNode iterator error - we are not in the leaf node!" << std::endl ;
-		}
-		it++ ;
-	}
-	return count ;
+	return surfelCount ;
+}
+
+size_t SurfelMapper::getMaxSceneSize()
+{
+	if (SPATIAL_INDEX == SPATIAL_INDEX_OCTREE)
+		return std::numeric_limits<int>::max() ;
+	return std::numeric_limits<SurfelIdx>::max() ;
 }
 
 
 void SurfelMapper::resetMap()
 {
-	cloudScene = pcl::PointCloud<PointCustomSurfel>::Ptr(new pcl::PointCloud<PointCustomSurfel>) ;
-	cloudScene->reserve(this->SCENE_SIZE) ;
+	//Recycle the chunks of the scene storage (no allocation is needed until the new map outgrows the old one)
+	scene.clear() ;
 
 	cloudSceneDownsampled = pcl::PointCloud<pcl::PointXYZRGB>::Ptr(new pcl::PointCloud<pcl::PointXYZRGB>) ;
-
-	octree.deleteTree() ;
-	octree.setResolution(this->OCTREE_RESOLUTION) ; //Does it give the same effect as placed in the constructor?
-	octree.setInputCloud(cloudScene) ;
+	previewVersion++ ;
+	surfelCount = 0 ;
+	freeSlots.clear() ;
+	releasedSlots.clear() ;
+	residentTiles.clear() ;
+	pagingOriginValid = false ;
+	if (tileCache)
+		tileCache->clear() ;
+	reorderActive = false ;
+	reorderLeaves.clear() ;
+	reorderStartFrame = frameIndex ;
+	rebuildEvictionHistogram() ; //The map is empty, the memory of the histogram is kept
+
+	createSpatialIndex() ;
+	SurfelLeaf::getPool().release() ; //Leaf storage of the old map has been returned to the pool, free it if no other map uses the pool
+
+	mapDelta.seq++ ;
+	mapDelta.clear() ;
 
 	initLogger() ;
 }
 
-void SurfelMapper::getBoundingBoxIndices(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<int> &k_indices)
+void SurfelMapper::getBoundingBoxIndices(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<SurfelIdx> &k_indices)
+{
+	spatialIndex->boxSearch(min_pt, max_pt, k_indices) ;
+}
+
+void SurfelMapper::getBoundingBoxSurfels(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, pcl::PointCloud<PointCustomSurfel> &surfels)
+{
+	std::vector<SurfelIdx> k_indices ;
+	spatialIndex->boxSearch(min_pt, max_pt, k_indices) ;
+	getSurfels(k_indices, surfels) ;
+	if (tileCache)
+		tileCache->getSurfelsInBox(min_pt, max_pt, surfels) ;
+}
+
+void SurfelMapper::getAllSurfels(pcl::PointCloud<PointCustomSurfel> &surfels)
 {
-	octree.boxSearch(min_pt, max_pt, k_indices) ;
+	std::vector<SurfelIdx> k_indices ;
+	getAllIndices(k_indices) ;
+	getSurfels(k_indices, surfels) ;
+	if (tileCache)
+		tileCache->getSurfelsInBox(Eigen::Vector3f::Constant(-std::numeric_limits<float>::max()), Eigen::Vector3f::Constant(std::numeric_limits<float>::max()), surfels) ;
 }
 
-void SurfelMapper::getAllIndices(std::vector<int> &k_indices) 
+void SurfelMapper::getAllIndices(std::vector<SurfelIdx> &k_indices) 
 {
 	//std::vector<int> k_indices1 ;
 	//double minx, miny, minz, maxx, maxy, maxz ;
@@ -802,19 +1475,173 @@ void SurfelMapper::getAllIndices(std::vector<int> &k_indices)
 	//octree.boxSearch(min_pt, max_pt, k_indices) ;
 
 	//Collect indices of points from all leaves
-	pcl::octree::OctreePointCloud<PointCustomSurfel>::LeafNodeIterator it = octree.leaf_begin() ;
-	const pcl::octree::OctreePointCloud<PointCustomSurfel>::DepthFirstIterator it_end = octree.leaf_end();
-	while(it != it_end) {
-		if (it.isLeafNode()) {
-			//Examine points in the voxel	
-			pcl::octree::OctreeContainerPointIndices& container = it.getLeafContainer() ;
-			std::vector<int> &pointIndices  = container.getPointIndicesVector() ;
-			k_indices.insert(k_indices.end(), pointIndices.begin(), pointIndices.end()) ; //What about the performance
-		} else {
-			std::cerr << "LeafNode iterator error - we are not in the leaf node!" << std::endl ;
-		}
-		it++ ;
+	std::vector<SurfelLeaf*> leaves ;
+	spatialIndex->getLeaves(leaves) ;
+	for (size_t i = 0; i < leaves.size() ; i++) {
+		leaves[i]->getPointIndices(k_indices) ;
 	}
 
 	//std::cout << "getAllIndices: method 1 " << k_indices.size() << " and method 2 " << k_indices1.size() << std::endl ;
 }
+
+void SurfelMapper::getOrderedIndices(std::vector<SurfelIdx> &k_indices)
+{
+	std::vector<SurfelLeaf*> leaves ;
+	spatialIndex->getOrderedLeaves(leaves) ;
+	for (size_t i = 0; i < leaves.size() ; i++)
+		leaves[i]->getPointIndices(k_indices) ;
+}
+
+void SurfelMapper::setDeltaRecording(bool RECORD_DELTA)
+{
+	this->RECORD_DELTA = RECORD_DELTA ;
+	mapDelta.clear() ;
+}
+
+void SurfelMapper::setOcclusionCulling(bool USE_OCCLUSION_CULLING)
+{
+	this->USE_OCCLUSION_CULLING = USE_OCCLUSION_CULLING ;
+}
+
+void SurfelMapper::setFreezing(bool USE_FREEZING, int FREEZE_CONFIDENCE, double FREEZE_MAX_RESIDUAL)
+{
+	this->USE_FREEZING = USE_FREEZING ;
+	this->FREEZE_CONFIDENCE = FREEZE_CONFIDENCE ;
+	this->FREEZE_MAX_RESIDUAL = FREEZE_MAX_RESIDUAL ;
+}
+
+void SurfelMapper::setActiveWindow(int ACTIVE_WINDOW)
+{
+	this->ACTIVE_WINDOW = ACTIVE_WINDOW ;
+}
+
+uint32_t SurfelMapper::getLastObserved(SurfelIdx idx)
+{
+	return scene.lastObserved(idx) ;
+}
+
+uint32_t SurfelMapper::getFrameIndex()
+{
+	return frameIndex ;
+}
+
+void SurfelMapper::setKeyframeRejection(double MIN_NEW_COVERAGE, int COVERAGE_SAMPLE_STEP)
+{
+	this->MIN_NEW_COVERAGE = MIN_NEW_COVERAGE ;
+	this->COVERAGE_SAMPLE_STEP = COVERAGE_SAMPLE_STEP ;
+}
+
+void SurfelMapper::setSurfelSpacing(double SURFEL_SPACING)
+{
+	this->SURFEL_SPACING = SURFEL_SPACING ;
+}
+
+void SurfelMapper::setConsolidation(double CONSOLIDATION_BUDGET, double MERGE_RADIUS_RATIO, double MERGE_MIN_NORMAL_DOT)
+{
+	this->CONSOLIDATION_BUDGET = CONSOLIDATION_BUDGET ;
+	this->MERGE_RADIUS_RATIO = MERGE_RADIUS_RATIO ;
+	this->MERGE_MIN_NORMAL_DOT = MERGE_MIN_NORMAL_DOT ;
+}
+
+unsigned long SurfelMapper::getRejectedFrameCount()
+{
+	return rejectedFrames ;
+}
+
+void SurfelMapper::setSurfelBudget(size_t MAX_SURFELS, EvictionPolicy EVICTION_POLICY, double EVICTION_FRACTION)
+{
+	bool rebuild = (MAX_SURFELS > 0) != (this->MAX_SURFELS > 0) || EVICTION_POLICY != this->EVICTION_POLICY ;
+	this->MAX_SURFELS = MAX_SURFELS ;
+	this->EVICTION_POLICY = EVICTION_POLICY ;
+	this->EVICTION_FRACTION = std::min(std::max(EVICTION_FRACTION, MIN_EVICTION_FRACTION), MAX_EVICTION_FRACTION) ;
+	if (this->EVICTION_FRACTION != EVICTION_FRACTION)
+		std::cout << "EVICTION_FRACTION [" << EVICTION_FRACTION << "] clamped to [" << this->EVICTION_FRACTION << "]" << std::endl ;
+	if (rebuild)
+		rebuildEvictionHistogram() ;
+}
+
+void SurfelMapper::setPaging(double PAGING_RADIUS, int PAGING_TILE_LEVEL, const std::string &PAGING_DIRECTORY, bool PAGING_COMPACT)
+{
+	//Tiles within the sensor range must stay in memory, otherwise the update would duplicate surfels paged out
+	double min_radius = MAX_KINECT_DIST + OCTREE_RESOLUTION * (1 << PAGING_TILE_LEVEL) ;
+	this->PAGING_RADIUS = PAGING_RADIUS > 0.0 ? std::max(PAGING_RADIUS, min_radius) : 0.0 ;
+	if (PAGING_RADIUS > 0.0 && this->PAGING_RADIUS != PAGING_RADIUS)
+		std::cout << "PAGING_RADIUS [" << PAGING_RADIUS << "] clamped to [" << this->PAGING_RADIUS << "]" << std::endl ;
+	this->PAGING_TILE_LEVEL = PAGING_TILE_LEVEL ;
+	this->PAGING_DIRECTORY = PAGING_DIRECTORY ;
+	this->PAGING_COMPACT = PAGING_COMPACT ;
+	if (PAGING_RADIUS > 0.0) {
+		tileCache.reset(new SurfelTileCache(PAGING_DIRECTORY, OCTREE_RESOLUTION * (1 << PAGING_TILE_LEVEL), PAGING_COMPACT)) ;
+		//Tiles of the surfels already in the map
+		residentTiles.clear() ;
+		for (size_t i = 0; i < scene.size() ; i++)
+			if (scene.isFinite(i))
+				residentTiles.insert(tileCache->getTileKey(scene.getPosition(i))) ;
+	} else {
+		tileCache.reset() ;
+		residentTiles.clear() ;
+	}
+	pagingOriginValid = false ;
+}
+
+void SurfelMapper::setReordering(int REORDER_INTERVAL, double REORDER_BUDGET)
+{
+	this->REORDER_INTERVAL = REORDER_INTERVAL ;
+	this->REORDER_BUDGET = REORDER_BUDGET ;
+}
+
+bool SurfelMapper::isReordering()
+{
+	return reorderActive ;
+}
+
+void SurfelMapper::getMemoryReport(MemoryReport &report)
+{
+	report.surfel_bytes = scene.getMemoryBytes() ;
+	report.slot_list_bytes = (freeSlots.capacity() + releasedSlots.capacity()) * sizeof(SurfelIdx) + reorderLeaves.capacity() * sizeof(SurfelLeaf*) +
+		evictionHistogram.getMemoryBytes() + evictionCellKeys.capacity() * sizeof(TileKey) +
+		evictionCells.size() * (sizeof(std::map<TileKey, uint32_t>::value_type) + 4 * sizeof(void*)) ; //Tree nodes hold the value, three links and the color
+
+	IndexMemoryUsage usage ;
+	spatialIndex->getMemoryUsage(usage) ;
+	report.branch_bytes = usage.branch_bytes ;
+	report.leaf_bytes = usage.leaf_bytes ;
+	report.branch_count = usage.branch_count ;
+	report.leaf_count = usage.leaf_count ;
+	report.leaf_index_bytes = SurfelLeaf::getPool().getReservedBytes() + SurfelLeaf::getPool().getHeapBytes() ;
+
+	report.preview_bytes = cloudSceneDownsampled->points.capacity() * sizeof(pcl::PointXYZRGB) ;
+	report.scratch_bytes = scratchBytes ;
+	report.live_surfels = surfelCount ;
+	report.dead_surfels = scene.size() - surfelCount ;
+}
+
+size_t SurfelMapper::getPagedOutCount()
+{
+	return tileCache ? tileCache->getSurfelCount() : 0 ;
+}
+
+const SurfelMapDelta &SurfelMapper::getLastDelta()
+{
+	return mapDelta ;
+}
+
+void SurfelMapper::setSpatialIndex(SpatialIndexType SPATIAL_INDEX)
+{
+	this->SPATIAL_INDEX = SPATIAL_INDEX ;
+	if (reorderActive) //Leaves of the old index are gone, the pass is cut short
+		finishReordering() ;
+	createSpatialIndex() ;
+	spatialIndex->addPointsFromInputStorage() ; //Removed surfels are NaN-ed, so they are skipped
+	downsampleSceneCloud() ;
+}
+
+void SurfelMapper::setCompactScene(bool COMPACT_SCENE)
+{
+	this->COMPACT_SCENE = COMPACT_SCENE ;
+	if (COMPACT_SCENE == scene.isCompact())
+		return ;
+	scene.setCompact(COMPACT_SCENE) ; //Indices refer to slots, so the spatial index is kept
+	if (MAX_SURFELS > 0)
+		rebuildEvictionHistogram() ; //Quantization may move surfels to other buckets
+}
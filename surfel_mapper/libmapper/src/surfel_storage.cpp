@@ -0,0 +1,113 @@
+/**
+ *  @file surfel_storage.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "surfel_storage.hpp"
+#include <algorithm>
+#include <limits>
+#include <assert.h>
+
+SurfelStorage::SurfelStorage(): count(0), compact(false)
+{}
+
+void SurfelStorage::addChunk()
+{
+	//Chunks are not initialized, so their pages are mapped when the surfels are written
+	if (compact)
+		packed_chunks.push_back(std::unique_ptr<PackedSurfel[]>(new PackedSurfel[SCENE_CHUNK_SIZE])) ;
+	else
+		chunks.push_back(std::unique_ptr<PointCustomSurfel[]>(new PointCustomSurfel[SCENE_CHUNK_SIZE])) ;
+	last_observed_chunks.push_back(std::unique_ptr<uint32_t[]>(new uint32_t[SCENE_CHUNK_SIZE])) ;
+}
+
+void SurfelStorage::remove(SurfelIdx idx)
+{
+	if (compact) {
+		packed(idx).position[3] |= 0x8000 ;
+	} else {
+		PointCustomSurfel &point = full(idx) ;
+		point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN () ;
+	}
+}
+
+void SurfelStorage::swap(SurfelIdx a, SurfelIdx b)
+{
+	if (compact)
+		std::swap(packed(a), packed(b)) ;
+	else
+		std::swap(full(a), full(b)) ;
+	std::swap(lastObserved(a), lastObserved(b)) ;
+}
+
+void SurfelStorage::move(SurfelIdx dst, SurfelIdx src)
+{
+	if (compact)
+		packed(dst) = packed(src) ;
+	else
+		full(dst) = full(src) ;
+	lastObserved(dst) = lastObserved(src) ;
+	remove(src) ;
+}
+
+void SurfelStorage::setCompact(bool compact)
+{
+	if (compact == this->compact)
+		return ;
+	for (size_t c = 0; c < last_observed_chunks.size() ; c++) {
+		size_t nslots = std::min<size_t>(SCENE_CHUNK_SIZE, count > (c << SCENE_CHUNK_SHIFT) ? count - (c << SCENE_CHUNK_SHIFT) : 0) ;
+		if (compact) {
+			packed_chunks.push_back(std::unique_ptr<PackedSurfel[]>(new PackedSurfel[SCENE_CHUNK_SIZE])) ;
+			for (size_t i = 0; i < nslots ; i++)
+				encodeSurfel(chunks[c][i], packed_chunks[c][i]) ;
+			chunks[c].reset() ;
+		} else {
+			chunks.push_back(std::unique_ptr<PointCustomSurfel[]>(new PointCustomSurfel[SCENE_CHUNK_SIZE])) ;
+			for (size_t i = 0; i < nslots ; i++)
+				decodeSurfel(packed_chunks[c][i], chunks[c][i]) ;
+			packed_chunks[c].reset() ;
+		}
+	}
+	if (compact)
+		chunks.clear() ;
+	else
+		packed_chunks.clear() ;
+	this->compact = compact ;
+}
+
+bool SurfelStorage::reserve(size_t size)
+{
+	bool allocated = false ;
+	while (capacity() < size) {
+		addChunk() ;
+		allocated = true ;
+	}
+	return allocated ;
+}
+
+void SurfelStorage::push_back(const PointCustomSurfel &point, uint32_t last_observed)
+{
+	if (count == capacity())
+		addChunk() ;
+	store(count, point) ;
+	lastObserved(count) = last_observed ;
+	count++ ;
+}
+
+void SurfelStorage::resize(size_t new_size)
+{
+	assert(new_size <= count) ;
+	count = new_size ;
+}
+
+size_t SurfelStorage::getMemoryBytes() const
+{
+	size_t surfel_bytes = compact ? sizeof(PackedSurfel) : sizeof(PointCustomSurfel) ;
+	return capacity() * (surfel_bytes + sizeof(uint32_t)) + chunks.capacity() * sizeof(chunks[0]) +
+		packed_chunks.capacity() * sizeof(packed_chunks[0]) + last_observed_chunks.capacity() * sizeof(last_observed_chunks[0]) ;
+}
@@ -0,0 +1,207 @@
+/**
+ *  @file tile_cache.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "tile_cache.hpp"
+#include "compact_surfel.hpp"
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <unistd.h>
+#include <sys/stat.h>
+
+SurfelTileCache::SurfelTileCache(const std::string &directory, double tile_size, bool compact): directory(directory), tile_size(tile_size), compact(compact), surfel_count(0)
+{
+	static unsigned int instances = 0 ;
+	prefix = std::to_string(getpid()) + "_" + std::to_string(instances++) ; //Several maps may share the directory
+	mkdir(directory.c_str(), 0755) ; //Fails harmlessly if the directory exists
+}
+
+SurfelTileCache::~SurfelTileCache()
+{
+	clear() ;
+}
+
+std::string SurfelTileCache::getTilePath(const TileKey &key) const
+{
+	return directory + "/tile_" + prefix + "_" + std::to_string(key.x) + "_" + std::to_string(key.y) + "_" + std::to_string(key.z) + ".bin" ;
+}
+
+Eigen::Vector3f SurfelTileCache::getTileOrigin(const TileKey &key) const
+{
+	return (Eigen::Vector3d(key.x, key.y, key.z) * tile_size).cast<float>() ;
+}
+
+SurfelTileCache::TileContents SurfelTileCache::readTile(const std::string &path, size_t count, bool compact, const Eigen::Vector3f &origin, float side)
+{
+	TileContents contents ;
+	contents.surfels.reset(new pcl::PointCloud<PointCustomSurfel>) ;
+	pcl::PointCloud<PointCustomSurfel> &cloud = *contents.surfels ;
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary) ;
+	size_t surfel_bytes = compact ? sizeof(CompactSurfel) : sizeof(PointCustomSurfel) ;
+	size_t record_bytes = surfel_bytes + sizeof(uint32_t) ;
+	std::vector<char> records(count * record_bytes) ;
+	if (count > 0 && file.read(&records[0], records.size())) {
+		cloud.points.resize(count) ;
+		contents.last_observed.resize(count) ;
+		for (size_t i = 0; i < count ; i++) {
+			const char *record = &records[i * record_bytes] ;
+			if (compact) {
+				CompactSurfel compact_surfel ;
+				memcpy(&compact_surfel, record, surfel_bytes) ;
+				decodeSurfel(compact_surfel, origin, side, cloud.points[i]) ;
+			} else
+				memcpy(&cloud.points[i], record, surfel_bytes) ;
+			memcpy(&contents.last_observed[i], record + surfel_bytes, sizeof(uint32_t)) ;
+		}
+	}
+	cloud.width = cloud.points.size() ;
+	cloud.height = 1 ;
+	return contents ;
+}
+
+SurfelTileCache::TileContents SurfelTileCache::getTileSurfels(const TileKey &key, PagedTile &tile) const
+{
+	if (tile.loading.valid())
+		return tile.loading.get() ;
+	return readTile(getTilePath(key), tile.count, compact, getTileOrigin(key), tile_size) ;
+}
+
+TileKey SurfelTileCache::getTileKey(const Eigen::Vector3f &point) const
+{
+	TileKey key = { static_cast<int>(floor(point[0] / tile_size)), static_cast<int>(floor(point[1] / tile_size)), static_cast<int>(floor(point[2] / tile_size)) } ;
+	return key ;
+}
+
+double SurfelTileCache::getSquaredDistance(const TileKey &key, const Eigen::Vector3f &point) const
+{
+	Eigen::Vector3d min_bb = Eigen::Vector3d(key.x, key.y, key.z) * tile_size ;
+	Eigen::Vector3d max_bb = min_bb + Eigen::Vector3d::Constant(tile_size) ;
+	Eigen::Vector3d p = point.cast<double>() ;
+	Eigen::Vector3d d = (min_bb - p).cwiseMax(p - max_bb).cwiseMax(Eigen::Vector3d::Zero()) ;
+	return d.squaredNorm() ;
+}
+
+bool SurfelTileCache::store(const TileKey &key, const pcl::PointCloud<PointCustomSurfel> &surfels, const std::vector<uint32_t> &last_observed)
+{
+	if (surfels.points.empty())
+		return true ;
+	PagedTile &tile = tiles[key] ;
+	if (tile.count == 0) {
+		tile.min_pt = Eigen::Vector3f::Constant(std::numeric_limits<float>::max()) ;
+		tile.max_pt = Eigen::Vector3f::Constant(-std::numeric_limits<float>::max()) ;
+	}
+	if (tile.loading.valid()) {
+		//The file is being read - let the read finish before appending (the data read is dropped, the file keeps it)
+		tile.loading.wait() ;
+		tile.loading = std::shared_future<TileContents>() ;
+	}
+
+	//Each record is a surfel (plain or quantized) followed by its last observation frame
+	Eigen::Vector3f origin = getTileOrigin(key) ;
+	size_t surfel_bytes = compact ? sizeof(CompactSurfel) : sizeof(PointCustomSurfel) ;
+	size_t record_bytes = surfel_bytes + sizeof(uint32_t) ;
+	std::vector<char> records(surfels.points.size() * record_bytes) ;
+	for (size_t i = 0; i < surfels.points.size() ; i++) {
+		char *record = &records[i * record_bytes] ;
+		if (compact) {
+			CompactSurfel compact_surfel ;
+			encodeSurfel(surfels.points[i], origin, tile_size, compact_surfel) ;
+			memcpy(record, &compact_surfel, surfel_bytes) ;
+		} else
+			memcpy(record, &surfels.points[i], surfel_bytes) ;
+		memcpy(record + surfel_bytes, &last_observed[i], sizeof(uint32_t)) ;
+	}
+	std::string path = getTilePath(key) ;
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::binary | std::ios::app) ;
+	if (!file.write(&records[0], records.size())) {
+		if (tile.count == 0)
+			tiles.erase(key) ;
+		return false ;
+	}
+	for (size_t i = 0; i < surfels.points.size() ; i++) {
+		tile.min_pt = tile.min_pt.cwiseMin(surfels.points[i].getVector3fMap()) ;
+		tile.max_pt = tile.max_pt.cwiseMax(surfels.points[i].getVector3fMap()) ;
+	}
+	tile.count += surfels.points.size() ;
+	surfel_count += surfels.points.size() ;
+	return true ;
+}
+
+void SurfelTileCache::prefetch(const TileKey &key)
+{
+	std::map<TileKey, PagedTile>::iterator it = tiles.find(key) ;
+	if (it == tiles.end() || it->second.loading.valid())
+		return ;
+	it->second.loading = std::async(std::launch::async, &SurfelTileCache::readTile, getTilePath(key), it->second.count, compact, getTileOrigin(key), static_cast<float>(tile_size)).share() ;
+}
+
+bool SurfelTileCache::isLoaded(const TileKey &key) const
+{
+	std::map<TileKey, PagedTile>::const_iterator it = tiles.find(key) ;
+	return it != tiles.end() && it->second.loading.valid() && it->second.loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready ;
+}
+
+bool SurfelTileCache::take(const TileKey &key, pcl::PointCloud<PointCustomSurfel> &surfels, std::vector<uint32_t> &last_observed)
+{
+	std::map<TileKey, PagedTile>::iterator it = tiles.find(key) ;
+	if (it == tiles.end())
+		return false ;
+	TileContents contents = getTileSurfels(key, it->second) ;
+	if (contents.surfels->points.size() != it->second.count) {
+		it->second.loading = std::shared_future<TileContents>() ; //The next attempt reads the file again
+		return false ;
+	}
+	surfels.points.insert(surfels.points.end(), contents.surfels->points.begin(), contents.surfels->points.end()) ;
+	last_observed.insert(last_observed.end(), contents.last_observed.begin(), contents.last_observed.end()) ;
+	surfels.width = surfels.points.size() ;
+	surfels.height = 1 ;
+
+	remove(getTilePath(key).c_str()) ;
+	surfel_count -= it->second.count ;
+	tiles.erase(it) ;
+	return true ;
+}
+
+void SurfelTileCache::getTiles(std::vector<TileKey> &keys) const
+{
+	for (std::map<TileKey, PagedTile>::const_iterator it = tiles.begin(); it != tiles.end() ; it++)
+		keys.push_back(it->first) ;
+}
+
+void SurfelTileCache::getSurfelsInBox(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, pcl::PointCloud<PointCustomSurfel> &surfels)
+{
+	for (std::map<TileKey, PagedTile>::iterator it = tiles.begin(); it != tiles.end() ; it++) {
+		PagedTile &tile = it->second ;
+		if ((tile.min_pt.array() > max_pt.array()).any() || (tile.max_pt.array() < min_pt.array()).any())
+			continue ;
+		CloudPtr cloud = getTileSurfels(it->first, tile).surfels ;
+		for (size_t i = 0; i < cloud->points.size() ; i++) {
+			const PointCustomSurfel &point = cloud->points[i] ;
+			if ((point.getArray3fMap() >= min_pt.array()).all() && (point.getArray3fMap() <= max_pt.array()).all())
+				surfels.points.push_back(point) ;
+		}
+	}
+	surfels.width = surfels.points.size() ;
+	surfels.height = 1 ;
+}
+
+void SurfelTileCache::clear()
+{
+	for (std::map<TileKey, PagedTile>::iterator it = tiles.begin(); it != tiles.end() ; it++) {
+		if (it->second.loading.valid())
+			it->second.loading.wait() ;
+		remove(getTilePath(it->first).c_str()) ;
+	}
+	tiles.clear() ;
+	surfel_count = 0 ;
+}
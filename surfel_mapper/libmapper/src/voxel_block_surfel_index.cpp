@@ -0,0 +1,270 @@
+/**
+ *  @file voxel_block_surfel_index.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "voxel_block_surfel_index.hpp"
+#include <pcl/visualization/common/common.h>
+#include <pcl/common/point_tests.h>
+#include <limits.h>
+#include <assert.h>
+#include <math.h>
+
+/**
+ * @brief Accumulated color of a preview voxel
+ */
+struct VoxelColorSum {
+	unsigned long r = 0 ; /**< @brief sum of red components */
+	unsigned long g = 0 ; /**< @brief sum of green components */
+	unsigned long b = 0 ; /**< @brief sum of blue components */
+	unsigned long count = 0 ; /**< @brief number of samples */
+} ;
+
+VoxelBlockSurfelIndex::VoxelBlockSurfelIndex(double resolution): resolution(resolution), block_side(resolution * BLOCK_SIDE), storage(NULL), leaf_count(0)
+{}
+
+void VoxelBlockSurfelIndex::addPointIdx(SurfelIdx idx)
+{
+	const Eigen::Vector3f point = storage->getPosition(idx) ;
+	int vx = static_cast<int>(floor(point[0] / resolution)) ;
+	int vy = static_cast<int>(floor(point[1] / resolution)) ;
+	int vz = static_cast<int>(floor(point[2] / resolution)) ;
+	BlockKey key = { floorDiv(vx, BLOCK_SIDE), floorDiv(vy, BLOCK_SIDE), floorDiv(vz, BLOCK_SIDE) } ;
+	int position = (vx - key.x * BLOCK_SIDE) + BLOCK_SIDE * ((vy - key.y * BLOCK_SIDE) + BLOCK_SIDE * (vz - key.z * BLOCK_SIDE)) ;
+
+	VoxelBlock &block = blocks[key] ;
+	int16_t &slot = block.slots[position] ;
+	if (slot < 0) {
+		slot = static_cast<int16_t>(block.leaves.size()) ;
+		block.leaves.push_back(SurfelLeaf()) ;
+		block.leaf_positions.push_back(static_cast<uint16_t>(position)) ;
+		leaf_count++ ;
+	}
+	block.leaves[slot].addPointIndex(idx) ;
+	setLeaf(idx, &block.leaves[slot]) ;
+}
+
+void VoxelBlockSurfelIndex::getBlockBounds(const BlockKey &key, Eigen::Vector3d &min_bb, Eigen::Vector3d &max_bb)
+{
+	min_bb = Eigen::Vector3d(key.x, key.y, key.z) * block_side ;
+	max_bb = min_bb + Eigen::Vector3d::Constant(block_side) ;
+}
+
+void VoxelBlockSurfelIndex::getLeafBounds(const BlockKey &key, int position, Eigen::Vector3d &min_bb, Eigen::Vector3d &max_bb)
+{
+	int px = position % BLOCK_SIDE ;
+	int py = (position / BLOCK_SIDE) % BLOCK_SIDE ;
+	int pz = position / (BLOCK_SIDE * BLOCK_SIDE) ;
+	min_bb = Eigen::Vector3d(key.x * BLOCK_SIDE + px, key.y * BLOCK_SIDE + py, key.z * BLOCK_SIDE + pz) * resolution ;
+	max_bb = min_bb + Eigen::Vector3d::Constant(resolution) ;
+}
+
+void VoxelBlockSurfelIndex::getBlocksInBox(const Eigen::Vector3d &min_bb, const Eigen::Vector3d &max_bb, std::vector<BlockMapT::value_type*> &selected)
+{
+	//Block coordinates of the box (clamped, so that the casts to int are safe)
+	double kmin[3], kmax[3], nblocks = 1.0 ;
+	for (int i = 0; i < 3 ; i++) {
+		kmin[i] = std::min(std::max(floor(min_bb[i] / block_side), INT_MIN / 2.0), INT_MAX / 2.0) ;
+		kmax[i] = std::min(std::max(floor(max_bb[i] / block_side), INT_MIN / 2.0), INT_MAX / 2.0) ;
+		if (kmax[i] < kmin[i])
+			return ;
+		nblocks *= kmax[i] - kmin[i] + 1.0 ;
+	}
+
+	if (nblocks < blocks.size()) {
+		//Enumerate block coordinates
+		BlockKey key ;
+		for (key.z = (int) kmin[2]; key.z <= (int) kmax[2] ; key.z++)
+			for (key.y = (int) kmin[1]; key.y <= (int) kmax[1] ; key.y++)
+				for (key.x = (int) kmin[0]; key.x <= (int) kmax[0] ; key.x++) {
+					BlockMapT::iterator it = blocks.find(key) ;
+					if (it != blocks.end())
+						selected.push_back(&*it) ;
+				}
+	} else {
+		//Scan allocated blocks
+		for (BlockMapT::iterator it = blocks.begin(); it != blocks.end() ; it++) {
+			const BlockKey &key = it->first ;
+			if (key.x >= kmin[0] && key.x <= kmax[0] && key.y >= kmin[1] && key.y <= kmax[1] && key.z >= kmin[2] && key.z <= kmax[2])
+				selected.push_back(&*it) ;
+		}
+	}
+}
+
+void VoxelBlockSurfelIndex::setInputStorage(const SurfelStorage *storage)
+{
+	this->storage = storage ;
+}
+
+void VoxelBlockSurfelIndex::addPointsFromInputStorage()
+{
+	for (size_t i = 0; i < storage->size() ; i++)
+		if (storage->isFinite(i))
+			addPointIdx(i) ;
+}
+
+void VoxelBlockSurfelIndex::addPointFromStorage(SurfelIdx idx)
+{
+	addPointIdx(idx) ;
+}
+
+unsigned int VoxelBlockSurfelIndex::getVisibleLeaves(const ViewFrustum &frustum, std::vector<SurfelLeaf*> &leaves)
+{
+	unsigned int nodes_visited = 0 ;
+	std::vector<BlockMapT::value_type*> selected ;
+	if (frustum.enabled)
+		getBlocksInBox(frustum.min_bb, frustum.max_bb, selected) ;
+	else
+		for (BlockMapT::iterator it = blocks.begin(); it != blocks.end() ; it++)
+			selected.push_back(&*it) ;
+
+	for (size_t i = 0; i < selected.size() ; i++) {
+		const BlockKey &key = selected[i]->first ;
+		VoxelBlock &block = selected[i]->second ;
+		nodes_visited++ ;
+
+		Eigen::Vector3d min_bb, max_bb ;
+		getBlockBounds(key, min_bb, max_bb) ;
+		unsigned int block_plane_mask = ViewFrustum::ALL_PLANES ;
+		int frustum_result = frustum.cull(min_bb, max_bb, block_plane_mask) ;
+		if (frustum_result == pcl::visualization::PCL_OUTSIDE_FRUSTUM || frustum.isOccluded(min_bb, max_bb))
+			continue ;
+
+		for (size_t j = 0; j < block.leaves.size() ; j++) {
+			if (frustum_result == pcl::visualization::PCL_INTERSECT_FRUSTUM || frustum.depth_bounds != NULL) {
+				//Block on the frustum border (or occlusion culling on) - test leaves separately (only against the planes crossing the block)
+				nodes_visited++ ;
+				getLeafBounds(key, block.leaf_positions[j], min_bb, max_bb) ;
+				unsigned int plane_mask = block_plane_mask ;
+				if (frustum.cull(min_bb, max_bb, plane_mask) == pcl::visualization::PCL_OUTSIDE_FRUSTUM || frustum.isOccluded(min_bb, max_bb))
+					continue ;
+			}
+			leaves.push_back(&block.leaves[j]) ;
+		}
+	}
+	return nodes_visited ;
+}
+
+void VoxelBlockSurfelIndex::getLeaves(std::vector<SurfelLeaf*> &leaves)
+{
+	for (BlockMapT::iterator it = blocks.begin(); it != blocks.end() ; it++) {
+		VoxelBlock &block = it->second ;
+		for (size_t j = 0; j < block.leaves.size() ; j++)
+			leaves.push_back(&block.leaves[j]) ;
+	}
+}
+
+void VoxelBlockSurfelIndex::getOrderedLeaves(std::vector<SurfelLeaf*> &leaves)
+{
+	std::vector<std::pair<uint64_t, SurfelLeaf*> > order ;
+	for (BlockMapT::iterator it = blocks.begin(); it != blocks.end() ; it++) {
+		const BlockKey &key = it->first ;
+		VoxelBlock &block = it->second ;
+		for (size_t j = 0; j < block.leaves.size() ; j++) {
+			int position = block.leaf_positions[j] ;
+			int vx = key.x * BLOCK_SIDE + position % BLOCK_SIDE ;
+			int vy = key.y * BLOCK_SIDE + (position / BLOCK_SIDE) % BLOCK_SIDE ;
+			int vz = key.z * BLOCK_SIDE + position / (BLOCK_SIDE * BLOCK_SIDE) ;
+			order.push_back(std::make_pair(getMortonCode(vx, vy, vz), &block.leaves[j])) ;
+		}
+	}
+	std::sort(order.begin(), order.end()) ;
+	for (size_t i = 0; i < order.size() ; i++)
+		leaves.push_back(order[i].second) ;
+}
+
+void VoxelBlockSurfelIndex::boxSearch(const Eigen::Vector3f &min_pt, const Eigen::Vector3f &max_pt, std::vector<SurfelIdx> &k_indices)
+{
+	std::vector<BlockMapT::value_type*> selected ;
+	getBlocksInBox(min_pt.cast<double>(), max_pt.cast<double>(), selected) ;
+
+	for (size_t i = 0; i < selected.size() ; i++) {
+		const BlockKey &key = selected[i]->first ;
+		VoxelBlock &block = selected[i]->second ;
+		for (size_t j = 0; j < block.leaves.size() ; j++) {
+			Eigen::Vector3d min_bb, max_bb ;
+			getLeafBounds(key, block.leaf_positions[j], min_bb, max_bb) ;
+			const SurfelLeaf &pointIndices = block.leaves[j] ;
+			if ((min_bb.array() >= min_pt.cast<double>().array()).all() && (max_bb.array() <= max_pt.cast<double>().array()).all())
+				pointIndices.getPointIndices(k_indices) ; //Leaf completely inside the box
+			else if ((max_bb.array() >= min_pt.cast<double>().array()).all() && (min_bb.array() <= max_pt.cast<double>().array()).all()) {
+				for (size_t k = 0; k < pointIndices.size() ; k++) {
+					const Eigen::Vector3f point = storage->getPosition(pointIndices[k]) ;
+					if ((point.array() >= min_pt.array()).all() && (point.array() <= max_pt.array()).all())
+						k_indices.push_back(pointIndices[k]) ;
+				}
+			}
+		}
+	}
+}
+
+void VoxelBlockSurfelIndex::getPreview(unsigned int level, double preview_resolution, int color_samples, pcl::PointCloud<pcl::PointXYZRGB> &cloud)
+{
+	//The largest voxel not exceeding the preview resolution (as in the octree), each coarser level doubles the voxel side
+	int factor = 1 ;
+	while (resolution * factor * 2 <= preview_resolution)
+		factor *= 2 ;
+	factor <<= level ;
+	double voxel_side = resolution * factor ;
+
+	//Accumulate colors sampled from the leaves in the preview voxels
+	std::unordered_map<BlockKey, VoxelColorSum, BlockKeyHash> voxels ;
+	for (BlockMapT::iterator it = blocks.begin(); it != blocks.end() ; it++) {
+		const BlockKey &key = it->first ;
+		VoxelBlock &block = it->second ;
+		for (size_t j = 0; j < block.leaves.size() ; j++) {
+			const SurfelLeaf &pointIndices = block.leaves[j] ;
+			if (pointIndices.empty())
+				continue ;
+			int position = block.leaf_positions[j] ;
+			BlockKey voxel_key = { floorDiv(key.x * BLOCK_SIDE + position % BLOCK_SIDE, factor),
+					floorDiv(key.y * BLOCK_SIDE + (position / BLOCK_SIDE) % BLOCK_SIDE, factor),
+					floorDiv(key.z * BLOCK_SIDE + position / (BLOCK_SIDE * BLOCK_SIDE), factor) } ;
+			VoxelColorSum &sum = voxels[voxel_key] ;
+			unsigned int step = pointIndices.size() / color_samples ;
+			if (step < 1) step = 1 ;
+			for (unsigned int i = 0; i < pointIndices.size() ; i += step) {
+				PointCustomSurfel p ;
+				storage->load(pointIndices[i], p) ;
+				sum.r += p.r ;
+				sum.g += p.g ;
+				sum.b += p.b ;
+				sum.count++ ;
+			}
+		}
+	}
+
+	//Convert voxels to points
+	cloud.clear() ;
+	cloud.reserve(voxels.size()) ;
+	for (std::unordered_map<BlockKey, VoxelColorSum, BlockKeyHash>::iterator it = voxels.begin(); it != voxels.end() ; it++) {
+		pcl::PointXYZRGB point ;
+		point.x = (it->first.x + 0.5) * voxel_side ;
+		point.y = (it->first.y + 0.5) * voxel_side ;
+		point.z = (it->first.z + 0.5) * voxel_side ;
+		point.r = it->second.r / it->second.count ;
+		point.g = it->second.g / it->second.count ;
+		point.b = it->second.b / it->second.count ;
+		point.a = 255 ;
+		cloud.push_back(point) ;
+	}
+}
+
+size_t VoxelBlockSurfelIndex::getBlockCount()
+{
+	return blocks.size() ;
+}
+
+void VoxelBlockSurfelIndex::getMemoryUsage(IndexMemoryUsage &usage) const
+{
+	usage.branch_count = blocks.size() ;
+	usage.leaf_count = leaf_count ;
+	//Hash nodes hold the key, the block and the link to the next node
+	usage.branch_bytes = blocks.size() * (sizeof(BlockMapT::value_type) + sizeof(void*)) + blocks.bucket_count() * sizeof(void*) ;
+	usage.leaf_bytes = leaf_count * (sizeof(SurfelLeaf) + sizeof(uint16_t)) + slot_leaves.capacity() * sizeof(SurfelLeaf*) ;
+}
@@ -14,7 +14,17 @@
 #define BOOST_TEST_MODULE SurfelMapperTest 
 #include <boost/test/unit_test.hpp>
 #include "surfel_mapper.hpp"
+#include "cloud_compression.hpp"
+#include "octree_surfel_index.hpp"
+#include "voxel_block_surfel_index.hpp"
+#include "compact_surfel.hpp"
+#include "tile_cache.hpp"
 #include <pcl/common/transforms.h>
+#include <pcl/common/io.h>
+#include <pcl/visualization/common/common.h>
+#include <map>
+#include <dirent.h>
+#include <unistd.h>
 
 
 ////////////////////////////////////////////////////////////////////////
@@ -49,6 +59,25 @@ CameraParams camera_params = { //Default camera parameters
 	239.5  //cy
 }; //Fixed camera params 
 
+/**
+ * Surfel mapper giving the tests direct access to the scene storage
+ */
+class SceneAccessMapper : public SurfelMapper {
+	public:
+		using SurfelMapper::SurfelMapper ;
+
+		SurfelStorage &getScene() { return scene ; } /**< @brief scene storage */
+		SurfelIndex &getSpatialIndex() { return *spatialIndex ; } /**< @brief spatial index */
+} ;
+
+/**
+ * Surfel storage giving the tests access to its chunks
+ */
+class ChunkAccessStorage : public SurfelStorage {
+	public:
+		const void *getChunk(size_t c) const { return compact ? (const void*) packed_chunks[c].get() : (const void*) chunks[c].get() ; } /**< @brief address of a chunk */
+} ;
+
 
 /**
  * Constructs a sample point cloud (flat surface)
@@ -177,6 +206,1205 @@ BOOST_AUTO_TEST_CASE(testAddMultipleViewpoints) {
     	BOOST_CHECK(startcount * 3 == endcount) ;
 }
 
+/**
+ * Boost test case - map deltas recorded for subsequent keyframes
+ */
+BOOST_AUTO_TEST_CASE(testMapDelta) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud ;
+	constructPointCloud(cloud) ;
+
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapper->setDeltaRecording(true) ;
+
+	mapper->addPointCloudToScene(cloud) ;
+	const SurfelMapDelta &delta = mapper->getLastDelta() ;
+	unsigned long seq = delta.seq ;
+	BOOST_CHECK_EQUAL(delta.added.size(), mapper->getPointCount()) ;
+	BOOST_CHECK(delta.updated.empty() && delta.removed.empty()) ;
+
+	//The same view again - surfels should be only updated
+	mapper->addPointCloudToScene(cloud) ;
+	BOOST_CHECK_EQUAL(delta.seq, seq + 1) ;
+	BOOST_CHECK(delta.added.empty() && delta.removed.empty()) ;
+	BOOST_CHECK(!delta.updated.empty()) ;
+
+	mapper->resetMap() ;
+	BOOST_CHECK_EQUAL(delta.seq, seq + 2) ;
+	BOOST_CHECK(delta.added.empty() && delta.updated.empty() && delta.removed.empty()) ;
+}
+
+/**
+ * Boost test case - the voxel-block spatial index gives the same map as the octree
+ */
+BOOST_AUTO_TEST_CASE(testVoxelBlockIndex) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud ;
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudTrans ;
+	constructPointCloud(cloud) ;
+
+	boost::shared_ptr<SurfelMapper> mapperOctree(new SurfelMapper(3e7, false, camera_params))  ;
+	boost::shared_ptr<SurfelMapper> mapperBlocks(new SurfelMapper(3e7, false, camera_params))  ;
+	mapperBlocks->setSpatialIndex(SPATIAL_INDEX_VOXEL_BLOCKS) ;
+
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+	mapperOctree->addPointCloudToScene(cloud) ;
+	mapperBlocks->addPointCloudToScene(cloud) ;
+	mapperBlocks->addPointCloudToScene(cloud) ; //Surfels should be only updated
+	BOOST_CHECK_EQUAL(mapperBlocks->getPointCount(), mapperOctree->getPointCount()) ;
+
+	cloud->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloud, cloudTrans) ;
+	mapperOctree->addPointCloudToScene(cloudTrans) ;
+	mapperBlocks->addPointCloudToScene(cloudTrans) ;
+	BOOST_CHECK_EQUAL(mapperBlocks->getPointCount(), mapperOctree->getPointCount()) ;
+
+	std::vector<SurfelIdx> indicesOctree, indicesBlocks ;
+	Eigen::Vector3f min_pt(-1.0, -1.0, 0.0), max_pt(0.0, 0.0, 3.0) ;
+	mapperOctree->getBoundingBoxIndices(min_pt, max_pt, indicesOctree) ;
+	mapperBlocks->getBoundingBoxIndices(min_pt, max_pt, indicesBlocks) ;
+	BOOST_CHECK(!indicesBlocks.empty()) ;
+	BOOST_CHECK_EQUAL(indicesBlocks.size(), indicesOctree.size()) ;
+
+	//Switching the index keeps the map
+	size_t count = mapperBlocks->getPointCount() ;
+	mapperBlocks->setSpatialIndex(SPATIAL_INDEX_OCTREE) ;
+	BOOST_CHECK_EQUAL(mapperBlocks->getPointCount(), count) ;
+}
+
+/**
+ * Boost test case - the linear octree follows changes of the underlying octree
+ */
+BOOST_AUTO_TEST_CASE(testLinearOctree) {
+	SurfelStorage storage ;
+	PointCustomSurfel p ;
+	p.rgba = 0u ;
+	for (int i = 0; i < 20 ; i++) {
+		p.x = 0.1 * i ;
+		p.y = 0.05 * i ;
+		p.z = 2.0 ;
+		storage.push_back(p, 0) ;
+	}
+
+	OctreeSurfelIndex index(0.2) ;
+	index.setInputStorage(&storage) ;
+	index.addPointsFromInputStorage() ;
+
+	std::vector<SurfelLeaf*> leaves, visible ;
+	index.getLeaves(leaves) ;
+	BOOST_CHECK_EQUAL(leaves.size(), index.getOctree().getLeafCount()) ;
+	BOOST_CHECK_EQUAL(index.getLinearNodeCount(), index.getOctree().getLeafCount() + index.getOctree().getBranchCount()) ;
+	ViewFrustum frustum ;
+	frustum.enabled = false ;
+	index.getVisibleLeaves(frustum, visible) ;
+	BOOST_CHECK(visible == leaves) ;
+
+	//A distant point extends the octree bounding box
+	p.x = p.y = -30.0 ;
+	storage.push_back(p, 0) ;
+	index.addPointFromStorage(storage.size() - 1) ;
+	leaves.clear() ;
+	index.getLeaves(leaves) ;
+	BOOST_CHECK_EQUAL(leaves.size(), index.getOctree().getLeafCount()) ;
+	BOOST_CHECK_EQUAL(index.getLinearNodeCount(), index.getOctree().getLeafCount() + index.getOctree().getBranchCount()) ;
+	size_t point_count = 0 ;
+	for (size_t i = 0; i < leaves.size() ; i++)
+		point_count += leaves[i]->getSize() ;
+	BOOST_CHECK_EQUAL(point_count, storage.size()) ;
+}
+
+/**
+ * Boost test case - leaf index storage drawn from the pool
+ */
+BOOST_AUTO_TEST_CASE(testSurfelLeaf) {
+	IndexPool &pool = SurfelLeaf::getPool() ;
+	size_t used_bytes = pool.getUsedBytes() ;
+	{
+		SurfelLeaf leaf ;
+		for (int i = 0; i < 100 ; i++)
+			leaf.addPointIndex(i) ;
+		BOOST_CHECK_EQUAL(leaf.size(), 100) ;
+		BOOST_CHECK(pool.getUsedBytes() > used_bytes) ;
+
+		//Remove odd indices as the map update does
+		for (size_t i = 0; i < leaf.size() ; i++)
+			if (leaf[i] % 2)
+				leaf[i] = -1 ;
+		int *end_valid = std::remove_if(leaf.begin(), leaf.end(), [](int i) { return i < 0 ; }) ;
+		leaf.resize(end_valid - leaf.begin()) ;
+		BOOST_CHECK_EQUAL(leaf.size(), 50) ;
+		BOOST_CHECK_EQUAL(leaf[49], 98) ;
+
+		//A single index is removed as the eviction does
+		BOOST_CHECK(leaf.removePointIndex(50)) ;
+		BOOST_CHECK(!leaf.removePointIndex(51)) ;
+		BOOST_CHECK_EQUAL(leaf.size(), 49) ;
+		BOOST_CHECK_EQUAL(leaf[25], 52) ;
+		leaf.addPointIndex(50) ;
+
+		SurfelLeaf copy(leaf) ;
+		BOOST_CHECK(copy == leaf) ;
+		leaf.resize(3) ; //Back to the inline storage
+		BOOST_CHECK_EQUAL(leaf[2], 4) ;
+		BOOST_CHECK_EQUAL(copy.size(), 50) ;
+	}
+	BOOST_CHECK_EQUAL(pool.getUsedBytes(), used_bytes) ;
+
+	//Consecutive indices are kept as a range until an index not following it is added
+	{
+		SurfelLeaf leaf ;
+		for (int i = 0; i < 100 ; i++)
+			leaf.addPointIndex(1000 + i) ;
+		BOOST_CHECK(leaf.packRange()) ;
+		BOOST_CHECK_EQUAL(pool.getUsedBytes(), used_bytes) ; //The block is returned to the pool
+		leaf.addPointIndex(1100) ;
+		BOOST_CHECK(leaf.removePointIndex(1000)) ;
+		BOOST_CHECK(leaf.isRange()) ;
+		BOOST_CHECK_EQUAL(leaf.size(), 100) ;
+		BOOST_CHECK_EQUAL(leaf.getIndex(99), 1100) ;
+		std::vector<SurfelIdx> indices ;
+		leaf.getPointIndices(indices) ;
+		BOOST_CHECK_EQUAL(indices.size(), 100) ;
+		BOOST_CHECK_EQUAL(indices[0], 1001) ;
+
+		leaf.addPointIndex(5) ;
+		BOOST_CHECK(!leaf.isRange()) ;
+		BOOST_CHECK_EQUAL(leaf[50], 1051) ;
+		BOOST_CHECK_EQUAL(leaf[100], 5) ;
+		BOOST_CHECK(!leaf.packRange()) ;
+	}
+	BOOST_CHECK_EQUAL(pool.getUsedBytes(), used_bytes) ;
+
+	//Leaves beyond the largest class are allocated from the heap, which is accounted separately from the chunks
+	size_t heap_bytes = pool.getHeapBytes() ;
+	{
+		SurfelLeaf leaf ;
+		uint32_t large = IndexPool::MIN_BLOCK_CAPACITY << IndexPool::CLASS_COUNT ;
+		for (uint32_t i = 0; i < large ; i++)
+			leaf.addPointIndex(i) ;
+		BOOST_CHECK(pool.getHeapBytes() >= heap_bytes + large * sizeof(SurfelIdx)) ;
+		MemoryReport report ;
+		boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(1000, false, camera_params))  ;
+		mapper->getMemoryReport(report) ;
+		BOOST_CHECK(report.leaf_index_bytes >= pool.getReservedBytes() + large * sizeof(SurfelIdx)) ;
+	}
+	BOOST_CHECK_EQUAL(pool.getHeapBytes(), heap_bytes) ;
+}
+
+/**
+ * Boost test case - frustum culling with plane masks gives the same results as the full test
+ */
+BOOST_AUTO_TEST_CASE(testFrustumPlaneMasks) {
+	//Kinect-like projection (as in SurfelMapper::addPointCloudToScene), sensor at the origin
+	double f = 4.05, n = 0.75 ;
+	Eigen::Matrix4d projectionMatrix ;
+	projectionMatrix << 2 * camera_params.alpha / 640, 0.0, 2 * camera_params.cx / 640 - 1.0, 0.0,
+				0.0, 2 * camera_params.beta / 480, 2 * camera_params.cy / 480 - 1.0, 0.0,
+				0.0, 0.0, (f + n) / (f - n), -2 * f * n / (f - n),
+				0.0, 0.0, 1.0, 0.0 ;
+	ViewFrustum frustum ;
+	frustum.set(projectionMatrix) ;
+
+	srand(0) ;
+	for (int i = 0; i < 1000 ; i++) {
+		Eigen::Vector3d min_bb(rand() % 100 / 10.0 - 5.0, rand() % 100 / 10.0 - 5.0, rand() % 100 / 10.0 - 5.0) ;
+		Eigen::Vector3d max_bb = min_bb + Eigen::Vector3d::Constant(0.2 * (1 + rand() % 8)) ;
+		unsigned int plane_mask = ViewFrustum::ALL_PLANES ;
+		int result = frustum.cull(min_bb, max_bb, plane_mask) ;
+		BOOST_CHECK_EQUAL(result, pcl::visualization::cullFrustum(frustum.planes, min_bb, max_bb)) ;
+		if (result == pcl::visualization::PCL_OUTSIDE_FRUSTUM)
+			continue ;
+
+		//Children tested only against the planes crossing the parent
+		Eigen::Vector3d half = (max_bb - min_bb) / 2 ;
+		for (int c = 0; c < 8 ; c++) {
+			Eigen::Vector3d child_min = min_bb + Eigen::Vector3d((c & 1) ? half[0] : 0.0, (c & 2) ? half[1] : 0.0, (c & 4) ? half[2] : 0.0) ;
+			unsigned int child_mask = plane_mask ;
+			BOOST_CHECK_EQUAL(frustum.cull(child_min, child_min + half, child_mask), frustum.cull(child_min, child_min + half)) ;
+		}
+	}
+
+	//Box behind the sensor
+	BOOST_CHECK_EQUAL(frustum.cull(Eigen::Vector3d(-0.5, -0.5, -2.0), Eigen::Vector3d(0.5, 0.5, -1.0)), pcl::visualization::PCL_OUTSIDE_FRUSTUM) ;
+}
+
+/**
+ * Boost test case - occlusion culling does not change the map
+ */
+BOOST_AUTO_TEST_CASE(testOcclusionCulling) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudWall ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	//A wall in front of the surface (seen at the same pixels)
+	cloudWall.reset(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	for (size_t i = 0; i < cloudWall->size() ; i++) {
+		pcl::PointXYZRGB &p = cloudWall->points[i] ;
+		p.x *= 0.5 ; p.y *= 0.5 ; p.z *= 0.5 ;
+	}
+
+	boost::shared_ptr<SurfelMapper> mapperCulling(new SurfelMapper(3e7, false, camera_params))  ;
+	boost::shared_ptr<SurfelMapper> mapperNoCulling(new SurfelMapper(3e7, false, camera_params))  ;
+	mapperNoCulling->setOcclusionCulling(false) ;
+	mapperCulling->setDeltaRecording(true) ;
+	mapperNoCulling->setDeltaRecording(true) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr views[] = { cloud, cloudWall, cloud, cloudWall } ;
+	for (int i = 0; i < 4 ; i++) {
+		mapperCulling->addPointCloudToScene(views[i]) ;
+		mapperNoCulling->addPointCloudToScene(views[i]) ;
+		BOOST_CHECK_EQUAL(mapperCulling->getPointCount(), mapperNoCulling->getPointCount()) ;
+		BOOST_CHECK(mapperCulling->getLastDelta().updated == mapperNoCulling->getLastDelta().updated) ;
+		BOOST_CHECK(mapperCulling->getLastDelta().removed == mapperNoCulling->getLastDelta().removed) ;
+	}
+
+	//Depth bounds of the wall
+	pcl::PointCloud<pcl::PointXYZRGBNormal> scan ;
+	pcl::copyPointCloud(*cloudWall, scan) ;
+	DepthPyramid pyramid ;
+	pyramid.build(scan) ;
+	pyramid.setCamera(Eigen::Matrix4d::Identity(), camera_params.alpha, camera_params.beta, camera_params.cx, camera_params.cy, 0.05) ;
+	Eigen::Vector3d center(cloudWall->at(100, 100).x, cloudWall->at(100, 100).y, 0.0) ;
+	BOOST_CHECK(pyramid.isOccluded(center * 2 + Eigen::Vector3d(-0.1, -0.1, 1.9), center * 2 + Eigen::Vector3d(0.1, 0.1, 2.1))) ;
+	BOOST_CHECK(!pyramid.isOccluded(center + Eigen::Vector3d(-0.1, -0.1, 0.9), center + Eigen::Vector3d(0.1, 0.1, 1.1))) ;
+	BOOST_CHECK(!pyramid.isOccluded(center * 0.5 + Eigen::Vector3d(-0.1, -0.1, 0.4), center * 0.5 + Eigen::Vector3d(0.1, 0.1, 0.6))) ;
+
+	//Valid readings
+	BOOST_CHECK_EQUAL(pyramid.getValidCount(0, 0, 639, 479), 100 * 100) ;
+	BOOST_CHECK_EQUAL(pyramid.getValidCount(140, 140, 159, 159), 10 * 10) ;
+	BOOST_CHECK(pyramid.isOccluded(Eigen::Vector3d(-0.1, -0.1, 1.9), Eigen::Vector3d(0.1, 0.1, 2.1))) ; //Box in the middle of the view projects on invalid readings
+}
+
+/**
+ * Boost test case - converged leaves are frozen and thawed by readings behind their surfels
+ */
+BOOST_AUTO_TEST_CASE(testFreezing) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudBehind ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	//A surface behind the first one (seen at the same pixels)
+	cloudBehind.reset(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	for (size_t i = 0; i < cloudBehind->size() ; i++) {
+		pcl::PointXYZRGB &p = cloudBehind->points[i] ;
+		p.x *= 1.5 ; p.y *= 1.5 ; p.z *= 1.5 ;
+	}
+
+	boost::shared_ptr<SurfelMapper> mapperFreezing(new SurfelMapper(3e7, false, camera_params))  ;
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapperFreezing->setFreezing(true, 3, 0.001) ;
+	mapperFreezing->setDeltaRecording(true) ;
+	mapper->setDeltaRecording(true) ;
+
+	//Surfels reach confidence 3 in the third view, the leaves are frozen after the fourth one
+	for (int i = 0; i < 4 ; i++) {
+		mapperFreezing->addPointCloudToScene(cloud) ;
+		mapper->addPointCloudToScene(cloud) ;
+		BOOST_CHECK(mapperFreezing->getLastDelta().updated == mapper->getLastDelta().updated) ;
+	}
+
+	//Frozen surfels still cover the readings, but are not updated
+	mapperFreezing->addPointCloudToScene(cloud) ;
+	BOOST_CHECK(mapperFreezing->getLastDelta().added.empty()) ;
+	BOOST_CHECK(mapperFreezing->getLastDelta().updated.empty()) ;
+	BOOST_CHECK_EQUAL(mapperFreezing->getPointCount(), mapper->getPointCount()) ;
+
+	//Free space behind the surfels thaws the leaves, unreliable surfels are removed
+	mapperFreezing->addPointCloudToScene(cloudBehind) ;
+	mapper->addPointCloudToScene(cloudBehind) ;
+	BOOST_CHECK(!mapperFreezing->getLastDelta().removed.empty()) ;
+	BOOST_CHECK(mapperFreezing->getLastDelta().removed == mapper->getLastDelta().removed) ;
+	BOOST_CHECK_EQUAL(mapperFreezing->getPointCount(), mapper->getPointCount()) ;
+}
+
+/**
+ * Boost test case - surfels not observed within the active window are skipped by the update
+ */
+BOOST_AUTO_TEST_CASE(testActiveWindow) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudLeft, cloudRight ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	//Views not overlapping the first one
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,-0.7071067811865476,0) ; //Euler 90 0 0
+	transformCloud(cloudRotated, cloudRight) ;
+
+	boost::shared_ptr<SurfelMapper> mapperWindow(new SurfelMapper(3e7, false, camera_params))  ;
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapperWindow->setActiveWindow(2) ;
+	mapperWindow->setDeltaRecording(true) ;
+	mapper->setDeltaRecording(true) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr views[] = { cloud, cloud, cloudLeft, cloudRight } ;
+	for (int i = 0; i < 4 ; i++) {
+		mapperWindow->addPointCloudToScene(views[i]) ;
+		mapper->addPointCloudToScene(views[i]) ;
+		BOOST_CHECK_EQUAL(mapperWindow->getPointCount(), mapper->getPointCount()) ;
+	}
+	size_t startcount = mapper->getPointCount() / 3 ;
+	BOOST_CHECK_EQUAL(mapperWindow->getFrameIndex(), 4u) ;
+	BOOST_CHECK_EQUAL(mapperWindow->getLastObserved(mapperWindow->getLastDelta().added.front()), 4u) ;
+
+	//Surfels of the first view were last observed in the second frame - they are inactive now and the view is mapped anew
+	mapperWindow->addPointCloudToScene(cloud) ;
+	mapper->addPointCloudToScene(cloud) ;
+	BOOST_CHECK_EQUAL(mapperWindow->getLastDelta().added.size(), startcount) ;
+	BOOST_CHECK(mapperWindow->getLastDelta().updated.empty()) ;
+	BOOST_CHECK(mapper->getLastDelta().added.empty()) ;
+	BOOST_CHECK(!mapper->getLastDelta().updated.empty()) ;
+
+	//The new surfels are active, the inactive ones are still in the map
+	mapperWindow->addPointCloudToScene(cloud) ;
+	BOOST_CHECK(mapperWindow->getLastDelta().added.empty()) ;
+	BOOST_CHECK(!mapperWindow->getLastDelta().updated.empty()) ;
+	BOOST_CHECK_EQUAL(mapperWindow->getPointCount(), mapper->getPointCount() + startcount) ;
+}
+
+/**
+ * Boost test case - frames covered by the map are rejected
+ */
+BOOST_AUTO_TEST_CASE(testKeyframeRejection) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudTrans ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapper->setKeyframeRejection(0.5, 8) ;
+	mapper->setDeltaRecording(true) ;
+
+	BOOST_CHECK(mapper->addPointCloudToScene(cloud)) ;
+	size_t startcount = mapper->getPointCount() ;
+	unsigned long seq = mapper->getLastDelta().seq ;
+
+	//The same view adds nothing - the frame is skipped and no delta is started
+	BOOST_CHECK(!mapper->addPointCloudToScene(cloud)) ;
+	BOOST_CHECK_EQUAL(mapper->getRejectedFrameCount(), 1u) ;
+	BOOST_CHECK_EQUAL(mapper->getLastDelta().seq, seq) ;
+	BOOST_CHECK_EQUAL(mapper->getPointCount(), startcount) ;
+
+	//A new view is integrated
+	cloud->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloud, cloudTrans) ;
+	BOOST_CHECK(mapper->addPointCloudToScene(cloudTrans)) ;
+	BOOST_CHECK_EQUAL(mapper->getRejectedFrameCount(), 1u) ;
+	BOOST_CHECK_EQUAL(mapper->getLastDelta().seq, seq + 1) ;
+	BOOST_CHECK_EQUAL(mapper->getPointCount(), startcount * 2) ;
+}
+
+/**
+ * Boost test case - surfels are added at the target spacing
+ */
+BOOST_AUTO_TEST_CASE(testSurfelSpacing) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	boost::shared_ptr<SurfelMapper> mapperSparse(new SurfelMapper(3e7, false, camera_params))  ;
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapperSparse->setSurfelSpacing(0.02) ; //A stride of 3 pixels at 2m
+	mapperSparse->addPointCloudToScene(cloud) ;
+	mapper->addPointCloudToScene(cloud) ;
+
+	size_t pcount = mapperSparse->getPointCount() ;
+	BOOST_CHECK(pcount * 7 < mapper->getPointCount() && pcount * 12 > mapper->getPointCount()) ;
+
+	//Surfels cover the readings skipped
+	std::vector<SurfelIdx> indices ;
+	mapperSparse->getAllIndices(indices) ;
+	float radius = mapper->getSurfel(0).radius ;
+	BOOST_CHECK_CLOSE(mapperSparse->getSurfel(indices[0]).radius, 3 * radius, 1.0) ;
+
+	//Updates keep the radius
+	mapperSparse->addPointCloudToScene(cloud) ;
+	BOOST_CHECK_CLOSE(mapperSparse->getSurfel(indices[0]).radius, 3 * radius, 1.0) ;
+}
+
+/**
+ * Boost test case - readings inside the projected discs of large surfels are covered
+ */
+BOOST_AUTO_TEST_CASE(testSurfelDiscCoverage) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudShifted ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	//The same surface seen from the sensor moved by 1cm (about 2.4 pixels)
+	cloudShifted.reset(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	for (size_t i = 0; i < cloudShifted->size() ; i++)
+		cloudShifted->points[i].x += 0.01 ;
+	cloudShifted->sensor_origin_ << 0.01, 0, 0, 1 ;
+
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapper->setSurfelSpacing(0.02) ; //Surfels of about 2 pixel radius at 2m
+	mapper->setDeltaRecording(true) ;
+	mapper->addPointCloudToScene(cloud) ;
+	size_t startcount = mapper->getPointCount() ;
+
+	//Only the strip of the surface seen for the first time is added
+	mapper->addPointCloudToScene(cloudShifted) ;
+	BOOST_CHECK(!mapper->getLastDelta().updated.empty()) ;
+	BOOST_CHECK(mapper->getLastDelta().added.size() * 5 < startcount) ;
+
+	//Repeated passes do not grow the map
+	size_t count = mapper->getPointCount() ;
+	mapper->addPointCloudToScene(cloud) ;
+	mapper->addPointCloudToScene(cloudShifted) ;
+	BOOST_CHECK_EQUAL(mapper->getPointCount(), count) ;
+}
+
+/**
+ * Boost test case - co-located surfels are merged
+ */
+BOOST_AUTO_TEST_CASE(testConsolidation) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudLeft, cloudRight ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,-0.7071067811865476,0) ; //Euler 90 0 0
+	transformCloud(cloudRotated, cloudRight) ;
+
+	//Revisiting the first view after it became inactive duplicates its surfels
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapper->setActiveWindow(2) ;
+	mapper->setConsolidation(1.0, 0.5, 0.95) ;
+	mapper->setDeltaRecording(true) ;
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr views[] = { cloud, cloud, cloudLeft, cloudRight, cloud } ;
+	for (int i = 0; i < 5 ; i++)
+		mapper->addPointCloudToScene(views[i]) ;
+	size_t startcount = mapper->getPointCount() / 4 ;
+	BOOST_CHECK(mapper->getLastDelta().removed.empty()) ; //Surfels observed in the current frame are not merged
+
+	//Duplicates are merged once they are out of the current frame
+	mapper->addPointCloudToScene(cloudRight) ;
+	const SurfelMapDelta &delta = mapper->getLastDelta() ;
+	BOOST_CHECK_EQUAL(mapper->getPointCount(), startcount * 3) ;
+	BOOST_CHECK_EQUAL(delta.removed.size(), startcount) ;
+	BOOST_CHECK_EQUAL(mapper->getSurfel(delta.updated.back()).count, 3u) ; //Two observations of the first surfel and one of its duplicate
+}
+
+/**
+ * Boost test case - surfels exceeding the budget are evicted according to the policy and their slots are reused
+ */
+BOOST_AUTO_TEST_CASE(testSurfelBudget) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudLeft, cloudRight, cloudBack ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,-0.7071067811865476,0) ; //Euler 90 0 0
+	transformCloud(cloudRotated, cloudRight) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0,0,1,0) ; //Euler 180 0 0
+	transformCloud(cloudRotated, cloudBack) ;
+
+	//The front view is observed twice, so its surfels are more confident but observed earlier than the ones of the left view
+	EvictionPolicy policies[] = { EVICT_LOWEST_CONFIDENCE, EVICT_LEAST_RECENTLY_OBSERVED } ;
+	for (int p = 0; p < 2 ; p++) {
+		boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+		mapper->setDeltaRecording(true) ;
+		mapper->addPointCloudToScene(cloud) ;
+		size_t budget = mapper->getPointCount() * 5 / 2 ;
+		size_t low_water = static_cast<size_t>(budget * 0.8) ;
+		mapper->setSurfelBudget(budget, policies[p], 0.2) ;
+		mapper->addPointCloudToScene(cloud) ;
+		mapper->addPointCloudToScene(cloudLeft) ;
+		BOOST_CHECK(mapper->getLastDelta().removed.empty()) ;
+		size_t count = mapper->getPointCount() ;
+
+		//The right view exceeds the budget
+		mapper->addPointCloudToScene(cloudRight) ;
+		const SurfelMapDelta &delta = mapper->getLastDelta() ;
+		BOOST_CHECK_EQUAL(mapper->getPointCount(), low_water) ;
+		BOOST_CHECK_EQUAL(delta.removed.size(), count + delta.added.size() - low_water) ;
+		std::vector<SurfelIdx> indices ;
+		mapper->getAllIndices(indices) ;
+		BOOST_CHECK_EQUAL(indices.size(), low_water) ;
+		for (size_t i = 0; i < delta.removed.size() ; i++) {
+			uint32_t last_observed = mapper->getLastObserved(delta.removed[i]) ;
+			if (policies[p] == EVICT_LOWEST_CONFIDENCE)
+				BOOST_CHECK_EQUAL(mapper->getSurfel(delta.removed[i]).confidence, 1u) ;
+			else
+				BOOST_CHECK(last_observed <= 2u) ;
+			BOOST_CHECK(last_observed < 4u) ; //Surfels of the current view are kept
+		}
+
+		//Slots of the evicted surfels are filled before the cloud grows
+		size_t nevicted = delta.removed.size() ;
+		size_t cloudsize = mapper->getSceneSize() ;
+		mapper->addPointCloudToScene(cloudBack) ;
+		size_t nadded = mapper->getLastDelta().added.size() ;
+		BOOST_CHECK_EQUAL(mapper->getSceneSize(), cloudsize + (nadded > nevicted ? nadded - nevicted : 0)) ;
+		BOOST_CHECK(mapper->getPointCount() <= budget) ;
+	}
+}
+
+/**
+ * Boost test case - surfels sharing an eviction bucket are evicted in the order of their last observation also for large values and the eviction fraction is clamped
+ */
+BOOST_AUTO_TEST_CASE(testEvictionKeys) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudLeft, cloudRight ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,-0.7071067811865476,0) ; //Euler 90 0 0
+	transformCloud(cloudRotated, cloudRight) ;
+
+	boost::shared_ptr<SceneAccessMapper> mapper(new SceneAccessMapper(3e7, false, camera_params))  ;
+	mapper->setDeltaRecording(true) ;
+	mapper->addPointCloudToScene(cloud) ;
+	size_t nfront = mapper->getPointCount() ;
+	mapper->addPointCloudToScene(cloudLeft) ;
+
+	//Equal confidences in the bucket of the largest powers of two - the older surfels of the front view must go first (the histogram is built by setting the budget)
+	SurfelStorage &scene = mapper->getScene() ;
+	PointCustomSurfel point ;
+	for (size_t i = 0; i < scene.size() ; i++) {
+		scene.load(i, point) ;
+		point.confidence = 1u << 30 ;
+		scene.store(i, point) ;
+	}
+	size_t budget = mapper->getPointCount() + nfront / 2 ;
+	mapper->setSurfelBudget(budget, EVICT_LOWEST_CONFIDENCE, 0.0) ; //Clamped to MIN_EVICTION_FRACTION
+	mapper->addPointCloudToScene(cloudRight) ;
+	const SurfelMapDelta &delta = mapper->getLastDelta() ;
+	BOOST_REQUIRE(!delta.removed.empty()) ;
+	BOOST_CHECK_EQUAL(mapper->getPointCount(), static_cast<size_t>(budget * (1.0 - MIN_EVICTION_FRACTION))) ;
+	for (size_t i = 0; i < delta.removed.size() ; i++)
+		BOOST_CHECK_EQUAL(mapper->getLastObserved(delta.removed[i]), 1u) ;
+}
+
+/**
+ * Boost test case - buckets of the eviction histogram list their surfels in the order of entry and slots are exchanged in place
+ */
+BOOST_AUTO_TEST_CASE(testEvictionHistogram) {
+	EvictionHistogram histogram ;
+	for (SurfelIdx i = 0; i < 6 ; i++)
+		histogram.insert(i, i % 2) ;
+	histogram.update(0, 0) ; //Moved to the tail
+	histogram.update(3, 2) ;
+	histogram.erase(4) ;
+	histogram.erase(4) ;
+	BOOST_CHECK_EQUAL(histogram.size(), 5u) ;
+	BOOST_CHECK_EQUAL(histogram.getCount(1), 2u) ;
+	BOOST_CHECK_EQUAL(histogram.getCount(3), 0u) ;
+
+	//Adjacent slots, a slot outside the histogram and slots of different buckets
+	histogram.swap(2, 0) ;
+	histogram.swap(5, 9) ;
+	histogram.swap(1, 3) ;
+	SurfelIdx expected[3][2] = { { 0, 2 }, { 3, 9 }, { 1, EvictionHistogram::NO_SLOT } } ;
+	for (uint32_t b = 0; b < 3 ; b++) {
+		SurfelIdx idx = histogram.getFirst(b) ;
+		for (size_t i = 0; i < histogram.getCount(b) ; i++) {
+			BOOST_CHECK_EQUAL(idx, expected[b][i]) ;
+			BOOST_CHECK_EQUAL(histogram.getBucket(idx), b) ;
+			idx = histogram.getNext(idx) ;
+		}
+		BOOST_CHECK_EQUAL(idx, EvictionHistogram::NO_SLOT) ;
+	}
+	BOOST_CHECK_EQUAL(histogram.getBucket(5), EvictionHistogram::NO_BUCKET) ;
+	histogram.clear() ;
+	BOOST_CHECK_EQUAL(histogram.getFirst(0), EvictionHistogram::NO_SLOT) ;
+}
+
+/**
+ * Boost test case - the scene storage grows on demand in whole chunks and is recycled on reset
+ */
+BOOST_AUTO_TEST_CASE(testSceneStorage) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	//At most a single chunk is preallocated
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	BOOST_CHECK_EQUAL(mapper->getSceneCapacity(), (size_t) SCENE_CHUNK_SIZE) ;
+	boost::shared_ptr<SurfelMapper> mapperSmall(new SurfelMapper(1000, false, camera_params))  ;
+	BOOST_CHECK_EQUAL(mapperSmall->getSceneCapacity(), (size_t) SCENE_CHUNK_SIZE) ;
+
+	mapperSmall->addPointCloudToScene(cloud) ;
+	BOOST_CHECK_EQUAL(mapperSmall->getSceneCapacity(), (size_t) SCENE_CHUNK_SIZE) ;
+	BOOST_CHECK_EQUAL(mapperSmall->getSceneSize(), mapperSmall->getPointCount()) ;
+
+	//Reset keeps the chunks
+	mapperSmall->resetMap() ;
+	BOOST_CHECK_EQUAL(mapperSmall->getSceneSize(), 0u) ;
+	BOOST_CHECK_EQUAL(mapperSmall->getSceneCapacity(), (size_t) SCENE_CHUNK_SIZE) ;
+	mapperSmall->addPointCloudToScene(cloud) ;
+	BOOST_CHECK_EQUAL(mapperSmall->getSceneCapacity(), (size_t) SCENE_CHUNK_SIZE) ;
+	mapper->addPointCloudToScene(cloud) ;
+	BOOST_CHECK_EQUAL(mapperSmall->getPointCount(), mapper->getPointCount()) ; //The map is built anew
+
+	//Growing the storage adds chunks and does not move the stored surfels
+	ChunkAccessStorage storage ;
+	BOOST_CHECK_EQUAL(storage.capacity(), 0u) ;
+	storage.push_back(mapper->getSurfel(0), 7) ;
+	const void *first = storage.getChunk(0) ;
+	BOOST_CHECK_EQUAL(storage.getChunkCount(), 1u) ;
+	BOOST_CHECK(!storage.reserve(SCENE_CHUNK_SIZE)) ;
+	BOOST_CHECK(storage.reserve(2 * SCENE_CHUNK_SIZE + 1)) ;
+	BOOST_CHECK_EQUAL(storage.getChunkCount(), 3u) ;
+	BOOST_CHECK_EQUAL(storage.getChunk(0), first) ;
+	BOOST_CHECK_EQUAL(storage.lastObserved(0), 7u) ;
+	storage.clear() ;
+	BOOST_CHECK_EQUAL(storage.capacity(), (size_t) 3 * SCENE_CHUNK_SIZE) ;
+}
+
+/**
+ * Boost test case - map tiles far from the sensor are paged out to the disk and back
+ */
+BOOST_AUTO_TEST_CASE(testPaging) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudFar ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudMoved(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudMoved->sensor_origin_ << 100, 0, 0, 1 ;
+	transformCloud(cloudMoved, cloudFar) ;
+
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	mapper->setDeltaRecording(true) ;
+	mapper->setPaging(10.0, 4, "/tmp/surfel_mapper_test_tiles") ;
+	mapper->addPointCloudToScene(cloud) ;
+	size_t viewcount = mapper->getPointCount() ;
+	BOOST_CHECK_EQUAL(mapper->getPagedOutCount(), 0u) ;
+
+	//The first view is left behind
+	mapper->addPointCloudToScene(cloudFar) ;
+	BOOST_CHECK_EQUAL(mapper->getPagedOutCount(), viewcount) ;
+	BOOST_CHECK_EQUAL(mapper->getLastDelta().removed.size(), viewcount) ;
+	size_t farcount = mapper->getPointCount() ;
+
+	//Queries cover the tiles on the disk
+	pcl::PointCloud<PointCustomSurfel> surfels ;
+	mapper->getBoundingBoxSurfels(Eigen::Vector3f(-5, -5, 0), Eigen::Vector3f(5, 5, 5), surfels) ;
+	BOOST_CHECK_EQUAL(surfels.size(), viewcount) ;
+	surfels.clear() ;
+	mapper->getAllSurfels(surfels) ;
+	BOOST_CHECK_EQUAL(surfels.size(), viewcount + farcount) ;
+
+	//Returning to the first view brings its tiles back before the update (no duplicates are added)
+	mapper->addPointCloudToScene(cloud) ;
+	BOOST_CHECK_EQUAL(mapper->getLastDelta().added.size(), viewcount) ;
+	BOOST_CHECK_EQUAL(mapper->getPagedOutCount(), farcount) ;
+	BOOST_CHECK_EQUAL(mapper->getPointCount(), viewcount) ;
+	surfels.clear() ;
+	mapper->getAllSurfels(surfels) ;
+	BOOST_CHECK_EQUAL(surfels.size(), viewcount + farcount) ;
+
+	mapper->resetMap() ;
+	BOOST_CHECK_EQUAL(mapper->getPagedOutCount(), 0u) ;
+
+	//A radius within the sensor range is raised, so the surfels in the range are not paged out when the sensor turns away
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudBack ;
+	cloudMoved->sensor_origin_ << 0, 0, -0.2, 1 ; //Moved enough to trigger a paging pass
+	cloudMoved->sensor_orientation_ = Eigen::Quaternionf(0,0,1,0) ; //Euler 180 0 0
+	transformCloud(cloudMoved, cloudBack) ;
+	mapper->setPaging(0.5, 0, "/tmp/surfel_mapper_test_tiles") ;
+	mapper->addPointCloudToScene(cloud) ;
+	mapper->addPointCloudToScene(cloudBack) ;
+	BOOST_CHECK_EQUAL(mapper->getPagedOutCount(), 0u) ;
+}
+
+/**
+ * Boost test case - surfels paged back in keep their age, so the least recently observed ones are still evicted first
+ */
+BOOST_AUTO_TEST_CASE(testPagingEviction) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudFar, cloudBack, cloudLeft ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudMoved(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudMoved->sensor_origin_ << 100, 0, 0, 1 ;
+	transformCloud(cloudMoved, cloudFar) ;
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0,0,1,0) ; //Euler 180 0 0
+	transformCloud(cloudRotated, cloudBack) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+
+	bool compact[] = { false, true } ;
+	for (int c = 0; c < 2 ; c++) {
+		boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+		mapper->setDeltaRecording(true) ;
+		mapper->setPaging(10.0, 4, "/tmp/surfel_mapper_test_tiles", compact[c]) ;
+		mapper->addPointCloudToScene(cloud) ;
+		size_t nfront = mapper->getPointCount() ;
+		mapper->addPointCloudToScene(cloudFar) ;
+		BOOST_CHECK_EQUAL(mapper->getPagedOutCount(), nfront) ;
+
+		//The front view is paged back in without being observed - it keeps the frame of its last observation
+		mapper->addPointCloudToScene(cloudBack) ;
+		const SurfelMapDelta &delta = mapper->getLastDelta() ;
+		size_t npaged = 0 ;
+		for (size_t i = 0; i < delta.added.size() ; i++)
+			if (mapper->getLastObserved(delta.added[i]) == 1u)
+				npaged++ ;
+		BOOST_CHECK_EQUAL(npaged, nfront) ;
+
+		//The front view is the least recently observed one, so it is evicted first
+		size_t budget = mapper->getPointCount() + nfront / 2 ;
+		mapper->setSurfelBudget(budget, EVICT_LEAST_RECENTLY_OBSERVED, 0.1) ;
+		mapper->addPointCloudToScene(cloudLeft) ;
+		BOOST_REQUIRE(!delta.removed.empty()) ;
+		BOOST_CHECK(delta.removed.size() < nfront) ;
+		for (size_t i = 0; i < delta.removed.size() ; i++)
+			BOOST_CHECK_EQUAL(mapper->getLastObserved(delta.removed[i]), 1u) ;
+		BOOST_CHECK(mapper->getPointCount() <= budget) ;
+	}
+}
+
+/**
+ * Boost test case - surfel indices use the full range of the index type configured at build time
+ */
+BOOST_AUTO_TEST_CASE(testSurfelIndexWidth) {
+	//Leaves keep the same footprint for both index widths
+	BOOST_CHECK_EQUAL(SurfelLeaf::INLINE_CAPACITY * sizeof(SurfelIdx), 24u) ;
+
+	//The largest indices survive both the inline and the pooled storage
+	const SurfelIdx max_idx = std::numeric_limits<SurfelIdx>::max() ;
+	SurfelLeaf leaf ;
+	for (SurfelIdx i = 0; i < 100 ; i++)
+		leaf.addPointIndex(max_idx - i) ;
+	std::vector<SurfelIdx> indices ;
+	leaf.getPointIndices(indices) ;
+	BOOST_REQUIRE_EQUAL(indices.size(), 100u) ;
+	for (size_t i = 0; i < indices.size() ; i++)
+		BOOST_CHECK_EQUAL(indices[i], max_idx - static_cast<SurfelIdx>(i)) ;
+
+	//The PCL octree limits the map to int indices, the voxel-block index to the index type
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	BOOST_CHECK_EQUAL(mapper->getMaxSceneSize(), static_cast<size_t>(std::numeric_limits<int>::max())) ;
+	mapper->setSpatialIndex(SPATIAL_INDEX_VOXEL_BLOCKS) ;
+	BOOST_CHECK_EQUAL(mapper->getMaxSceneSize(), static_cast<size_t>(max_idx)) ;
+}
+
+/**
+ * Boost test case - quantized surfels are decoded within the quantization error and tiles stored quantized are read back
+ */
+BOOST_AUTO_TEST_CASE(testCompactSurfel) {
+	BOOST_CHECK_EQUAL(sizeof(CompactSurfel), 20u) ;
+
+	SurfelTileCache cache("/tmp/surfel_mapper_test_tiles", 6.4, true) ;
+	TileKey key = { -1, 0, 2 } ;
+	Eigen::Vector3f origin(-6.4f, 0.0f, 12.8f) ;
+	pcl::PointCloud<PointCustomSurfel> surfels ;
+	srand(0) ;
+	for (int i = 0; i < 1000 ; i++) {
+		PointCustomSurfel p ;
+		p.getVector3fMap() = origin + Eigen::Vector3f::Random().cwiseAbs() * 6.4f ;
+		p.getNormalVector3fMap() = Eigen::Vector3f::Random().normalized() ;
+		p.rgba = i ;
+		p.radius = 0.001 + rand() % 1000 / 10000.0 ;
+		p.confidence = i * 100 ;
+		p.count = i ;
+		surfels.push_back(p) ;
+	}
+
+	CompactSurfel compact ;
+	PointCustomSurfel decoded ;
+	for (size_t i = 0; i < surfels.size() ; i++) {
+		encodeSurfel(surfels[i], origin, 6.4, compact) ;
+		decodeSurfel(compact, origin, 6.4, decoded) ;
+		BOOST_CHECK_SMALL((decoded.getVector3fMap() - surfels[i].getVector3fMap()).cwiseAbs().maxCoeff(), 1e-4f) ;
+		BOOST_CHECK_GT(decoded.getNormalVector3fMap().dot(surfels[i].getNormalVector3fMap()), 0.99999) ;
+		BOOST_CHECK_CLOSE(decoded.radius, surfels[i].radius, 0.1) ;
+		BOOST_CHECK_EQUAL(decoded.rgba, surfels[i].rgba) ;
+		BOOST_CHECK_EQUAL(decoded.confidence, std::min(surfels[i].confidence, 65535u)) ;
+		BOOST_CHECK_EQUAL(decoded.count, surfels[i].count) ;
+	}
+
+	std::vector<uint32_t> last_observed(surfels.size()) ;
+	for (size_t i = 0; i < last_observed.size() ; i++)
+		last_observed[i] = 0xfffff000u + i ;
+	BOOST_CHECK(cache.store(key, surfels, last_observed)) ;
+	pcl::PointCloud<PointCustomSurfel> taken ;
+	std::vector<uint32_t> taken_last_observed ;
+	BOOST_CHECK(cache.take(key, taken, taken_last_observed)) ;
+	BOOST_REQUIRE_EQUAL(taken.size(), surfels.size()) ;
+	BOOST_REQUIRE_EQUAL(taken_last_observed.size(), surfels.size()) ;
+	for (size_t i = 0; i < surfels.size() ; i++) {
+		BOOST_CHECK_SMALL((taken[i].getVector3fMap() - surfels[i].getVector3fMap()).cwiseAbs().maxCoeff(), 1e-4f) ;
+		BOOST_CHECK_EQUAL(taken_last_observed[i], last_observed[i]) ;
+	}
+
+	//A truncated tile file is not taken (the tile stays paged out)
+	const char *directory = "/tmp/surfel_mapper_test_truncated" ;
+	SurfelTileCache truncatedCache(directory, 6.4, false) ;
+	BOOST_CHECK(truncatedCache.store(key, surfels, last_observed)) ;
+	DIR *dir = opendir(directory) ;
+	BOOST_REQUIRE(dir) ;
+	for (struct dirent *entry = readdir(dir); entry ; entry = readdir(dir))
+		if (entry->d_name[0] != '.')
+			BOOST_CHECK_EQUAL(truncate((std::string(directory) + "/" + entry->d_name).c_str(), 100), 0) ;
+	closedir(dir) ;
+	taken.clear() ;
+	taken_last_observed.clear() ;
+	BOOST_CHECK(!truncatedCache.take(key, taken, taken_last_observed)) ;
+	BOOST_CHECK(taken.empty()) ;
+	BOOST_CHECK_EQUAL(truncatedCache.getSurfelCount(), surfels.size()) ;
+	std::vector<TileKey> keys ;
+	truncatedCache.getTiles(keys) ;
+	BOOST_CHECK_EQUAL(keys.size(), 1u) ;
+}
+
+/**
+ * Boost test case - the scene storage in the compact mode keeps surfels within the quantization error and the map is built as with full surfels
+ */
+BOOST_AUTO_TEST_CASE(testCompactScene) {
+	BOOST_CHECK_EQUAL(sizeof(PackedSurfel), 22u) ;
+
+	//Packed surfels (negative coordinates included)
+	SurfelStorage storage ;
+	storage.setCompact(true) ;
+	srand(0) ;
+	std::vector<PointCustomSurfel, Eigen::aligned_allocator<PointCustomSurfel> > surfels ;
+	for (int i = 0; i < 1000 ; i++) {
+		PointCustomSurfel p ;
+		p.getVector3fMap() = Eigen::Vector3f::Random() * 500.0f ;
+		p.getNormalVector3fMap() = Eigen::Vector3f::Random().normalized() ;
+		p.rgba = i ;
+		p.radius = 0.001 + rand() % 1000 / 10000.0 ;
+		p.confidence = i * 100 ;
+		p.count = i ;
+		BOOST_CHECK(storage.canStore(p)) ;
+		storage.push_back(p, i) ;
+		surfels.push_back(p) ;
+	}
+	PointCustomSurfel decoded ;
+	for (size_t i = 0; i < surfels.size() ; i++) {
+		storage.load(i, decoded) ;
+		BOOST_CHECK_SMALL((decoded.getVector3fMap() - surfels[i].getVector3fMap()).cwiseAbs().maxCoeff(), 0.5f * PACKED_POSITION_STEP + 1e-4f) ;
+		BOOST_CHECK((storage.getPosition(i) - decoded.getVector3fMap()).isZero()) ;
+		BOOST_CHECK_GT(decoded.getNormalVector3fMap().dot(surfels[i].getNormalVector3fMap()), 0.99999) ;
+		BOOST_CHECK_CLOSE(decoded.radius, surfels[i].radius, 0.1) ;
+		BOOST_CHECK_EQUAL(decoded.rgba, surfels[i].rgba) ;
+		BOOST_CHECK_EQUAL(decoded.confidence, std::min(surfels[i].confidence, 65535u)) ;
+		BOOST_CHECK_EQUAL(storage.lastObserved(i), static_cast<uint32_t>(i)) ;
+	}
+	PointCustomSurfel distant = surfels[0] ;
+	distant.y = -600.0f ;
+	BOOST_CHECK(!storage.canStore(distant)) ;
+
+	//Removal and moves between slots
+	storage.remove(1) ;
+	BOOST_CHECK(!storage.isFinite(1)) ;
+	storage.load(1, decoded) ;
+	BOOST_CHECK(!pcl::isFinite(decoded)) ;
+	storage.move(1, 2) ;
+	BOOST_CHECK(storage.isFinite(1) && !storage.isFinite(2)) ;
+	BOOST_CHECK_EQUAL(storage.get(1).rgba, surfels[2].rgba) ;
+	BOOST_CHECK_EQUAL(storage.lastObserved(1), 2u) ;
+
+	//Conversion back to full surfels keeps the decoded values
+	storage.setCompact(false) ;
+	BOOST_CHECK(!storage.isFinite(2)) ;
+	BOOST_CHECK_EQUAL(storage.get(3).rgba, surfels[3].rgba) ;
+	BOOST_CHECK_SMALL((storage.getPosition(3) - surfels[3].getVector3fMap()).cwiseAbs().maxCoeff(), 0.5f * PACKED_POSITION_STEP + 1e-4f) ;
+
+	//The same map from full and packed surfels
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudLeft ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+
+	boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+	boost::shared_ptr<SurfelMapper> mapperCompact(new SurfelMapper(3e7, false, camera_params))  ;
+	mapperCompact->setCompactScene(true) ;
+	for (int i = 0; i < 3 ; i++) {
+		mapper->addPointCloudToScene(i == 1 ? cloudLeft : cloud) ;
+		mapperCompact->addPointCloudToScene(i == 1 ? cloudLeft : cloud) ;
+	}
+	BOOST_CHECK_CLOSE((double) mapperCompact->getPointCount(), (double) mapper->getPointCount(), 1.0) ;
+	MemoryReport report, reportCompact ;
+	mapper->getMemoryReport(report) ;
+	mapperCompact->getMemoryReport(reportCompact) ;
+	BOOST_CHECK_LT(reportCompact.surfel_bytes * 2.5, report.surfel_bytes) ;
+
+	//Surfels are expanded when retrieved
+	std::vector<SurfelIdx> indices ;
+	mapperCompact->getAllIndices(indices) ;
+	pcl::PointCloud<PointCustomSurfel> expanded ;
+	mapperCompact->getSurfels(indices, expanded) ;
+	BOOST_CHECK_EQUAL(expanded.size(), mapperCompact->getPointCount()) ;
+	for (size_t i = 0; i < expanded.size() ; i++)
+		BOOST_CHECK(pcl::isFinite(expanded[i])) ;
+}
+
+/**
+ * Applies the last map delta to the copy of the map kept by a delta consumer
+ *
+ * @param mapper surfel mapper
+ * @param mirror copy of the map (surfels by their indices)
+ */
+void applyLastDelta(boost::shared_ptr<SurfelMapper> &mapper, std::map<SurfelIdx, PointCustomSurfel> &mirror) {
+	const SurfelMapDelta &delta = mapper->getLastDelta() ;
+	for (size_t i = 0; i < delta.removed.size() ; i++)
+		BOOST_CHECK_EQUAL(mirror.erase(delta.removed[i]), 1u) ;
+	for (size_t i = 0; i < delta.updated.size() ; i++) {
+		BOOST_CHECK(mirror.count(delta.updated[i])) ;
+		mirror[delta.updated[i]] = mapper->getSurfel(delta.updated[i]) ;
+	}
+	for (size_t i = 0; i < delta.added.size() ; i++) {
+		BOOST_CHECK(!mirror.count(delta.added[i])) ;
+		mirror[delta.added[i]] = mapper->getSurfel(delta.added[i]) ;
+	}
+}
+
+/**
+ * Checks that the copy of the map kept by a delta consumer matches the map
+ *
+ * @param mapper surfel mapper
+ * @param mirror copy of the map (surfels by their indices)
+ */
+void checkMirror(boost::shared_ptr<SurfelMapper> &mapper, const std::map<SurfelIdx, PointCustomSurfel> &mirror) {
+	BOOST_CHECK_EQUAL(mirror.size(), mapper->getPointCount()) ;
+	for (std::map<SurfelIdx, PointCustomSurfel>::const_iterator it = mirror.begin(); it != mirror.end() ; it++) {
+		BOOST_REQUIRE((size_t) it->first < mapper->getSceneSize()) ;
+		BOOST_CHECK(it->second.getVector3fMap() == mapper->getSurfel(it->first).getVector3fMap()) ;
+	}
+}
+
+/**
+ * Boost test case - reordering packs surfels of each leaf in the Morton order and the map delta follows the moved surfels
+ */
+BOOST_AUTO_TEST_CASE(testReordering) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudLeft, cloudRight ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,-0.7071067811865476,0) ; //Euler 90 0 0
+	transformCloud(cloudRotated, cloudRight) ;
+
+	SpatialIndexType index_types[] = { SPATIAL_INDEX_OCTREE, SPATIAL_INDEX_VOXEL_BLOCKS } ;
+	for (int t = 0; t < 2 ; t++) {
+		boost::shared_ptr<SceneAccessMapper> accessMapper(new SceneAccessMapper(3e7, false, camera_params))  ;
+		boost::shared_ptr<SurfelMapper> mapper(accessMapper) ;
+		mapper->setSpatialIndex(index_types[t]) ;
+		mapper->setDeltaRecording(true) ;
+		std::map<SurfelIdx, PointCustomSurfel> mirror ;
+
+		//Evictions leave holes in the cloud
+		mapper->addPointCloudToScene(cloud) ;
+		applyLastDelta(mapper, mirror) ;
+		mapper->setSurfelBudget(mapper->getPointCount() * 3 / 2, EVICT_LOWEST_CONFIDENCE, 0.2) ;
+		mapper->addPointCloudToScene(cloudLeft) ;
+		applyLastDelta(mapper, mirror) ;
+		BOOST_REQUIRE(!mapper->getLastDelta().removed.empty()) ;
+		mapper->setSurfelBudget(0, EVICT_LOWEST_CONFIDENCE, 0.2) ;
+
+		//A pass spread over keyframes (a single leaf per keyframe)
+		mapper->setReordering(1, 0.0) ;
+		int nframes = 0 ;
+		do {
+			mapper->addPointCloudToScene(nframes % 2 ? cloud : cloudRight) ;
+			applyLastDelta(mapper, mirror) ;
+			checkMirror(mapper, mirror) ;
+			nframes++ ;
+		} while (mapper->isReordering() && nframes < 1000) ;
+		BOOST_CHECK(nframes > 1) ;
+		BOOST_CHECK(!mapper->isReordering()) ;
+
+		//The pass is finished within the keyframe
+		mapper->setReordering(1, 10.0) ;
+		mapper->addPointCloudToScene(cloudLeft) ;
+		applyLastDelta(mapper, mirror) ;
+		checkMirror(mapper, mirror) ;
+		BOOST_CHECK(!mapper->isReordering()) ;
+		BOOST_CHECK_EQUAL(mapper->getSceneSize(), mapper->getPointCount()) ;
+		std::vector<SurfelIdx> indices ;
+		mapper->getOrderedIndices(indices) ; //Each leaf is a contiguous range and the ranges follow the Morton order
+		BOOST_CHECK_EQUAL(indices.size(), mapper->getPointCount()) ;
+		for (size_t i = 0; i < indices.size() ; i++)
+			BOOST_CHECK_EQUAL(indices[i], static_cast<SurfelIdx>(i)) ;
+
+		//Leaves keep only their ranges, the next update reads them sequentially
+		std::vector<SurfelLeaf*> leaves ;
+		accessMapper->getSpatialIndex().getLeaves(leaves) ;
+		for (size_t l = 0; l < leaves.size() ; l++)
+			BOOST_CHECK(leaves[l]->empty() || leaves[l]->isRange()) ;
+		mapper->addPointCloudToScene(cloudLeft) ;
+		applyLastDelta(mapper, mirror) ;
+		checkMirror(mapper, mirror) ;
+	}
+}
+
+/**
+ * Boost test case - the memory report follows the map without traversing it
+ */
+BOOST_AUTO_TEST_CASE(testMemoryReport) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, cloudLeft ;
+	constructPointCloud(cloud) ;
+	cloud->sensor_origin_ << 0, 0, 0, 1 ;
+	cloud->sensor_orientation_ = Eigen::Quaternionf(1,0,0,0) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudRotated(new pcl::PointCloud<pcl::PointXYZRGB>(*cloud)) ;
+	cloudRotated->sensor_orientation_ = Eigen::Quaternionf(0.70710678118654760,0,0.7071067811865476,0) ; //Euler -90 0 0
+	transformCloud(cloudRotated, cloudLeft) ;
+
+	SpatialIndexType index_types[] = { SPATIAL_INDEX_OCTREE, SPATIAL_INDEX_VOXEL_BLOCKS } ;
+	for (int t = 0; t < 2 ; t++) {
+		boost::shared_ptr<SurfelMapper> mapper(new SurfelMapper(3e7, false, camera_params))  ;
+		mapper->setSpatialIndex(index_types[t]) ;
+		mapper->addPointCloudToScene(cloud) ;
+		mapper->setSurfelBudget(mapper->getPointCount() * 3 / 2, EVICT_LOWEST_CONFIDENCE, 0.2) ;
+		mapper->addPointCloudToScene(cloudLeft) ;
+
+		MemoryReport report ;
+		mapper->getMemoryReport(report) ;
+		BOOST_CHECK_EQUAL(report.live_surfels, mapper->getPointCount()) ;
+		BOOST_CHECK_EQUAL(report.live_surfels + report.dead_surfels, mapper->getSceneSize()) ;
+		BOOST_CHECK(report.dead_surfels > 0) ; //Evicted surfels
+		BOOST_CHECK(report.surfel_bytes >= mapper->getSceneSize() * sizeof(PointCustomSurfel)) ;
+		BOOST_CHECK(report.preview_bytes >= mapper->getCloudSceneDownsampled()->size() * sizeof(pcl::PointXYZRGB)) ;
+		BOOST_CHECK(report.scratch_bytes >= 2 * 640 * 480 * sizeof(pcl::PointXYZRGBNormal)) ;
+
+		//Node counts are the same as found by the traversal
+		std::vector<SurfelIdx> indices ;
+		mapper->getAllIndices(indices) ;
+		BOOST_CHECK_EQUAL(indices.size(), report.live_surfels) ;
+		BOOST_CHECK(report.leaf_count > 0 && report.branch_count > 0) ;
+		BOOST_CHECK(report.leaf_bytes >= report.leaf_count * sizeof(SurfelLeaf)) ;
+		BOOST_CHECK_EQUAL(report.getTotalBytes(), report.surfel_bytes + report.slot_list_bytes + report.branch_bytes + report.leaf_bytes + 
+				report.leaf_index_bytes + report.preview_bytes + report.scratch_bytes) ;
+	}
+
+	//Leaf counts of both indices
+	SurfelStorage surfels ;
+	PointCustomSurfel p ;
+	p.rgba = 0u ;
+	for (int i = 0; i < 20 ; i++) {
+		p.x = 0.1 * i ;
+		p.y = 0.05 * i ;
+		p.z = 2.0 ;
+		surfels.push_back(p, 0) ;
+	}
+	OctreeSurfelIndex octreeIndex(0.2) ;
+	VoxelBlockSurfelIndex blockIndex(0.2) ;
+	SurfelIndex *indexes[] = { &octreeIndex, &blockIndex } ;
+	for (int t = 0; t < 2 ; t++) {
+		indexes[t]->setInputStorage(&surfels) ;
+		indexes[t]->addPointsFromInputStorage() ;
+		std::vector<SurfelLeaf*> leaves ;
+		indexes[t]->getLeaves(leaves) ;
+		IndexMemoryUsage usage ;
+		indexes[t]->getMemoryUsage(usage) ;
+		BOOST_CHECK_EQUAL(usage.leaf_count, leaves.size()) ;
+	}
+}
+
+/**
+ * Boost test case - visible leaves found with the cut reused between frames are the same as found by the traversal from the root
+ */
+BOOST_AUTO_TEST_CASE(testFrustumCoherence) {
+	SurfelStorage storage ;
+	PointCustomSurfel p ;
+	p.rgba = 0u ;
+	srand(0) ;
+	for (int i = 0; i < 5000 ; i++) {
+		p.x = rand() % 1000 / 100.0 - 5.0 ;
+		p.y = rand() % 1000 / 100.0 - 5.0 ;
+		p.z = rand() % 1000 / 100.0 - 5.0 ;
+		storage.push_back(p, 0) ;
+	}
+	OctreeSurfelIndex indexCut(0.2), indexFull(0.2) ; //Both indices refer to the same storage
+	indexCut.setInputStorage(&storage) ;
+	indexCut.addPointsFromInputStorage() ;
+	indexFull.setInputStorage(&storage) ;
+	indexFull.addPointsFromInputStorage() ;
+
+	double f = 4.05, n = 0.75 ;
+	Eigen::Matrix4d projectionMatrix ;
+	projectionMatrix << 2 * camera_params.alpha / 640, 0.0, 2 * camera_params.cx / 640 - 1.0, 0.0,
+				0.0, 2 * camera_params.beta / 480, 2 * camera_params.cy / 480 - 1.0, 0.0,
+				0.0, 0.0, (f + n) / (f - n), -2 * f * n / (f - n),
+				0.0, 0.0, 1.0, 0.0 ;
+
+	//The sensor turns and moves slowly, new points appear in the meantime
+	for (int frame = 0; frame < 50 ; frame++) {
+		Eigen::Matrix4d viewMatrix = Eigen::Matrix4d::Identity() ;
+		viewMatrix.topLeftCorner<3, 3>() = Eigen::AngleAxisd(0.01 * frame, Eigen::Vector3d::UnitY()).toRotationMatrix() ;
+		viewMatrix.topRightCorner<3, 1>() = Eigen::Vector3d(0.0, 0.0, -0.02 * frame) ;
+		ViewFrustum frustumCut ;
+		frustumCut.set(projectionMatrix * viewMatrix) ;
+		frustumCut.setPose(viewMatrix) ;
+		ViewFrustum frustumFull = frustumCut ;
+		frustumFull.pose_valid = false ;
+
+		if (frame % 10 == 5) {
+			p.x = p.y = 0.1 * frame - 5.0 ;
+			p.z = 2.0 ;
+			storage.push_back(p, 0) ;
+			indexCut.addPointFromStorage(storage.size() - 1) ;
+			indexFull.addPointFromStorage(storage.size() - 1) ;
+		}
+
+		std::vector<SurfelLeaf*> leavesCut, leavesFull ;
+		indexCut.getVisibleLeaves(frustumCut, leavesCut) ;
+		indexFull.getVisibleLeaves(frustumFull, leavesFull) ;
+		BOOST_REQUIRE_EQUAL(leavesCut.size(), leavesFull.size()) ;
+		for (size_t i = 0; i < leavesCut.size() ; i++)
+			BOOST_CHECK(*leavesCut[i] == *leavesFull[i]) ;
+	}
+}
+
+/**
+ * Boost test case - compression and decompression of a preview-like cloud
+ */
+BOOST_AUTO_TEST_CASE(testCloudCompression) {
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>) ;
+	for (int i = 0; i < 20 ; i++)
+		for (int j = 0; j < 20 ; j++) {
+			pcl::PointXYZRGB p ;
+			p.x = i * 0.2f ; p.y = j * 0.2f ; p.z = 2.0f ;
+			p.r = p.g = p.b = 100 ;
+			cloud->push_back(p) ;
+		}
+
+	CloudCompression compression(0.005, 0.05, 6) ;
+	std::vector<uint8_t> data ;
+	compression.encode(cloud, data) ;
+	BOOST_CHECK(data.size() < cloud->size() * sizeof(pcl::PointXYZRGB)) ;
+
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudDecoded ;
+	CloudCompression::decode(data, cloudDecoded) ;
+	BOOST_REQUIRE_EQUAL(cloudDecoded->size(), cloud->size()) ;
+
+	//Points are reordered by the coder - compare the bounds only
+	Eigen::Vector4f min_pt, max_pt ;
+	pcl::getMinMax3D(*cloudDecoded, min_pt, max_pt) ;
+	BOOST_CHECK(fabs(min_pt[0]) < 0.01 && fabs(max_pt[0] - 3.8) < 0.01) ;
+}
+
 /*int main() {
 	testAddPointCloud() ;
 	testAddSingleViewpoint() ;
@@ -0,0 +1,60 @@
+/**
+ *  @file compressed_cloud_decoder_node.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ * 
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "ros/ros.h"
+#include "sensor_msgs/PointCloud2.h"
+#include "pcl_conversions/pcl_conversions.h"
+#include "cloud_compression.hpp"
+#include "surfel_mapper/CompressedCloud.h"
+
+ros::Publisher cloud_pub ; /**< @brief decoded cloud publisher */
+
+/**
+ * @brief Callback for the incoming compressed cloud message
+ *
+ * Decodes the cloud and republishes it as a plain PointCloud2 message
+ *
+ * @param msg incoming compressed cloud message
+ */
+void compressedCloudCallback(const surfel_mapper::CompressedCloud::ConstPtr &msg)
+{
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>) ;
+	CloudCompression::decode(msg->data, cloud) ;
+
+	pcl::PCLPointCloud2 pcl_pc2;
+	pcl::toPCLPointCloud2(*cloud, pcl_pc2) ;
+	sensor_msgs::PointCloud2 cloud_msg ;
+	pcl_conversions::fromPCL(pcl_pc2, cloud_msg) ;
+	cloud_msg.header = msg->header ;
+
+	ROS_DEBUG("Decoded cloud: [%d] bytes -> [%d] points", (int) msg->data.size(), (int) cloud->size()) ;
+	cloud_pub.publish(cloud_msg) ;
+}
+
+/**
+ * @brief Main program function 
+ *
+ * @param argc program argument count 
+ * @param argv program argument values 
+ *
+ * @return 0 on correct exit, 1 on failure
+ */
+int main(int argc, char **argv)
+{
+	ros::init(argc, argv, "compressed_cloud_decoder");
+	ros::NodeHandle n ;
+
+	ros::Subscriber sub_compressed = n.subscribe("compressed_cloud", 5, compressedCloudCallback);
+	cloud_pub = n.advertise<sensor_msgs::PointCloud2>("cloud", 5, true);
+
+	ros::spin() ;
+
+	return 0;
+}
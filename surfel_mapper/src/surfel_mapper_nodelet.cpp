@@ -0,0 +1,621 @@
+/**
+ *  @file surfel_mapper_nodelet.cpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ * 
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#include "surfel_mapper_nodelet.hpp"
+#include <pluginlib/class_list_macros.h>
+#include "sensor_msgs/point_cloud2_iterator.h"
+#include "pcl_conversions/pcl_conversions.h"
+#include "pcl/common/point_tests.h"
+#include "pcl/common/io.h"
+#include "pcl/filters/filter.h"
+#include <limits.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+
+namespace surfel_mapper {
+
+//ccny_rgbd uses timestamps for keyframes compatible with rgb camera, but odometry path is time stamped anew (so it can be actually some microseconds later than keyframe
+//simple workaround is to round time stamps to miliseconds.TODO: possibly some patch to ccny_rgbd could be proposed?
+
+ros::Time roundTimeStamp(const ros::Time &time_stamp)
+{
+	ros::Time rounded_time_stamp = time_stamp ;
+	uint32_t time_stamp_nsec_mod = time_stamp.nsec % 1000000l ;   
+	rounded_time_stamp.nsec -= time_stamp_nsec_mod ; //Results in full milliseconds contained in the timestamp 
+		if (time_stamp_nsec_mod > 500000l) { //If the remainder was grater than 0.5 millisecond
+			rounded_time_stamp.nsec += 1000000l ; //Round up to the full milisecond
+			if (rounded_time_stamp.nsec == 1000000000l) { //And if after addition we hit a full second (should not overflow on int32)
+				rounded_time_stamp.sec++ ;
+				rounded_time_stamp.nsec = 0l ;
+			}
+		}
+	return rounded_time_stamp ;
+}
+
+bool SurfelMapperNodelet::getSensorPosition(const ros::Time &time_stamp, SensorPose &sensor_pose)
+{
+	ros::Time time_stamp_rounded = roundTimeStamp(time_stamp) ;	
+	if (!current_path) {
+		ROS_WARN("No odometry path message available!") ;
+		return false ;
+	} else if (current_path->poses.empty()) {
+		ROS_WARN("Empty list of poses in odometry path message") ;
+		return false ;
+	} else if (roundTimeStamp(current_path->poses.front().header.stamp) > time_stamp_rounded || roundTimeStamp(current_path->poses.back().header.stamp) < time_stamp_rounded) {
+		ROS_WARN("Odometry path message does not contain pose corresponding with the keyframe. Keyframe timestamp (rounded) [%d.%d]. Odometry timestamps (rounded) [%d.%d]-[%d.%d]", 
+				time_stamp_rounded.sec, time_stamp_rounded.nsec, roundTimeStamp(current_path->poses.front().header.stamp).sec, roundTimeStamp(current_path->poses.front().header.stamp).nsec, 
+				roundTimeStamp(current_path->poses.back().header.stamp).sec, roundTimeStamp(current_path->poses.back().header.stamp).nsec) ;
+		return false ;
+	} else {
+		//Search by bi-section
+		size_t i, j, k ;
+		i = 0 ; j = current_path->poses.size() - 1 ;
+		while (i + 1 < j) {
+			k = (i + j) / 2 ;
+			if (roundTimeStamp(current_path->poses[k].header.stamp) <= time_stamp_rounded)
+				i = k ;
+			else
+				j = k ;
+		}
+
+		//Find closest match (nearest neighbor)	
+		ros::Duration duri = roundTimeStamp(time_stamp) - roundTimeStamp(current_path->poses[i].header.stamp) ;
+		ros::Duration durj = roundTimeStamp(current_path->poses[j].header.stamp) - roundTimeStamp(time_stamp) ;
+		if (duri < durj)
+			k = i ;
+		else
+			k = j ;
+
+		geometry_msgs::PoseStamped pose_stamped = current_path->poses[k] ;
+		//ROS_INFO("Stamp found for k = %ld (out of %ld), number of steps [%ld]", k, current_path->poses.size(), steps) ;
+		//ROS_INFO("search time stamp [%d,%d], found time stamp [%d,%d]", time_stamp.sec, time_stamp.nsec, current_path->poses[i].header.stamp.sec, current_path->poses[i].header.stamp.nsec) ;
+		//ROS_INFO("search time stamp [%d,%d], found time stamp [%d,%d]", time_stamp.sec, time_stamp.nsec, current_path->poses[j].header.stamp.sec, current_path->poses[j].header.stamp.nsec) ;
+		ROS_INFO("search time stamp (rounded) [%d,%d], found time stamp (rounded) [%d,%d]", time_stamp_rounded.sec, time_stamp_rounded.nsec, roundTimeStamp(pose_stamped.header.stamp).sec, roundTimeStamp(pose_stamped.header.stamp).nsec) ;
+
+		sensor_pose.origin = Eigen::Vector4f((float) pose_stamped.pose.position.x, (float) pose_stamped.pose.position.y, (float) pose_stamped.pose.position.z, 1.0f) ;
+		sensor_pose.orientation = Eigen::Quaternionf((float) pose_stamped.pose.orientation.w, (float) pose_stamped.pose.orientation.x, 
+							     (float) pose_stamped.pose.orientation.y, (float) pose_stamped.pose.orientation.z) ;
+		std::cout << "Orientation: " << pose_stamped.pose.orientation.w << " " << pose_stamped.pose.orientation.x << " " << pose_stamped.pose.orientation.y << " " << pose_stamped.pose.orientation.z << std::endl ;
+		std::cout << "Pose: " << pose_stamped.pose.position.x << " " << pose_stamped.pose.position.y << " " << pose_stamped.pose.position.z << " " << std::endl ;
+		return true ;
+	}
+}
+
+void SurfelMapperNodelet::processCloudMsgQueue()
+{
+	//Try to associate clouds from the queue with appropriate transforms and process them
+	if (mapper) {
+		while(!cloudMsgQueue.empty()) {
+			SensorPose sensor_pose ;
+			const sensor_msgs::PointCloud2::ConstPtr& msg = cloudMsgQueue.front() ;
+			bool res = getSensorPosition(msg->header.stamp, sensor_pose) ;
+			if (res) {
+				//Convert message to PointCloud
+				pcl::PCLPointCloud2 pcl_pc2;
+				pcl_conversions::toPCL(*msg, pcl_pc2);
+				pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGB>());
+				pcl::fromPCLPointCloud2(pcl_pc2, *cloud);
+
+				//Fix sensor pose		
+				cloud->sensor_origin_ = sensor_pose.origin ;
+				cloud->sensor_orientation_ = sensor_pose.orientation ;
+
+				//Add cloud to the map
+				ROS_INFO("-------------->Adding point cloud [%d, %d]", msg->header.stamp.sec, msg->header.stamp.nsec) ;
+				ROS_INFO("Sensor position data: [%f, %f, %f, %f] ", cloud->sensor_origin_.x(), cloud->sensor_origin_.y(), cloud->sensor_origin_.z(), cloud->sensor_origin_.w()) ;
+				ROS_INFO("Sensor orientation data: [%f, %f, %f, %f] ", cloud->sensor_orientation_.x(), cloud->sensor_orientation_.y(), cloud->sensor_orientation_.z(), cloud->sensor_orientation_.w()) ;
+
+				bool integrated = mapper->addPointCloudToScene(cloud) ;
+				//addPointCloudToScene1(cloud) ;
+				if (!integrated)
+					ROS_INFO("Point cloud rejected: too little new coverage [%lu frames rejected]", mapper->getRejectedFrameCount()) ;
+				else if (publish_map_delta)
+					publishMapDelta(false) ;
+
+				//Remove message from queue
+				cloudMsgQueue.pop_front() ;	
+			} else break ;
+		}
+	} else 
+		ROS_INFO("processCloudMsgQueue: mapper not initialized") ;
+}
+
+void SurfelMapperNodelet::pathCallback(const nav_msgs::Path::ConstPtr& msg)
+{
+	ROS_DEBUG("pathCallback: [%s]", msg->header.frame_id.c_str());
+	current_path = msg ;
+}
+
+void SurfelMapperNodelet::keyframeCallback(const sensor_msgs::PointCloud2::ConstPtr& msg)
+{
+	ROS_INFO("keyframeCallback: [%s]", msg->header.frame_id.c_str());
+	//Add point cloud to our local queue (the queue is needed since we must sometimes wait for a transform from a path)
+	cloudMsgQueue.push_back(msg) ;	
+	processCloudMsgQueue() ;
+}
+
+void SurfelMapperNodelet::cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr &msg)
+{
+	if (!mapper) {
+
+		ROS_INFO("cameraInfoCallback: camera params message arrived [%s]", msg->header.frame_id.c_str());
+
+		CameraParams camera_params ;
+		camera_params.alpha = msg->K[0] ;
+		camera_params.beta = msg->K[4] ;
+		camera_params.cx = msg->K[2] ;
+		camera_params.cy = msg->K[5] ;
+		
+		
+		mapper.reset(new SurfelMapper(dmax, min_kinect_dist, max_kinect_dist, octree_resolution,
+						preview_resolution, preview_color_samples_in_voxel,
+						confidence_threshold, min_scan_znormal, 
+						use_frustum, scene_size, logging, use_update, camera_params)) ;
+		mapper->setDeltaRecording(publish_map_delta) ;
+		mapper->setOcclusionCulling(use_occlusion_culling) ;
+		mapper->setFreezing(use_freezing, freeze_confidence, freeze_max_residual) ;
+		mapper->setActiveWindow(active_window) ;
+		mapper->setKeyframeRejection(min_new_coverage, coverage_sample_step) ;
+		mapper->setSurfelSpacing(surfel_spacing) ;
+		mapper->setConsolidation(consolidation_budget, merge_radius_ratio, merge_min_normal_dot) ;
+		EvictionPolicy policy = EVICT_LOWEST_CONFIDENCE ;
+		if (eviction_policy == "age")
+			policy = EVICT_LEAST_RECENTLY_OBSERVED ;
+		else if (eviction_policy == "distance")
+			policy = EVICT_FARTHEST ;
+		else if (eviction_policy != "confidence")
+			ROS_WARN("Unknown eviction policy [%s]. Using confidence.", eviction_policy.c_str()) ;
+		mapper->setSurfelBudget(max_surfels, policy, eviction_fraction) ;
+		mapper->setPaging(paging_radius, paging_tile_level, paging_directory, paging_compact) ;
+		mapper->setCompactScene(compact_scene) ;
+		mapper->setReordering(reorder_interval, reorder_budget) ;
+		if (spatial_index == "voxel_blocks")
+			mapper->setSpatialIndex(SPATIAL_INDEX_VOXEL_BLOCKS) ;
+		else if (spatial_index != "octree")
+			ROS_WARN("Unknown spatial index [%s]. Using octree.", spatial_index.c_str()) ;
+
+		processCloudMsgQueue() ; //In case we only waited for camera_info message
+	}
+}
+
+void SurfelMapperNodelet::compressCloud(const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr &cloud, surfel_mapper::CompressedCloud &compressed_msg)
+{
+	compression->encode(cloud, compressed_msg.data) ;
+	compressed_msg.npoints = cloud->size() ;
+	compressed_msg.header.frame_id = "/odom" ;
+	compressed_msg.header.stamp = ros::Time::now() ;
+}
+
+void SurfelMapperNodelet::buildDownsampledMapMessage(unsigned int level, sensor_msgs::PointCloud2 &cloud_msg, surfel_mapper::CompressedCloud &compressed_msg) 
+{
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudSceneDownsampled(new pcl::PointCloud<pcl::PointXYZRGB>) ;
+	mapper->getCloudSceneDownsampled(level, *cloudSceneDownsampled) ;
+
+	pcl::PCLPointCloud2 pcl_pc2;
+	pcl::toPCLPointCloud2(*cloudSceneDownsampled, pcl_pc2) ;
+	pcl_conversions::fromPCL(pcl_pc2, cloud_msg) ;
+	cloud_msg.header.frame_id = "/odom" ;
+	cloud_msg.header.stamp = ros::Time::now() ;
+
+	if (publish_compressed)
+		compressCloud(cloudSceneDownsampled, compressed_msg) ;
+}
+
+double SurfelMapperNodelet::getPreviewMessageSize()
+{
+	return publish_compressed ? preview_state.compressed_msg->data.size() : preview_state.cloud_msg->data.size() ;
+}
+
+void SurfelMapperNodelet::sendDownsampledMapMessage() 
+{
+	ros::Time now = ros::Time::now() ;
+	if (preview_max_bandwidth > 0.0) {
+		if (preview_state.last_refill.isZero())
+			preview_state.tokens = preview_max_bandwidth ; //Start with the full bucket
+		else
+			preview_state.tokens = std::min(preview_state.tokens + (now - preview_state.last_refill).toSec() * preview_max_bandwidth, preview_max_bandwidth) ;
+		preview_state.last_refill = now ;
+	}
+
+	unsigned long version = mapper->getPreviewVersion() ;
+	if (!preview_state.msg_valid || preview_state.msg_version != version) {
+		//Published messages must not be modified, so the preview is always built into fresh ones
+		preview_state.cloud_msg.reset(new sensor_msgs::PointCloud2) ;
+		preview_state.compressed_msg.reset(new surfel_mapper::CompressedCloud) ;
+		unsigned int level = 0 ;
+		buildDownsampledMapMessage(level, *preview_state.cloud_msg, *preview_state.compressed_msg) ;
+		while (preview_max_bandwidth > 0.0 && getPreviewMessageSize() > preview_max_bandwidth && (int) level < preview_max_level)
+			buildDownsampledMapMessage(++level, *preview_state.cloud_msg, *preview_state.compressed_msg) ;
+		if (level > 0)
+			ROS_DEBUG("Preview does not fit into bandwidth limit. Falling back to preview level [%d]", level) ;
+		preview_state.msg_version = version ;
+		preview_state.msg_valid = true ;
+		preview_state.msg_published = false ;
+	}
+
+	if (preview_state.msg_published)
+		return ; //Nothing changed since the last publishing
+
+	double msg_size = getPreviewMessageSize() ;
+	if (preview_max_bandwidth > 0.0) {
+		//Oversized (coarsest level) messages are sent with the full bucket and leave a debt
+		if (preview_state.tokens < std::min(msg_size, preview_max_bandwidth)) 
+			return ; //Wait for the bandwidth to be available
+		preview_state.tokens -= msg_size ;
+	}
+	downsampled_map_pub.publish(sensor_msgs::PointCloud2::ConstPtr(preview_state.cloud_msg)) ;
+	if (publish_compressed)
+		compressed_downsampled_map_pub.publish(surfel_mapper::CompressedCloud::ConstPtr(preview_state.compressed_msg)) ;
+	preview_state.msg_published = true ;
+}
+
+void SurfelMapperNodelet::surfelsToCloudMessage(const pcl::PointCloud<PointCustomSurfel> &cloud, sensor_msgs::PointCloud2 &cloud_msg)
+{
+	sensor_msgs::PointCloud2Modifier modifier(cloud_msg) ;
+	modifier.setPointCloud2Fields(9, "x", 1, sensor_msgs::PointField::FLOAT32,
+					"y", 1, sensor_msgs::PointField::FLOAT32,
+					"z", 1, sensor_msgs::PointField::FLOAT32,
+					"normal_x", 1, sensor_msgs::PointField::FLOAT32,
+					"normal_y", 1, sensor_msgs::PointField::FLOAT32,
+					"normal_z", 1, sensor_msgs::PointField::FLOAT32,
+					"radius", 1, sensor_msgs::PointField::FLOAT32,
+					"rgba", 1, sensor_msgs::PointField::UINT32,
+					"confidence", 1, sensor_msgs::PointField::UINT32) ;
+	modifier.resize(cloud.size()) ;
+
+	sensor_msgs::PointCloud2Iterator<float> iter_x(cloud_msg, "x") ;
+	sensor_msgs::PointCloud2Iterator<float> iter_normal(cloud_msg, "normal_x") ;
+	sensor_msgs::PointCloud2Iterator<float> iter_radius(cloud_msg, "radius") ;
+	sensor_msgs::PointCloud2Iterator<uint32_t> iter_rgba(cloud_msg, "rgba") ;
+	sensor_msgs::PointCloud2Iterator<uint32_t> iter_confidence(cloud_msg, "confidence") ;
+
+	size_t nsurfels = 0 ;
+	for (size_t i = 0; i < cloud.size() ; i++) {
+		const PointCustomSurfel &point = cloud.points[i] ;
+		if (!pcl::isFinite(point))
+			continue ;
+		//Iterators over x and normal_x give access to the consecutive (y, z) and (normal_y, normal_z) fields
+		iter_x[0] = point.x ; iter_x[1] = point.y ; iter_x[2] = point.z ;
+		iter_normal[0] = point.normal_x ; iter_normal[1] = point.normal_y ; iter_normal[2] = point.normal_z ;
+		*iter_radius = point.radius ;
+		*iter_rgba = point.rgba ;
+		*iter_confidence = point.confidence ;
+		++iter_x ; ++iter_normal ; ++iter_radius ; ++iter_rgba ; ++iter_confidence ;
+		nsurfels++ ;
+	}
+	modifier.resize(nsurfels) ; //Drop the space reserved for removed surfels
+}
+
+void SurfelMapperNodelet::sendMapMessage(Eigen::Vector3f &min_bb, Eigen::Vector3f &max_bb) 
+{
+	pcl::PointCloud<PointCustomSurfel> surfels ;
+	mapper->getBoundingBoxSurfels(min_bb, max_bb, surfels) ; //Covers also the map tiles paged out to the disk
+
+	sensor_msgs::PointCloud2::Ptr cloud_msg(new sensor_msgs::PointCloud2) ;
+	surfelsToCloudMessage(surfels, *cloud_msg) ;
+	cloud_msg->header.frame_id = "/odom" ;
+	cloud_msg->header.stamp = ros::Time::now() ;
+	ROS_INFO("Publishing: %d surfels ", (int) cloud_msg->width) ;
+
+	surfel_map_pub.publish(sensor_msgs::PointCloud2::ConstPtr(cloud_msg)) ;
+
+	if (publish_compressed) {
+		//Only surfel centers and colors are compressed
+		pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudXYZRGB(new pcl::PointCloud<pcl::PointXYZRGB>) ;
+		cloudXYZRGB->reserve(surfels.size()) ;
+		for (size_t i = 0; i < surfels.size() ; i++) {
+			const PointCustomSurfel &point = surfels.points[i] ;
+			if (pcl::isFinite(point)) {
+				pcl::PointXYZRGB pointXYZRGB ;
+				pointXYZRGB.x = point.x ; pointXYZRGB.y = point.y ; pointXYZRGB.z = point.z ;
+				pointXYZRGB.rgba = point.rgba ;
+				cloudXYZRGB->push_back(pointXYZRGB) ;
+			}
+		}
+		surfel_mapper::CompressedCloud::Ptr compressed_msg(new surfel_mapper::CompressedCloud) ;
+		compressCloud(cloudXYZRGB, *compressed_msg) ;
+		ROS_INFO("Publishing compressed map fragment: %d bytes (uncompressed: %d bytes)", (int) compressed_msg->data.size(), (int) cloud_msg->data.size()) ;
+		compressed_map_pub.publish(surfel_mapper::CompressedCloud::ConstPtr(compressed_msg)) ;
+	}
+}
+
+void SurfelMapperNodelet::publishMapDelta(bool reset)
+{
+	const ::SurfelMapDelta &delta = mapper->getLastDelta() ;
+
+	surfel_mapper::SurfelMapDelta::Ptr delta_msg(new surfel_mapper::SurfelMapDelta) ;
+	delta_msg->header.frame_id = "/odom" ;
+	delta_msg->header.stamp = ros::Time::now() ;
+	delta_msg->seq = delta.seq ;
+	delta_msg->reset = reset ;
+	delta_msg->removed.assign(delta.removed.begin(), delta.removed.end()) ;
+	//Added and updated surfels are always valid, so the cloud messages are aligned with the index arrays
+	delta_msg->added_indices.assign(delta.added.begin(), delta.added.end()) ;
+	pcl::PointCloud<PointCustomSurfel> surfels ;
+	mapper->getSurfels(delta.added, surfels) ;
+	surfelsToCloudMessage(surfels, delta_msg->added) ;
+	delta_msg->updated_indices.assign(delta.updated.begin(), delta.updated.end()) ;
+	surfels.clear() ;
+	mapper->getSurfels(delta.updated, surfels) ;
+	surfelsToCloudMessage(surfels, delta_msg->updated) ;
+
+	ROS_DEBUG("Publishing map delta [%lu]: added [%d], updated [%d], removed [%d]", delta.seq, (int) delta.added.size(), (int) delta.updated.size(), (int) delta.removed.size()) ;
+	map_delta_pub.publish(surfel_mapper::SurfelMapDelta::ConstPtr(delta_msg)) ;
+}
+
+void SurfelMapperNodelet::saveMap(const std::string &fileName) 
+{
+	//Copy map to standard RGBXYZ point cloud. Leave only points that are actually valid (octree indices are present or the tile is paged out)
+	pcl::PointCloud<PointCustomSurfel> surfels ;
+	pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudXYZRGBfilt(new pcl::PointCloud<pcl::PointXYZRGB>) ;
+	mapper->getAllSurfels(surfels) ;
+
+	pcl::copyPointCloud(surfels, *cloudXYZRGBfilt) ;
+
+	pcl::io::savePCDFileBinary(fileName, *cloudXYZRGBfilt) ;
+
+	/*	
+	std::cout << "Cloud length: " << cloudXYZRGB->size() << std::endl ;
+	//pcl::removeNaNFromPointCloud(*cloudXYZRGB, *cloudXYZRGB, indv) ;
+	int count = 0 ;
+	for (int i = 0; i < cloudXYZRGB->points.size() ; i++)
+		if (!pcl_isfinite(cloudXYZRGB->points[i].x))
+			count++ ;	
+
+	std::vector<int> ind1 ;
+	ind1.resize(cloudXYZRGB->size()) ;	
+	for (int i = 0; i < ind1.size() ; i++)
+		ind1[i] = 0 ;
+	
+	for (int i = 0; i < indv.size() ; i++)
+		ind1[indv[i]] = 1 ;
+
+	int count1 = 0 ;
+	int count2 = 0 ;
+	for (int i = 0; i < ind1.size() ; i++)
+		if (ind1[i] == 0) {
+			std::cout << "*" << i << "+" << cloudXYZRGB->points[i].x << std::endl ;
+			count1++ ;
+			if (pcl_isfinite(cloudXYZRGB->points[i].x))
+				count2++ ;
+		}
+
+	std::cout << "Number of non nans: " << indv.size() << std::endl ;
+	std::cout << "Number of nans: " << count << std::endl ;
+	std::cout << "Cloud length: " << cloudXYZRGB->size() << std::endl ;
+	std::cout << "Count1: " << count1 << std::endl ;
+	std::cout << "Count2: " << count2 << std::endl ;
+
+	if (mapper->getPointCount() != indv.size())
+		std::cerr << "saveMap: mapper->getPointCount does not match cloud index vector size" ;
+
+	std::cout << "Saving map. Point count: " << mapper->getPointCount() << std::endl ;
+	std::cout.flush() ;
+	*/	
+}
+
+bool SurfelMapperNodelet::resetMapCallback(
+  surfel_mapper::ResetMap::Request& request,
+  surfel_mapper::ResetMap::Response& response)
+{
+	ROS_INFO("ResetMap request arrived") ;	
+	if (mapper) {
+		mapper->resetMap() ;
+		if (publish_map_delta)
+			publishMapDelta(true) ;
+		ROS_INFO("The map has been reset") ;	
+	} else
+		ROS_INFO("resetMapCallback: Mapper not initialized.") ;
+
+	return true ;
+}
+
+bool SurfelMapperNodelet::publishMapCallback(
+  surfel_mapper::PublishMap::Request& request,
+  surfel_mapper::PublishMap::Response& response)
+{
+	Eigen::Vector3f minbb(request.x1, request.y1, request. z1) ;
+	Eigen::Vector3f maxbb(request.x2, request.y2, request. z2) ;
+
+	ROS_INFO("PublishMap request arrived for bb. [%f,%f,%f]-[%f,%f,%f]", minbb[0], minbb[1], minbb[2], maxbb[0], maxbb[1], maxbb[2]) ;	
+	if (mapper) {
+		sendMapMessage(minbb, maxbb) ;	
+		ROS_INFO("The map has been sent") ;	
+	} else
+		ROS_INFO("resetMapCallback: Mapper not initialized.") ;
+	return true ;
+}
+
+bool SurfelMapperNodelet::saveMapCallback(
+  surfel_mapper::SaveMap::Request& request,
+  surfel_mapper::SaveMap::Response& response)
+{
+	ROS_INFO("SaveMap request arrived.") ;	
+	if (mapper) {
+		saveMap("cloud.pcd") ;	
+		ROS_INFO("The map has been saved") ;	
+	} else
+		ROS_INFO("saveMapCallback: Mapper not initialized.") ;
+	return true ;
+}
+
+bool SurfelMapperNodelet::resyncMapCallback(
+  surfel_mapper::ResyncMap::Request& request,
+  surfel_mapper::ResyncMap::Response& response)
+{
+	ROS_INFO("ResyncMap request arrived.") ;	
+	if (mapper) {
+		std::vector<SurfelIdx> indices ;
+		mapper->getAllIndices(indices) ;
+		response.seq = mapper->getLastDelta().seq ;
+		response.indices.assign(indices.begin(), indices.end()) ;
+		pcl::PointCloud<PointCustomSurfel> surfels ;
+		mapper->getSurfels(indices, surfels) ;
+		surfelsToCloudMessage(surfels, response.surfels) ;
+		response.surfels.header.frame_id = "/odom" ;
+		response.surfels.header.stamp = ros::Time::now() ;
+		ROS_INFO("The map snapshot has been sent [%d surfels]", (int) indices.size()) ;	
+	} else {
+		ROS_INFO("resyncMapCallback: Mapper not initialized.") ;
+		return false ;
+	}
+	return true ;
+}
+void SurfelMapperNodelet::timerCallback(const ros::TimerEvent &event)
+{
+	processCloudMsgQueue() ;
+	if (mapper) {
+		ros::Time start = ros::Time::now() ;
+		sendDownsampledMapMessage() ;
+		ros::Time stop = ros::Time::now() ;
+		ROS_DEBUG("Sending Map Message time (s): [%.6lf]", (stop - start).toSec()) ;
+	} else 
+		ROS_INFO("Downsampled map not sent. Mapper is not initialized.") ;
+}
+
+/**
+ * Appends a key-value pair to the diagnostic status
+ *
+ * @param status diagnostic status
+ * @param key key
+ * @param value value
+ */
+static void addDiagnosticValue(diagnostic_msgs::DiagnosticStatus &status, const std::string &key, size_t value)
+{
+	diagnostic_msgs::KeyValue key_value ;
+	key_value.key = key ;
+	key_value.value = std::to_string(value) ;
+	status.values.push_back(key_value) ;
+}
+
+void SurfelMapperNodelet::diagnosticsTimerCallback(const ros::TimerEvent &event)
+{
+	diagnostic_msgs::DiagnosticStatus status ;
+	status.level = diagnostic_msgs::DiagnosticStatus::OK ;
+	status.name = getName() + ": memory" ;
+	status.hardware_id = "surfel_mapper" ;
+
+	//Messages waiting in the nodelet
+	size_t queue_bytes = 0 ;
+	for (PointCloudMsgListT::iterator it = cloudMsgQueue.begin(); it != cloudMsgQueue.end() ; it++)
+		queue_bytes += (*it)->data.size() ;
+	size_t preview_msg_bytes = preview_state.cloud_msg ? preview_state.cloud_msg->data.capacity() : 0 ;
+
+	if (mapper) {
+		MemoryReport report ;
+		mapper->getMemoryReport(report) ;
+		size_t total = report.getTotalBytes() + queue_bytes + preview_msg_bytes ;
+		char message[64] ;
+		snprintf(message, sizeof(message), "%.1f MB", total / 1048576.0) ;
+		status.message = message ;
+		addDiagnosticValue(status, "total_bytes", total) ;
+		addDiagnosticValue(status, "surfel_bytes", report.surfel_bytes) ;
+		addDiagnosticValue(status, "slot_list_bytes", report.slot_list_bytes) ;
+		addDiagnosticValue(status, "index_branch_bytes", report.branch_bytes) ;
+		addDiagnosticValue(status, "index_leaf_bytes", report.leaf_bytes) ;
+		addDiagnosticValue(status, "leaf_index_bytes", report.leaf_index_bytes) ;
+		addDiagnosticValue(status, "preview_bytes", report.preview_bytes) ;
+		addDiagnosticValue(status, "scratch_bytes", report.scratch_bytes) ;
+		addDiagnosticValue(status, "live_surfels", report.live_surfels) ;
+		addDiagnosticValue(status, "dead_surfels", report.dead_surfels) ;
+		addDiagnosticValue(status, "index_branches", report.branch_count) ;
+		addDiagnosticValue(status, "index_leaves", report.leaf_count) ;
+		addDiagnosticValue(status, "surfels_on_disk", mapper->getPagedOutCount()) ;
+	} else
+		status.message = "Mapper not initialized" ;
+	addDiagnosticValue(status, "keyframe_queue_bytes", queue_bytes) ;
+	addDiagnosticValue(status, "preview_message_bytes", preview_msg_bytes) ;
+
+	diagnostic_msgs::DiagnosticArray::Ptr msg(new diagnostic_msgs::DiagnosticArray) ;
+	msg->header.stamp = ros::Time::now() ;
+	msg->status.push_back(status) ;
+	diagnostics_pub.publish(diagnostic_msgs::DiagnosticArray::ConstPtr(msg)) ;
+}
+
+void SurfelMapperNodelet::onInit()
+{
+	ros::NodeHandle &n = getNodeHandle() ;
+	ros::NodeHandle &np = getPrivateNodeHandle() ;
+
+	//Parse parameters
+	if (!np.getParam("dmax", dmax)) dmax = 0.005f ;
+	if (!np.getParam("min_kinect_dist", min_kinect_dist)) min_kinect_dist = 0.8 ;
+	if (!np.getParam("max_kinect_dist", max_kinect_dist))  max_kinect_dist = 4.0 ;
+	if (!np.getParam("octree_resolution", octree_resolution)) octree_resolution = 0.2 ;
+	if (!np.getParam("preview_resolution", preview_resolution)) preview_resolution= 0.2 ;
+	if (!np.getParam("preview_color_samples_in_voxel", preview_color_samples_in_voxel)) preview_color_samples_in_voxel = 3 ;
+	if (!np.getParam("confidence_threshold", confidence_threshold)) confidence_threshold = 5 ;
+	if (!np.getParam("min_scan_znormal", min_scan_znormal)) min_scan_znormal = 0.2f ;
+	if (!np.getParam("use_frustum", use_frustum)) use_frustum = true ;
+	if (!np.getParam("use_occlusion_culling", use_occlusion_culling)) use_occlusion_culling = true ;
+	if (!np.getParam("use_freezing", use_freezing)) use_freezing = false ;
+	if (!np.getParam("freeze_confidence", freeze_confidence)) freeze_confidence = 20 ;
+	if (!np.getParam("freeze_max_residual", freeze_max_residual)) freeze_max_residual = 0.025 ;
+	if (!np.getParam("active_window", active_window)) active_window = 0 ;
+	if (!np.getParam("min_new_coverage", min_new_coverage)) min_new_coverage = 0.0 ;
+	if (!np.getParam("coverage_sample_step", coverage_sample_step)) coverage_sample_step = 8 ;
+	if (!np.getParam("surfel_spacing", surfel_spacing)) surfel_spacing = 0.0 ;
+	if (!np.getParam("consolidation_budget", consolidation_budget)) consolidation_budget = 0.0 ;
+	if (!np.getParam("merge_radius_ratio", merge_radius_ratio)) merge_radius_ratio = 0.5 ;
+	if (!np.getParam("merge_min_normal_dot", merge_min_normal_dot)) merge_min_normal_dot = 0.95 ;
+	if (!np.getParam("max_surfels", max_surfels)) max_surfels = 0 ;
+	if (!np.getParam("eviction_policy", eviction_policy)) eviction_policy = "confidence" ;
+	if (!np.getParam("eviction_fraction", eviction_fraction)) eviction_fraction = 0.1 ;
+	if (!np.getParam("paging_radius", paging_radius)) paging_radius = 0.0 ;
+	if (!np.getParam("paging_tile_level", paging_tile_level)) paging_tile_level = 5 ;
+	if (!np.getParam("paging_directory", paging_directory)) paging_directory = "/tmp/surfel_tiles" ;
+	if (!np.getParam("paging_compact", paging_compact)) paging_compact = false ;
+	if (!np.getParam("compact_scene", compact_scene)) compact_scene = false ;
+	if (!np.getParam("reorder_interval", reorder_interval)) reorder_interval = 0 ;
+	if (!np.getParam("reorder_budget", reorder_budget)) reorder_budget = 0.005 ;
+	if (!np.getParam("diagnostics_period", diagnostics_period)) diagnostics_period = 10.0 ;
+	if (!np.getParam("scene_size", scene_size)) scene_size = 3e7 ;
+	if (!np.getParam("logging", logging)) logging = true ;
+	if (!np.getParam("use_update", use_update)) use_update = true ;
+	if (!np.getParam("publish_map_delta", publish_map_delta)) publish_map_delta = true ;
+	if (!np.getParam("preview_max_bandwidth", preview_max_bandwidth)) preview_max_bandwidth = 0.0 ;
+	if (!np.getParam("preview_max_level", preview_max_level)) preview_max_level = 3 ;
+	if (!np.getParam("publish_compressed", publish_compressed)) publish_compressed = false ;
+	if (!np.getParam("compression_point_resolution", compression_point_resolution)) compression_point_resolution = 0.005 ;
+	if (!np.getParam("compression_octree_resolution", compression_octree_resolution)) compression_octree_resolution = 0.05 ;
+	if (!np.getParam("compression_color_bits", compression_color_bits)) compression_color_bits = 6 ;
+	if (!np.getParam("spatial_index", spatial_index)) spatial_index = "octree" ;
+
+	if (publish_compressed)
+		compression.reset(new CloudCompression(compression_point_resolution, compression_octree_resolution, compression_color_bits)) ;
+
+	sub_path = n.subscribe("mapper_path", 3, &SurfelMapperNodelet::pathCallback, this);
+	sub_keyframe = n.subscribe("keyframes", 200, &SurfelMapperNodelet::keyframeCallback, this);
+	sub_camerainfo = n.subscribe("camera/rgb/camera_info", 3, &SurfelMapperNodelet::cameraInfoCallback, this);
+
+	downsampled_map_pub = n.advertise<sensor_msgs::PointCloud2>("surfelmap_preview", 5, true); //Latched - the preview is published only when it changes
+	surfel_map_pub = n.advertise<sensor_msgs::PointCloud2>("surfelmap", 1);
+	map_delta_pub = n.advertise<surfel_mapper::SurfelMapDelta>("surfelmap_delta", 50);
+	compressed_downsampled_map_pub = n.advertise<surfel_mapper::CompressedCloud>("surfelmap_preview_compressed", 5, true);
+	compressed_map_pub = n.advertise<surfel_mapper::CompressedCloud>("surfelmap_compressed", 1);
+
+	resetmap_service = n.advertiseService("reset_map", &SurfelMapperNodelet::resetMapCallback, this);
+	publishmap_service = n.advertiseService("publish_map", &SurfelMapperNodelet::publishMapCallback, this);
+	savemap_service = n.advertiseService("save_map", &SurfelMapperNodelet::saveMapCallback, this);
+	resyncmap_service = n.advertiseService("resync_map", &SurfelMapperNodelet::resyncMapCallback, this);
+
+	//Replaces the 2Hz main loop of the standalone node. Timer callbacks share the queue with the subscriptions
+	publish_timer = n.createTimer(ros::Duration(0.5), &SurfelMapperNodelet::timerCallback, this) ;
+	if (diagnostics_period > 0.0) {
+		diagnostics_pub = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+		diagnostics_timer = n.createTimer(ros::Duration(diagnostics_period), &SurfelMapperNodelet::diagnosticsTimerCallback, this) ;
+	}
+}
+
+}
+
+PLUGINLIB_EXPORT_CLASS(surfel_mapper::SurfelMapperNodelet, nodelet::Nodelet)
@@ -0,0 +1,325 @@
+/**
+ *  @file surfel_mapper_nodelet.hpp
+ *  @author Artur Wilkowski <ArturWilkowski@piap.pl>
+ *
+ *  @section LICENSE
+ *
+ *  Copyright (C) 2015, Industrial Research Institute for Automation and Measurements
+ *  Security and Defence Systems Division <http://www.piap.pl>
+ */
+
+#ifndef SURFEL_MAPPER_NODELET_HPP
+#define SURFEL_MAPPER_NODELET_HPP
+
+#include <nodelet/nodelet.h>
+#include "ros/ros.h"
+#include "nav_msgs/Path.h"
+#include "sensor_msgs/PointCloud2.h"
+#include <sensor_msgs/CameraInfo.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <Eigen/Geometry>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include "surfel_mapper.hpp"
+#include "cloud_compression.hpp"
+#include "surfel_mapper/ResetMap.h"
+#include "surfel_mapper/PublishMap.h"
+#include "surfel_mapper/SaveMap.h"
+#include "surfel_mapper/ResyncMap.h"
+#include "surfel_mapper/SurfelMapDelta.h"
+#include "surfel_mapper/CompressedCloud.h"
+
+namespace surfel_mapper {
+
+/**
+ * @brief Structure describing sensor pose
+ */
+struct SensorPose {
+	public:
+		Eigen::Quaternionf orientation ; /**< @brief sensor orientation */
+		Eigen::Vector4f origin ; /**< @brief sensor origin */
+} ;
+
+/**
+ * @brief State of the change-gated preview publishing
+ */
+struct PreviewPublishingState {
+	sensor_msgs::PointCloud2::Ptr cloud_msg ; /**< @brief cached preview message */
+	CompressedCloud::Ptr compressed_msg ; /**< @brief cached compressed preview message (used if compressed publishing is turned on) */
+	unsigned long msg_version = 0 ; /**< @brief preview version the cached message was built from */
+	bool msg_valid = false ; /**< @brief is the cached message built */
+	bool msg_published = false ; /**< @brief has the cached message been already published */
+	double tokens = 0.0 ; /**< @brief bytes that can be sent without exceeding the bandwidth limit */
+	ros::Time last_refill ; /**< @brief time of the last token refill */
+} ;
+
+/**
+ * @brief Surfel mapper nodelet
+ *
+ * When loaded into the same nodelet manager as the keyframe producer and the preview consumers, messages
+ * are passed as shared pointers without serialization. All callbacks are served by the nodelet's single-threaded
+ * callback queue, so the mapper state needs no additional locking.
+ */
+class SurfelMapperNodelet : public nodelet::Nodelet {
+	public:
+		/** @brief Initializes the nodelet (parameters, topics, services and the publishing timer) */
+		virtual void onInit() ;
+
+	protected:
+		//typedef std::list<pcl::PointCloud<pcl::PointXYZRGB>::Ptr> PointCloudMsgListT ;
+		typedef std::list<sensor_msgs::PointCloud2::ConstPtr> PointCloudMsgListT ; /**< @brief message list of points clouds */
+
+		//Node parameters
+		double dmax ; /**< @brief distance threshold for surfel update*/
+		double min_kinect_dist ; /**< @brief reliable minimum sensor reading distance*/
+		double max_kinect_dist ; /**< @brief reliable maximum sensor reading distance*/
+		double octree_resolution ; /**< @brief resolution of underlying octree*/
+		double preview_resolution ; /**< @brief resolution of output preview map*/
+		int preview_color_samples_in_voxel ; /**< @brief number of samples in voxel used for constructing preview point (affects preview efficiency)*/
+		int confidence_threshold ; /**< @brief confidence threshold used for establishing reliable surfels*/
+		double min_scan_znormal ; /**< @brief acceptable minimum z-component of scan normal*/
+		bool use_frustum ; /**< @brief use frustum or no*/
+		bool use_occlusion_culling ; /**< @brief skip map parts hidden behind the observed surface during the update or no*/
+		bool use_freezing ; /**< @brief skip averaging of surfels in converged map regions or no*/
+		int freeze_confidence ; /**< @brief minimum surfel confidence in a converged map region*/
+		double freeze_max_residual ; /**< @brief maximum distance between surfels and matching readings in a converged map region*/
+		int active_window ; /**< @brief number of recent keyframes in which a surfel must have been observed to take part in the update (0 - all surfels)*/
+		double min_new_coverage ; /**< @brief minimum estimated fraction of keyframe readings not covered by the map for the keyframe to be integrated (0 - all keyframes)*/
+		int coverage_sample_step ; /**< @brief pixel step of the readings sampled for the coverage estimate*/
+		double surfel_spacing ; /**< @brief target spacing of added surfels (0 - a surfel for each uncovered reading)*/
+		double consolidation_budget ; /**< @brief time (in seconds) spent on merging surfels after each keyframe (0 - no merging)*/
+		double merge_radius_ratio ; /**< @brief maximum distance between centers of merged surfels relative to the smaller radius*/
+		double merge_min_normal_dot ; /**< @brief minimum cosine of the angle between normals of merged surfels*/
+		int max_surfels ; /**< @brief maximum number of surfels in the map (0 - no limit)*/
+		std::string eviction_policy ; /**< @brief order of evicting surfels from the map exceeding the budget (confidence, age or distance)*/
+		double eviction_fraction ; /**< @brief fraction of the surfel budget freed by each eviction*/
+		double paging_radius ; /**< @brief distance from the sensor beyond which map tiles are paged out to the disk (0 - no paging)*/
+		int paging_tile_level ; /**< @brief side of a map tile as the number of doublings of the octree resolution*/
+		std::string paging_directory ; /**< @brief directory of the map tiles paged out*/
+		bool paging_compact ; /**< @brief if true the map tiles paged out are stored quantized*/
+		bool compact_scene ; /**< @brief if true the surfels in memory are stored quantized*/
+		int reorder_interval ; /**< @brief number of keyframes between the starts of passes reordering the surfel cloud (0 - no reordering)*/
+		double reorder_budget ; /**< @brief time (in seconds) spent on reordering the surfel cloud after each keyframe*/
+		double diagnostics_period ; /**< @brief period (in seconds) of publishing the memory report on diagnostics (0 - no publishing)*/
+		int scene_size ; /**< @brief preallocated size of scene*/
+		bool logging ; /**< @brief logging turned on or off*/
+		bool use_update ; /**< @brief use surfel update or no*/
+		bool publish_map_delta ; /**< @brief publish map deltas for each integrated keyframe or no*/
+		double preview_max_bandwidth ; /**< @brief upper limit of the preview publishing bandwidth in bytes per second (0 - no limit)*/
+		int preview_max_level ; /**< @brief coarsest preview level used when the preview does not fit into the bandwidth limit*/
+		bool publish_compressed ; /**< @brief publish octree-compressed preview and map fragments or no*/
+		double compression_point_resolution ; /**< @brief precision of compressed point coordinates*/
+		double compression_octree_resolution ; /**< @brief resolution of the compression octree*/
+		int compression_color_bits ; /**< @brief number of bits per color component in compressed clouds*/
+		std::string spatial_index ; /**< @brief spatial index organizing surfels (octree or voxel_blocks)*/
+
+		nav_msgs::Path::ConstPtr current_path ; /**< @brief pointer to the current path message */
+		PointCloudMsgListT cloudMsgQueue ; /**< @brief queue of point cloud messages */
+
+		boost::shared_ptr<SurfelMapper> mapper ; /**< @brief mapper pointer */
+		boost::shared_ptr<CloudCompression> compression ; /**< @brief cloud compression object (initialized if compressed publishing is turned on)*/
+		PreviewPublishingState preview_state ; /**< @brief state of the preview publishing */
+
+		ros::Subscriber sub_path ; /**< @brief odometry path subscriber */
+		ros::Subscriber sub_keyframe ; /**< @brief keyframe subscriber */
+		ros::Subscriber sub_camerainfo ; /**< @brief camera info subscriber */
+		ros::Publisher downsampled_map_pub ; /**< @brief preview publisher */
+		ros::Publisher surfel_map_pub ; /**< @brief surfel mapper publisher */
+		ros::Publisher map_delta_pub ; /**< @brief map delta publisher */
+		ros::Publisher compressed_downsampled_map_pub ; /**< @brief compressed preview publisher */
+		ros::Publisher compressed_map_pub ; /**< @brief compressed surfel map publisher */
+		ros::Publisher diagnostics_pub ; /**< @brief memory report (diagnostics) publisher */
+		ros::ServiceServer resetmap_service ; /**< @brief ResetMap service server */
+		ros::ServiceServer publishmap_service ; /**< @brief PublishMap service server */
+		ros::ServiceServer savemap_service ; /**< @brief SaveMap service server */
+		ros::ServiceServer resyncmap_service ; /**< @brief ResyncMap service server */
+		ros::Timer publish_timer ; /**< @brief timer driving queue processing and preview publishing */
+		ros::Timer diagnostics_timer ; /**< @brief timer driving memory report publishing */
+
+		/**
+		 * @brief Retrieves sensor position associated with the given timestamp
+		 *
+		 * @param time_stamp time stamp to search for
+		 * @param sensor_pose output sensor pose
+		 * @return true if the time stamp was found, false otherwise
+		 */
+		bool getSensorPosition(const ros::Time &time_stamp, SensorPose &sensor_pose) ;
+
+		/**
+		 * @brief Process a queue of buffered cloud messages
+		 */
+		void processCloudMsgQueue() ;
+
+		/**
+		 * @brief Callback for the incoming path message
+		 *
+		 * @param msg incoming path message
+		 */
+		void pathCallback(const nav_msgs::Path::ConstPtr& msg) ;
+
+		/**
+		 * @brief Callback for the incoming keyframe (cloud) message
+		 *
+		 * @param msg incoming point cloud message
+		 */
+		void keyframeCallback(const sensor_msgs::PointCloud2::ConstPtr& msg) ;
+
+		/**
+		 * @brief Callback for the incoming camera info message
+		 *
+		 * @param msg incoming camera info message
+		 */
+		void cameraInfoCallback(const sensor_msgs::CameraInfo::ConstPtr &msg) ;
+
+		/**
+		 * @brief Callback for the publishing timer
+		 *
+		 * Processes the buffered clouds and sends the preview
+		 *
+		 * @param event timer event
+		 */
+		void timerCallback(const ros::TimerEvent &event) ;
+
+		/**
+		 * @brief Callback for the diagnostics timer
+		 *
+		 * Publishes the memory report of the mapper (and of the messages buffered by the nodelet)
+		 *
+		 * @param event timer event
+		 */
+		void diagnosticsTimerCallback(const ros::TimerEvent &event) ;
+
+		/**
+		 * @brief Fills compressed cloud message
+		 *
+		 * @param cloud input cloud
+		 * @param compressed_msg output compressed cloud message
+		 */
+		void compressCloud(const pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr &cloud, CompressedCloud &compressed_msg) ;
+
+		/**
+		 * @brief Builds downsampled cloud message (and its compressed version if compressed publishing is turned on)
+		 *
+		 * @param level preview level
+		 * @param cloud_msg output cloud message
+		 * @param compressed_msg output compressed cloud message
+		 */
+		void buildDownsampledMapMessage(unsigned int level, sensor_msgs::PointCloud2 &cloud_msg, CompressedCloud &compressed_msg) ;
+
+		/**
+		 * @brief Gets size of the cached preview in bytes
+		 *
+		 * If compressed publishing is turned on, the compressed size is used (the compressed preview is intended for the bandwidth-limited links)
+		 *
+		 * @return size of the preview
+		 */
+		double getPreviewMessageSize() ;
+
+		/**
+		 * @brief Sends downsampled cloud message if the preview changed since the last publishing
+		 *
+		 * The message is rebuilt only when the preview changes. When the bandwidth limit is set, the message is sent
+		 * only if it fits into the limit (token bucket with one second burst), and coarser preview levels are used for previews
+		 * that would never fit. A rebuilt preview is placed in a newly allocated message, since the previously published one
+		 * may still be shared with intra-process subscribers.
+		 */
+		void sendDownsampledMapMessage() ;
+
+		/**
+		 * @brief Fills a packed surfel cloud message with the selected surfels
+		 *
+		 * Each surfel is stored as x, y, z, normal_x, normal_y, normal_z, radius, rgba and confidence fields (36 bytes per surfel).
+		 * Surfels removed from the map (NaN-ed) are skipped.
+		 *
+		 * @param cloud surfels to be sent (copied out of the mapper with SurfelMapper::getSurfels() or SurfelMapper::getBoundingBoxSurfels())
+		 * @param cloud_msg output cloud message
+		 */
+		void surfelsToCloudMessage(const pcl::PointCloud<PointCustomSurfel> &cloud, sensor_msgs::PointCloud2 &cloud_msg) ;
+
+		/**
+		 * @brief Sends surfel map message
+		 *
+		 * The surfels from the bounding box are sent as a packed PointCloud2 (see surfelsToCloudMessage()),
+		 * so that consumers can render them as discs.
+		 *
+		 * @param min_bb coordinates of the first corner of the bounding box
+		 * @param max_bb coordinates of the second corner of the bounding box
+		 */
+		void sendMapMessage(Eigen::Vector3f &min_bb, Eigen::Vector3f &max_bb) ;
+
+		/**
+		 * @brief Publishes changes introduced to the map by the last keyframe (or the last map reset)
+		 *
+		 * @param reset true if the delta follows the map reset
+		 */
+		void publishMapDelta(bool reset) ;
+
+		/**
+		 * @brief Saves map under the filename specified
+		 *
+		 * Only XYZRGB components of surfels are saved.
+		 *
+		 * @param fileName point cloud file name
+		 */
+		void saveMap(const std::string &fileName) ;
+
+		/**
+		 * @brief Callback for the ResetMap service.
+		 *
+		 * Removes all surfels from the map.
+		 *
+		 * @param request service request object
+		 * @param response service response object
+		 *
+		 * @return true if service call is correctly handled
+		 */
+		bool resetMapCallback(ResetMap::Request& request, ResetMap::Response& response) ;
+
+		/**
+		 * @brief Callback for the PublishMap service.
+		 *
+		 * Publishes a fragment of the map.
+		 *
+		 * @param request service request object
+		 * @param response service response object
+		 *
+		 * @return true if service call is correctly handled
+		 */
+		bool publishMapCallback(PublishMap::Request& request, PublishMap::Response& response) ;
+
+		/**
+		 * @brief Callback for the SaveMap service.
+		 *
+		 * Save the current map as a RGBXYZ point cloud
+		 *
+		 * @param request service request object
+		 * @param response service response object
+		 *
+		 * @return true if service call is correctly handled
+		 */
+		bool saveMapCallback(SaveMap::Request& request, SaveMap::Response& response) ;
+
+		/**
+		 * @brief Callback for the ResyncMap service.
+		 *
+		 * Returns a snapshot of the whole map together with the sequence number of the last map delta reflected in it.
+		 *
+		 * @param request service request object
+		 * @param response service response object
+		 *
+		 * @return true if service call is correctly handled
+		 */
+		bool resyncMapCallback(ResyncMap::Request& request, ResyncMap::Response& response) ;
+} ;
+
+/**
+ * @brief rounds the time stamp to miliseconds
+ *
+ * @param time_stamp time stamp to round
+ * @return rounded time stamp
+ */
+ros::Time roundTimeStamp(const ros::Time &time_stamp) ;
+
+}
+
+#endif